@@ -0,0 +1,149 @@
+#!/bin/bash
+
+# Compares builds on the test corpus by the CPU time (user + system) of
+# decompressing every file, compressing them back, and a round trip in
+# memory. CPU time is far less noisy than wall-clock time on a shared box.
+#
+# Usage: ./bench/bench.sh [RUNS] EXEC [EXEC...]
+#   e.g. ./bench/bench.sh 10 ./AoV_Zstd ./AoV_Zstd_release
+#
+# The first build is the baseline; the others are reported against it.
+#
+# With JSON=FILE, the CPU time of every run and the compression ratio are
+# also written to FILE, one NDJSON record per measure, keyed by the
+# fingerprint of the machine (see bench/compare.c and `make bench-compare`).
+# `bench.sh --fingerprint` prints the fingerprint alone.
+
+RUNS=10
+
+# Identifies the machine results come from: architecture, processors and CPU model.
+fingerprint() {
+    local model
+
+    model=$(grep -m1 'model name' /proc/cpuinfo 2>/dev/null | cut -d: -f2)
+    [ -z "$model" ] && model=$(sysctl -n machdep.cpu.brand_string 2>/dev/null)
+
+    echo "$(uname -m)-$(getconf _NPROCESSORS_ONLN)-$(printf '%s' "$model" | cksum | cut -d' ' -f1)"
+}
+
+if [ "$1" = "--fingerprint" ]; then
+    fingerprint
+    exit 0
+fi
+
+if [[ $1 =~ ^[0-9]+$ ]]; then
+    RUNS=$1
+    shift
+fi
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 [RUNS] EXEC [EXEC...]"
+    exit 1
+fi
+
+CORPUS=${CORPUS:-./tests/106_XiaoQiao}
+THREADS=${THREADS:-1}
+MACHINE=$(fingerprint)
+
+if [ -n "$JSON" ]; then
+    : > "$JSON" || exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+find "$CORPUS" -type f > "$WORK/list.txt"
+
+# Lists each file with a unique output name in DIR, so nested files do not collide.
+mapped() {
+    while IFS= read -r f; do
+        printf '%s\t%s/%s\n' "$f" "$1" "$(echo "$f" | tr '/' '_')"
+    done < "$WORK/list.txt"
+}
+
+mkdir -p "$WORK/plain" "$WORK/out"
+mapped "$WORK/plain" > "$WORK/plain.txt"
+mapped "$WORK/out" > "$WORK/out.txt"
+
+# Prints the median of the numbers on stdin.
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { print (NR % 2) ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2 }'
+}
+
+# Runs one command and prints its CPU time in microseconds.
+cputime() {
+    local TIMEFORMAT='%3U %3S'
+    local t
+
+    t=$( { time "$@" > /dev/null 2>&1; } 2>&1 )
+
+    echo "$t" | awk '{ printf "%d\n", ($1 + $2) * 1000000 }'
+}
+
+# Runs one command RUNS times and prints its median CPU time in milliseconds.
+# The time of each run is kept in $WORK/samples, in microseconds.
+measure() {
+    for ((i = 0; i < RUNS; i++)); do
+        rm -rf "$WORK/out" && mkdir "$WORK/out"
+        cp -r "$WORK/plain" "$WORK/in"
+
+        cputime "$@"
+
+        rm -rf "$WORK/in"
+    done > "$WORK/samples"
+
+    median < "$WORK/samples" | awk '{ printf "%.2f", $1 / 1000 }'
+}
+
+# Prints the total size of the files of a directory.
+dirsize() {
+    find "$1" -type f -exec cat {} + | wc -c
+}
+
+# Appends the samples of the last measure to $JSON: EXEC NAME BYTES.
+record() {
+    [ -n "$JSON" ] || return 0
+
+    printf '{"machine":"%s","exec":"%s","name":"%s","unit":"ms","bytes":%d,"samples":[%s]}\n' \
+        "$MACHINE" "$1" "$2" "$3" "$(awk '{ printf "%s%.3f", (NR > 1 ? "," : ""), $1 / 1000 }' "$WORK/samples")" >> "$JSON"
+}
+
+printf "%-28s %14s %14s %14s\n" "CPU time ($RUNS runs, -j $THREADS)" "decompress ms" "compress ms" "verify ms"
+
+declare -a base
+
+for exec in "$@"; do
+
+    # Reference plain files for the compress and verify runs.
+    rm -rf "$WORK/plain" && mkdir "$WORK/plain"
+    "$exec" -d --files-from "$WORK/plain.txt" --log-level error > /dev/null 2>&1
+
+    bytes=$(dirsize "$WORK/plain")
+
+    d=$(measure "$exec" -d --files-from "$WORK/out.txt" -j "$THREADS")
+    record "$exec" decompress "$bytes"
+    c=$(measure "$exec" -c -D "$WORK/in" -j "$THREADS")
+    record "$exec" compress "$bytes"
+    v=$(measure "$exec" --verify -D "$WORK/in" -j "$THREADS")
+    record "$exec" verify "$bytes"
+
+    # Compressed size over plain size, the same on every run.
+    if [ -n "$JSON" ]; then
+        cp -r "$WORK/plain" "$WORK/in"
+        "$exec" -c -D "$WORK/in" --log-level error > /dev/null 2>&1
+        ratio=$(awk "BEGIN { printf \"%.6f\", $(dirsize "$WORK/in") / $bytes }")
+        rm -rf "$WORK/in"
+
+        printf '{"machine":"%s","exec":"%s","name":"compress/ratio","ratio":%s}\n' "$MACHINE" "$exec" "$ratio" >> "$JSON"
+    fi
+
+    if [ ${#base[@]} -eq 0 ]; then
+        base=("$d" "$c" "$v")
+        printf "%-28s %14s %14s %14s\n" "$exec" "$d" "$c" "$v"
+    else
+        printf "%-28s %14s %14s %14s\n" "$exec" \
+            "$d ($(awk "BEGIN { printf \"%.2fx\", ${base[0]} / $d }"))" \
+            "$c ($(awk "BEGIN { printf \"%.2fx\", ${base[1]} / $c }"))" \
+            "$v ($(awk "BEGIN { printf \"%.2fx\", ${base[2]} / $v }"))"
+    fi
+done
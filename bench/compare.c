@@ -0,0 +1,399 @@
+
+
+/**
+ * Compares benchmark results against a baseline and fails on regressions.
+ *
+ * Both files hold NDJSON records as written by `bench.sh` with JSON=FILE:
+ * a record with "samples" holds the times of repeated runs (lower is
+ * better), a record with "ratio" a compression ratio, compressed over plain
+ * size (lower is better). Records are matched by "name", and baseline
+ * records by "machine" too, so one baseline file serves several machines.
+ *
+ * Times are compared with a one-sided Mann-Whitney U test: a benchmark
+ * regressed when its samples are slower with a p-value below ALPHA and its
+ * median is more than TOLERANCE and DELTA slower, so neither noise, nor a
+ * significant but negligible shift, nor the resolution of the timer fails
+ * the run. Ratios regressed when they grew by
+ * more than RATIO_TOLERANCE.
+ *
+ * Usage: compare [-a ALPHA] [-t TOLERANCE] [-d DELTA] [-r RATIO_TOLERANCE] [-m MACHINE] [--allow-missing] BASELINE CURRENT
+ * Exits with 1 on a regression, 2 when the files cannot be read or the
+ * baseline has no results for the machine, as a gate without a baseline
+ * would pass whatever the results. With --allow-missing, a missing
+ * baseline only gives a warning.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+
+/* Default significance level, and slowdown of the median tolerated. */
+#define CMP_ALPHA                 0.01
+#define CMP_TOLERANCE             0.05
+
+/* Default slowdown of the median tolerated in the unit of the samples, as
+ * bench.sh times runs to the millisecond. */
+#define CMP_DELTA                 1.0
+
+/* Default growth of the compression ratio tolerated. */
+#define CMP_RATIO_TOLERANCE       0.005
+
+#define CMP_SAMPLES_MAX           1024
+#define CMP_RECORDS_MAX           1024
+
+
+struct cmp_record {
+    char machine[128];
+    char name[128];
+
+    /* Times of the runs, or the ratio when `nsamples` is 0. */
+    double samples[CMP_SAMPLES_MAX];
+    int nsamples;
+    double ratio;
+
+    double bytes;
+};
+
+typedef struct cmp_record cmp_record;
+
+
+/**
+ * Copies the string value of `"key":"..."` in a record line.
+ *
+ * @return: `true` if the key was found.
+ */
+static bool cmp_string(const char *line, const char *key, char *out, size_t size) {
+
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+
+    const char *p = strstr(line, pattern);
+
+    if (p == NULL) {
+        return false;
+    }
+
+    p += strlen(pattern);
+
+    size_t n = 0;
+
+    while (p[n] && p[n] != '"' && n + 1 < size) {
+        n++;
+    }
+
+    memcpy(out, p, n);
+    out[n] = '\0';
+
+    return true;
+}
+
+
+/**
+ * Reads the number value of `"key":...` in a record line.
+ *
+ * @return: `true` if the key was found.
+ */
+static bool cmp_number(const char *line, const char *key, double *out) {
+
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+
+    const char *p = strstr(line, pattern);
+
+    if (p == NULL) {
+        return false;
+    }
+
+    *out = strtod(p + strlen(pattern), NULL);
+
+    return true;
+}
+
+
+/**
+ * Reads the records of a results file, keeping those of `machine` when it
+ * is given.
+ *
+ * @return: The number of records, or -1 if the file cannot be read.
+ */
+static int cmp_load(const char *path, const char *machine, cmp_record *records) {
+
+    FILE *fptr = fopen(path, "r");
+
+    if (fptr == NULL) {
+        return -1;
+    }
+
+    static char line[64 * 1024];
+    int count = 0;
+
+    while (count < CMP_RECORDS_MAX && fgets(line, sizeof(line), fptr)) {
+        cmp_record *r = &records[count];
+
+        memset(r, 0, sizeof(*r));
+
+        if (!cmp_string(line, "name", r->name, sizeof(r->name))) {
+            continue;
+        }
+
+        cmp_string(line, "machine", r->machine, sizeof(r->machine));
+
+        if (machine && strcmp(machine, r->machine) != 0) {
+            continue;
+        }
+
+        cmp_number(line, "bytes", &r->bytes);
+
+        const char *p = strstr(line, "\"samples\":[");
+
+        if (p != NULL) {
+            p += strlen("\"samples\":[");
+
+            while (*p && *p != ']' && r->nsamples < CMP_SAMPLES_MAX) {
+                char *end;
+                double v = strtod(p, &end);
+
+                if (end == p) {
+                    break;
+                }
+
+                r->samples[r->nsamples++] = v;
+                p = *end == ',' ? end + 1 : end;
+            }
+
+            if (r->nsamples == 0) {
+                continue;
+            }
+        } else if (!cmp_number(line, "ratio", &r->ratio)) {
+            continue;
+        }
+
+        count++;
+    }
+
+    fclose(fptr);
+
+    return count;
+}
+
+
+static int cmp_compareDoubles(const void *a, const void *b) {
+
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+static double cmp_median(const double *v, int n) {
+
+    double sorted[CMP_SAMPLES_MAX];
+
+    memcpy(sorted, v, (size_t)n * sizeof(double));
+    qsort(sorted, (size_t)n, sizeof(double), cmp_compareDoubles);
+
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+
+struct cmp_value {
+    double v;
+    bool current;
+};
+
+typedef struct cmp_value cmp_value;
+
+
+static int cmp_compareValues(const void *a, const void *b) {
+
+    return cmp_compareDoubles(&((const cmp_value *)a)->v, &((const cmp_value *)b)->v);
+}
+
+
+/**
+ * One-sided Mann-Whitney U test that the current samples are larger
+ * (slower) than the baseline ones, with the normal approximation
+ * corrected for ties and continuity.
+ *
+ * @return: The p-value.
+ */
+static double cmp_mannWhitney(const double *base, int nbase, const double *cur, int ncur) {
+
+    int n = nbase + ncur;
+
+    cmp_value *all = (cmp_value *)malloc((size_t)n * sizeof(cmp_value));
+
+    if (all == NULL) {
+        return 1;
+    }
+
+    for (int i = 0; i < nbase; i++) {
+        all[i] = (cmp_value){ base[i], false };
+    }
+
+    for (int i = 0; i < ncur; i++) {
+        all[nbase + i] = (cmp_value){ cur[i], true };
+    }
+
+    qsort(all, (size_t)n, sizeof(cmp_value), cmp_compareValues);
+
+    /* Sum of the ranks of the current samples, tied values sharing their average rank. */
+    double ranks = 0;
+    double ties = 0;
+
+    for (int i = 0; i < n;) {
+        int j = i;
+
+        while (j < n && all[j].v == all[i].v) {
+            j++;
+        }
+
+        double rank = (i + 1 + j) / 2.0;
+        double t = j - i;
+
+        for (int k = i; k < j; k++) {
+            if (all[k].current) {
+                ranks += rank;
+            }
+        }
+
+        ties += t * t * t - t;
+        i = j;
+    }
+
+    free(all);
+
+    double u = ranks - ncur * (ncur + 1) / 2.0;
+    double mean = (double)nbase * ncur / 2;
+    double var = (double)nbase * ncur / 12 * ((n + 1) - ties / ((double)n * (n - 1)));
+
+    if (var <= 0) {
+        return u > mean ? 0 : 1;
+    }
+
+    double z = (u - mean - 0.5) / sqrt(var);
+
+    return 0.5 * erfc(z / sqrt(2));
+}
+
+
+int main(int argc, char *argv[]) {
+
+    double alpha = CMP_ALPHA;
+    double tolerance = CMP_TOLERANCE;
+    double delta = CMP_DELTA;
+    double ratiotolerance = CMP_RATIO_TOLERANCE;
+    const char *machine = NULL;
+    bool allowmissing = false;
+    const char *paths[2] = { NULL, NULL };
+    int npaths = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            alpha = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            delta = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            ratiotolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            machine = argv[++i];
+        } else if (strcmp(argv[i], "--allow-missing") == 0) {
+            allowmissing = true;
+        } else if (argv[i][0] != '-' && npaths < 2) {
+            paths[npaths++] = argv[i];
+        } else {
+            npaths = 0;
+            break;
+        }
+    }
+
+    if (npaths != 2) {
+        fprintf(stderr, "Usage: %s [-a ALPHA] [-t TOLERANCE] [-d DELTA] [-r RATIO_TOLERANCE] [-m MACHINE] [--allow-missing] BASELINE CURRENT\n", argv[0]);
+        return 2;
+    }
+
+    static cmp_record base[CMP_RECORDS_MAX];
+    static cmp_record cur[CMP_RECORDS_MAX];
+
+    int nbase = cmp_load(paths[0], machine, base);
+    int ncur = cmp_load(paths[1], NULL, cur);
+
+    if (ncur < 0 || (nbase < 0 && !allowmissing)) {
+        fprintf(stderr, "Cannot read %s.\n", ncur < 0 ? paths[1] : paths[0]);
+        return 2;
+    }
+
+    if (nbase <= 0) {
+        fprintf(stderr, "%s: no baseline for machine %s in %s, record one with make bench-baseline.\n",
+                allowmissing ? "Warning" : "Error", machine ? machine : "(any)", paths[0]);
+        return allowmissing ? 0 : 2;
+    }
+
+    printf("%-20s %12s %12s %9s %10s %9s  %s\n", "benchmark", "baseline", "current", "change", "MB/s", "p", "verdict");
+
+    int regressions = 0;
+
+    for (int i = 0; i < ncur; i++) {
+        const cmp_record *c = &cur[i];
+        const cmp_record *b = NULL;
+
+        for (int k = 0; k < nbase && b == NULL; k++) {
+            if (strcmp(base[k].name, c->name) == 0 && (base[k].nsamples > 0) == (c->nsamples > 0)) {
+                b = &base[k];
+            }
+        }
+
+        if (b == NULL) {
+            printf("%-20s %12s %12s %9s %10s %9s  %s\n", c->name, "-", "-", "-", "-", "-", "new");
+            continue;
+        }
+
+        const char *verdict = "same";
+
+        if (c->nsamples > 0) {
+            double mbase = cmp_median(b->samples, b->nsamples);
+            double mcur = cmp_median(c->samples, c->nsamples);
+            double change = mbase > 0 ? mcur / mbase - 1 : 0;
+
+            double slower = cmp_mannWhitney(b->samples, b->nsamples, c->samples, c->nsamples);
+            double faster = cmp_mannWhitney(c->samples, c->nsamples, b->samples, b->nsamples);
+
+            if (slower < alpha && change > tolerance && mcur - mbase > delta) {
+                verdict = "REGRESSION";
+                regressions++;
+            } else if (faster < alpha && -change > tolerance && mbase - mcur > delta) {
+                verdict = "faster";
+            }
+
+            /* Throughput of the current run, when the record tells the bytes of a run (times in ms). */
+            double mbs = c->bytes > 0 && mcur > 0 ? c->bytes / mcur / 1e3 : 0;
+
+            printf("%-20s %12.3f %12.3f %+8.1f%% %10.1f %9.4f  %s\n", c->name, mbase, mcur, change * 100, mbs,
+                   slower < faster ? slower : faster, verdict);
+        } else {
+            double change = b->ratio > 0 ? c->ratio / b->ratio - 1 : 0;
+
+            if (change > ratiotolerance) {
+                verdict = "REGRESSION";
+                regressions++;
+            } else if (-change > ratiotolerance) {
+                verdict = "smaller";
+            }
+
+            printf("%-20s %12.6f %12.6f %+8.2f%% %10s %9s  %s\n", c->name, b->ratio, c->ratio, change * 100, "-", "-", verdict);
+        }
+    }
+
+    if (regressions) {
+        printf("\n%d regression%s beyond tolerance (p < %g and over %.1f%% slower, ratio over %.2f%% larger).\n",
+               regressions, regressions > 1 ? "s" : "", alpha, tolerance * 100, ratiotolerance * 100);
+    }
+
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,569 @@
+
+
+/**
+ * Microbenchmarks of the codec hot paths: the AoV header helpers, the
+ * compression and decompression calls by size class with a cold (digested
+ * per call) or warm (reused) dictionary and context, file reads and writes,
+ * and the hex preview.
+ *
+ * Every benchmark is calibrated to run for at least the sample time, then
+ * measured over several samples; the median time per operation is reported
+ * with the median absolute deviation, so one noisy sample does not move it.
+ * Allocations are counted by interposing the C allocator (glibc) and the
+ * mappings of the Zstandard workspace pool.
+ *
+ * Usage: microbench [-n SAMPLES] [-t MS] [-l LEVEL] [-f FILTER] [--json] [CORPUS]
+ *   CORPUS is a directory of AoV files, ./tests/106_XiaoQiao/skill by default.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "embed.h"
+#include "io.h"
+#include "log.h"
+#include "types.h"
+#include "utils.h"
+#include "zmem.h"
+#include "zstandard.h"
+
+
+/* Default number of samples per benchmark, and least time of one sample in milliseconds. */
+#define MB_SAMPLES                15
+#define MB_SAMPLE_MS              20
+
+#define MB_SAMPLES_MAX            101
+
+
+static _Atomic size_t mb_allocs;
+static _Atomic size_t mb_bytes;
+
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+/* Counts every allocation of the process, ours, Zstandard's and the C library's. */
+void *malloc(size_t size) {
+
+    atomic_fetch_add_explicit(&mb_allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&mb_bytes, size, memory_order_relaxed);
+
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+
+    atomic_fetch_add_explicit(&mb_allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&mb_bytes, n * size, memory_order_relaxed);
+
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+
+    atomic_fetch_add_explicit(&mb_allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&mb_bytes, size, memory_order_relaxed);
+
+    return __libc_realloc(p, size);
+}
+
+#endif
+
+
+/**
+ * Inputs shared by the benchmarks of one size class.
+ */
+struct mb_input {
+    size_t size;
+
+    /* Plain content, its AoV compressed form, and the bare frame. */
+    bytes *plain;
+    bytes *aov;
+    bytes *frame;
+
+    /* A file holding the plain content, for the I/O benchmarks. */
+    char path[256];
+};
+
+typedef struct mb_input mb_input;
+
+
+struct mb_env {
+    const bytes *dict;
+    ZSTD_aov_dict *d;
+    ZSTD_aov_ctx *ctx;
+
+    int compressionlevel;
+    mb_input *in;
+};
+
+typedef struct mb_env mb_env;
+
+
+typedef void (*mb_fn)(mb_env *env);
+
+
+/* Keeps the compiler from dropping the results of the benchmarked calls. */
+static volatile uintptr_t mb_sink;
+
+
+static bytes *mb_copy(const bytes *b) {
+
+    bytes *copy = bytes_init(b->size);
+
+    if (copy != NULL) {
+        memcpy(copy->data, b->data, b->size);
+    }
+
+    return copy;
+}
+
+
+static void mb_frameHeaderHit(mb_env *env) {
+
+    mb_sink += (uintptr_t)ZSTD_getFrameHeaderIndex(env->in->aov->data, env->in->aov->size);
+}
+
+
+/* Plain data holds no frame header: the whole buffer is searched. */
+static void mb_frameHeaderMiss(mb_env *env) {
+
+    mb_sink += (uintptr_t)ZSTD_getFrameHeaderIndex(env->in->plain->data, env->in->plain->size);
+}
+
+
+static void mb_setHeader(mb_env *env) {
+
+    bytes *b = ZSTD_setHeader(mb_copy(env->in->frame), (uint32_t)env->in->size);
+
+    mb_sink += (uintptr_t)b;
+    bytes_free(b);
+}
+
+
+static void mb_extract(mb_env *env) {
+
+    bytes *b = ZSTD_extract_CompressData(mb_copy(env->in->aov));
+
+    mb_sink += (uintptr_t)b;
+    bytes_free(b);
+}
+
+
+static void mb_compressCold(mb_env *env) {
+
+    bytes *b = ZSTD_aov_compress(mb_copy(env->in->plain), (bytes *)env->dict, env->compressionlevel);
+
+    mb_sink += (uintptr_t)b;
+    bytes_free(b);
+}
+
+
+static void mb_compressWarm(mb_env *env) {
+
+    bytes *b = ZSTD_aov_compress_usingDict(env->ctx, mb_copy(env->in->plain), env->d);
+
+    mb_sink += (uintptr_t)b;
+    bytes_free(b);
+}
+
+
+static void mb_decompressCold(mb_env *env) {
+
+    bytes *b = ZSTD_aov_decompress(mb_copy(env->in->aov), (bytes *)env->dict);
+
+    mb_sink += (uintptr_t)b;
+    bytes_free(b);
+}
+
+
+static void mb_decompressWarm(mb_env *env) {
+
+    bytes *b = ZSTD_aov_decompress_usingDict(env->ctx, mb_copy(env->in->aov), env->d);
+
+    mb_sink += (uintptr_t)b;
+    bytes_free(b);
+}
+
+
+static void mb_readFile(mb_env *env) {
+
+    bytes *b = read_file(env->in->path);
+
+    mb_sink += (uintptr_t)b;
+    bytes_free(b);
+}
+
+
+static void mb_writeFile(mb_env *env) {
+
+    mb_sink += write_file(env->in->path, env->in->plain);
+}
+
+
+static void mb_preview(mb_env *env) {
+
+    preview(env->in->plain, 0, 128, 16);
+}
+
+
+struct mb_bench {
+    const char *name;
+    mb_fn fn;
+
+    /* Whether the benchmark runs once per size class, or only on the smallest. */
+    bool sized;
+};
+
+typedef struct mb_bench mb_bench;
+
+
+static const mb_bench mb_benches[] = {
+    { "frameheader/hit",     mb_frameHeaderHit,  false },
+    { "frameheader/miss",    mb_frameHeaderMiss, true  },
+    { "setheader",           mb_setHeader,       true  },
+    { "extract",             mb_extract,         true  },
+    { "compress/cold",       mb_compressCold,    true  },
+    { "compress/warm",       mb_compressWarm,    true  },
+    { "decompress/cold",     mb_decompressCold,  true  },
+    { "decompress/warm",     mb_decompressWarm,  true  },
+    { "read_file",           mb_readFile,        true  },
+    { "write_file",          mb_writeFile,       true  },
+    { "preview",             mb_preview,         false },
+};
+
+
+static const size_t mb_sizes[] = { 1024, 16 * 1024, 256 * 1024, 1024 * 1024 };
+
+#define MB_SIZES                  (sizeof(mb_sizes) / sizeof(mb_sizes[0]))
+
+
+static int mb_compareDoubles(const void *a, const void *b) {
+
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+static double mb_median(double *v, int n) {
+
+    qsort(v, (size_t)n, sizeof(double), mb_compareDoubles);
+
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+
+/**
+ * Runs one benchmark: finds the number of operations that fills a sample,
+ * then times `nsamples` samples of that many operations.
+ *
+ * @param samples: Receives the time per operation of each sample, in nanoseconds.
+ * @param allocs: Receives the allocations per operation.
+ * @param allocated: Receives the bytes allocated per operation.
+ * @return: The number of operations per sample.
+ */
+static uint64_t mb_run(mb_fn fn, mb_env *env, int nsamples, uint64_t sample_ns,
+                       double *samples, double *allocs, double *allocated) {
+
+    /* The first call warms the caches, the pools and, for warm benchmarks, the context. */
+    fn(env);
+
+    uint64_t iters = 1;
+
+    for (;;) {
+        uint64_t start = time_ns();
+
+        for (uint64_t i = 0; i < iters; i++) {
+            fn(env);
+        }
+
+        uint64_t elapsed = time_ns() - start;
+
+        if (elapsed >= sample_ns || iters >= ((uint64_t)1 << 40)) {
+            break;
+        }
+
+        /* Aim past the sample time, at most 10 times more operations at once. */
+        uint64_t next = elapsed ? iters * sample_ns / elapsed * 5 / 4 + 1 : iters * 10;
+
+        iters = next > iters * 10 ? iters * 10 : next;
+    }
+
+    zmem_stats zs;
+    zmem_getStats(&zs);
+
+    size_t maps = zs.maps;
+    size_t nallocs = atomic_load(&mb_allocs);
+    size_t nbytes = atomic_load(&mb_bytes);
+
+    for (int s = 0; s < nsamples; s++) {
+        uint64_t start = time_ns();
+
+        for (uint64_t i = 0; i < iters; i++) {
+            fn(env);
+        }
+
+        samples[s] = (double)(time_ns() - start) / (double)iters;
+    }
+
+    zmem_getStats(&zs);
+
+    double ops = (double)iters * nsamples;
+
+    *allocs = (double)(atomic_load(&mb_allocs) - nallocs + zs.maps - maps) / ops;
+    *allocated = (double)(atomic_load(&mb_bytes) - nbytes) / ops;
+
+    return iters;
+}
+
+
+/**
+ * Builds the inputs of a size class from the plain corpus, repeated as
+ * needed, and writes its file for the I/O benchmarks.
+ */
+static bool mb_prepare(mb_input *in, size_t size, const bytes *corpus, mb_env *env, const char *tmpdir) {
+
+    in->size = size;
+    in->plain = bytes_init(size);
+
+    if (in->plain == NULL) {
+        return false;
+    }
+
+    for (size_t off = 0; off < size; off += corpus->size) {
+        size_t n = size - off < corpus->size ? size - off : corpus->size;
+        memcpy(in->plain->data + off, corpus->data, n);
+    }
+
+    in->aov = ZSTD_aov_compress_usingDict(env->ctx, mb_copy(in->plain), env->d);
+    in->frame = in->aov ? mb_copy(in->aov) : NULL;
+
+    if (in->frame == NULL || (in->frame = ZSTD_extract_CompressData(in->frame)) == NULL) {
+        return false;
+    }
+
+    snprintf(in->path, sizeof(in->path), "%s/%zu.xml", tmpdir, size);
+
+    return write_file(in->path, in->plain);
+}
+
+
+/**
+ * Reads every AoV file of the corpus directory and joins their plain
+ * contents.
+ */
+static bytes *mb_corpus(const char *dir, mb_env *env) {
+
+    batch bt;
+    batch_init(&bt);
+
+    bytes *corpus = NULL;
+
+    if (batch_addDir(&bt, dir, NULL)) {
+        corpus = bytes_init(0);
+
+        for (size_t i = 0; corpus && i < bt.count; i++) {
+            bytes *b = read_file(bt.jobs[i].input);
+
+            if (b == NULL || b->size < HEADER_SIZE || !ZSTD_isHeader(b->data)) {
+                bytes_free(b);
+                continue;
+            }
+
+            b = ZSTD_aov_decompress_usingDict(env->ctx, b, env->d);
+
+            if (b != NULL && bytes_reserve(corpus, corpus->size + b->size)) {
+                memcpy(corpus->data + corpus->size, b->data, b->size);
+                corpus->size += b->size;
+            }
+
+            bytes_free(b);
+        }
+    }
+
+    batch_free(&bt);
+
+    if (corpus && corpus->size == 0) {
+        bytes_free(corpus);
+        corpus = NULL;
+    }
+
+    return corpus;
+}
+
+
+static void mb_formatSize(size_t size, char *out, size_t len) {
+
+    if (size >= 1024 * 1024) {
+        snprintf(out, len, "%zuM", size / (1024 * 1024));
+    } else {
+        snprintf(out, len, "%zuK", size / 1024);
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+
+    int nsamples = MB_SAMPLES;
+    int sample_ms = MB_SAMPLE_MS;
+    int level = ZSTD_aov_compressionlevel;
+    const char *filter = NULL;
+    const char *corpusdir = "./tests/106_XiaoQiao/skill";
+    bool json = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            nsamples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            sample_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            level = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [-n SAMPLES] [-t MS] [-l LEVEL] [-f FILTER] [--json] [CORPUS]\n", argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            corpusdir = argv[i];
+        }
+    }
+
+    if (nsamples < 1 || nsamples > MB_SAMPLES_MAX || sample_ms < 1 || !ZSTD_checkCLevel(level)) {
+        fprintf(stderr, "Invalid samples (1 to %d), sample time or level.\n", MB_SAMPLES_MAX);
+        return EXIT_FAILURE;
+    }
+
+    zmem_init(false);
+
+    /* The preview is only built when it is logged: log it, to nowhere. */
+    FILE *sink = fopen("/dev/null", "w");
+    log_init(sink ? sink : stderr, LOG_INFO, LOG_FORMAT_TEXT);
+
+    bytes *loaded = NULL;
+    const bytes *dict = embed_dictionary();
+
+    if (dict == NULL) {
+        dict = loaded = ZSTD_loadDictionary("./bin/dict.zst");
+    }
+
+    mb_env env = { dict, ZSTD_aov_createDict(dict, level), ZSTD_aov_createCtx(), level, NULL };
+
+    bytes *corpus = env.d && env.ctx ? mb_corpus(corpusdir, &env) : NULL;
+
+    if (corpus == NULL) {
+        fprintf(stderr, "Cannot load the dictionary or the corpus: %s\n", corpusdir);
+        return EXIT_FAILURE;
+    }
+
+    char tmpdir[] = "/tmp/microbench.XXXXXX";
+
+    if (mkdtemp(tmpdir) == NULL) {
+        fprintf(stderr, "Cannot create a temporary directory.\n");
+        return EXIT_FAILURE;
+    }
+
+    mb_input inputs[MB_SIZES];
+    memset(inputs, 0, sizeof(inputs));
+
+    bool ok = true;
+
+    for (size_t s = 0; s < MB_SIZES && ok; s++) {
+        ok = mb_prepare(&inputs[s], mb_sizes[s], corpus, &env, tmpdir);
+    }
+
+    if (!json) {
+        printf("Corpus %s (%zu bytes), level %d, %d samples of at least %d ms\n\n",
+               corpusdir, corpus->size, level, nsamples, sample_ms);
+        printf("%-24s %14s %8s %10s %12s %10s\n", "benchmark", "ns/op", "mad", "MB/s", "B/op", "allocs/op");
+    }
+
+    double samples[MB_SAMPLES_MAX];
+    double deviations[MB_SAMPLES_MAX];
+
+    for (size_t b = 0; b < sizeof(mb_benches) / sizeof(mb_benches[0]) && ok; b++) {
+        const mb_bench *mb = &mb_benches[b];
+
+        for (size_t s = 0; s < (mb->sized ? MB_SIZES : 1); s++) {
+            char name[64];
+            char size[16];
+
+            mb_formatSize(mb_sizes[s], size, sizeof(size));
+            snprintf(name, sizeof(name), "%s/%s", mb->name, size);
+
+            if (filter && strstr(name, filter) == NULL) {
+                continue;
+            }
+
+            env.in = &inputs[s];
+
+            double allocs = 0;
+            double allocated = 0;
+
+            uint64_t iters = mb_run(mb->fn, &env, nsamples, (uint64_t)sample_ms * 1000000,
+                                    samples, &allocs, &allocated);
+
+            double median = mb_median(samples, nsamples);
+
+            for (int i = 0; i < nsamples; i++) {
+                deviations[i] = samples[i] > median ? samples[i] - median : median - samples[i];
+            }
+
+            double mad = mb_median(deviations, nsamples);
+            double mbs = median > 0 ? (double)mb_sizes[s] / median * 1e3 : 0;
+
+            if (json) {
+                printf("{\"name\":\"%s\",\"size\":%zu,\"iters\":%llu,\"ns_op\":%.2f,\"mad\":%.2f,"
+                       "\"bytes_op\":%.1f,\"allocs_op\":%.3f,\"samples\":[",
+                       name, mb_sizes[s], (unsigned long long)iters, median, mad, allocated, allocs);
+
+                for (int i = 0; i < nsamples; i++) {
+                    printf("%s%.2f", i ? "," : "", samples[i]);
+                }
+
+                printf("]}\n");
+            } else {
+                printf("%-24s %14.1f %7.1f%% %10.1f %12.0f %10.2f\n", name, median,
+                       median > 0 ? mad / median * 100 : 0, mbs, allocated, allocs);
+            }
+
+            fflush(stdout);
+        }
+    }
+
+    for (size_t s = 0; s < MB_SIZES; s++) {
+        if (inputs[s].path[0]) {
+            unlink(inputs[s].path);
+        }
+
+        bytes_free(inputs[s].plain);
+        bytes_free(inputs[s].aov);
+        bytes_free(inputs[s].frame);
+    }
+
+    rmdir(tmpdir);
+
+    bytes_free(corpus);
+    ZSTD_aov_freeCtx(env.ctx);
+    ZSTD_aov_freeDict(env.d);
+    bytes_free(loaded);
+
+    log_shutdown();
+
+    if (sink) {
+        fclose(sink);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
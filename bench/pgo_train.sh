@@ -0,0 +1,33 @@
+#!/bin/bash
+
+# Records the PGO profile for `make release`: runs an instrumented build
+# over the test corpus in both directions, in batch and streaming modes.
+#
+# Usage: ./bench/pgo_train.sh ./AoV_Zstd_release
+
+EXEC=${1:-./AoV_Zstd_release}
+CORPUS=${CORPUS:-./tests/106_XiaoQiao}
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+find "$CORPUS" -type f > "$WORK/list.txt"
+
+for round in 1 2 3; do
+
+    # Decompress the game files, then compress them back.
+    "$EXEC" -d --files-from "$WORK/list.txt" -o "$WORK/plain" --log-level error -j 2 > /dev/null || exit 1
+    cp -r "$WORK/plain" "$WORK/packed"
+    "$EXEC" -c -D "$WORK/packed" --log-level error -j 2 > /dev/null || exit 1
+
+    # Round trip in memory and through pipes, single-threaded.
+    "$EXEC" --verify -D "$WORK/plain" --log-level error -j 1 > /dev/null || exit 1
+
+    for f in "$WORK"/plain/*; do
+        "$EXEC" -c -f - < "$f" | "$EXEC" -d -f - > /dev/null || exit 1
+    done
+
+    rm -rf "$WORK/plain" "$WORK/packed"
+done
+
+echo "Recorded the profile on $(wc -l < "$WORK/list.txt") files."
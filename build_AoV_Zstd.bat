@@ -10,39 +10,111 @@ echo Building AoV_Zstd Project. . .
 echo.
 
 :: Compile Zstandard library
-echo [1/9] Compiling Zstandard library. . .
+echo [1/20] Compiling Zstandard library. . .
 gcc -c -o ./build/zstd.o ./lib/zstd/*.c -I./include/zstd/ -fPIC
 if errorlevel 1 (
     echo [Error] Failed to compile Zstandard library!
     exit /b 1
 )
 
+:: Compile aes.c
+echo [2/20] Compiling aes.c. . .
+gcc -c -o ./build/aes.o ./src/aes.c -I./src/ -fPIC
+if errorlevel 1 (
+    echo [Error] Failed to compile aes.c!
+    exit /b 1
+)
+
 :: Compile args.c
-echo [2/9] Compiling args.c. . .
+echo [3/20] Compiling args.c. . .
 gcc -c -o ./build/args.o ./src/args.c -I./src/ -I./include/zstd/ -fPIC
 if errorlevel 1 (
     echo [Error] Failed to compile args.c!
     exit /b 1
 )
 
+:: Compile batch.c
+echo [4/20] Compiling batch.c. . .
+gcc -c -o ./build/batch.o ./src/batch.c -I./src/ -I./include/ -I./include/zstd/ -fPIC
+if errorlevel 1 (
+    echo [Error] Failed to compile batch.c!
+    exit /b 1
+)
+
+:: Compile embed.c
+echo [5/20] Compiling embed.c. . .
+gcc -c -o ./build/embed.o ./src/embed.c -I./src/ -fPIC
+if errorlevel 1 (
+    echo [Error] Failed to compile embed.c!
+    exit /b 1
+)
+
+:: Compile estimate.c
+echo [6/20] Compiling estimate.c. . .
+gcc -c -o ./build/estimate.o ./src/estimate.c -I./src/ -I./include/zstd/ -fPIC
+if errorlevel 1 (
+    echo [Error] Failed to compile estimate.c!
+    exit /b 1
+)
+
 :: Compile io.c
-echo [3/9] Compiling io.c. . .
+echo [7/20] Compiling io.c. . .
 gcc -c -o ./build/io.o ./src/io.c -I./src/ -fPIC
 if errorlevel 1 (
     echo [Error] Failed to compile io.c!
     exit /b 1
 )
 
+:: Compile log.c
+echo [8/20] Compiling log.c. . .
+gcc -c -o ./build/log.o ./src/log.c -I./src/ -fPIC
+if errorlevel 1 (
+    echo [Error] Failed to compile log.c!
+    exit /b 1
+)
+
+:: Compile match.c
+echo [9/20] Compiling match.c. . .
+gcc -c -o ./build/match.o ./src/match.c -I./src/ -I./include/zstd/ -fPIC
+if errorlevel 1 (
+    echo [Error] Failed to compile match.c!
+    exit /b 1
+)
+
 :: Compile message.c
-echo [4/9] Compiling message.c. . .
+echo [10/20] Compiling message.c. . .
 gcc -c -o ./build/message.o ./src/message.c -I./src/ -fPIC
 if errorlevel 1 (
     echo [Error] Failed to compile message.c!
     exit /b 1
 )
 
+:: Compile pool.c
+echo [11/20] Compiling pool.c. . .
+gcc -c -o ./build/pool.o ./src/pool.c -I./src/ -fPIC
+if errorlevel 1 (
+    echo [Error] Failed to compile pool.c!
+    exit /b 1
+)
+
+:: Compile scan.c
+echo [12/20] Compiling scan.c. . .
+gcc -c -o ./build/scan.o ./src/scan.c -I./src/ -I./include/zstd/ -fPIC
+if errorlevel 1 (
+    echo [Error] Failed to compile scan.c!
+    exit /b 1
+)
+
+:: Compile server.c
+echo [13/20] Compiling server.c. . .
+gcc -c -o ./build/server.o ./src/server.c -I./src/ -I./include/zstd/ -fPIC
+if errorlevel 1 (
+    echo [Error] Failed to compile server.c!
+    exit /b 1
+)
+
 :: Compile utils.c
-echo [5/9] Compiling utils.c. . .
+echo [14/20] Compiling utils.c. . .
 gcc -c -o ./build/utils.o ./src/utils.c -I./src/ -I./include/zstd/ -fPIC
 if errorlevel 1 (
     echo [Error] Failed to compile utils.c!
@@ -50,15 +122,31 @@ if errorlevel 1 (
 )
 
 :: Compile version.c
-echo [6/9] Compiling version.c. . .
+echo [15/20] Compiling version.c. . .
 gcc -c -o ./build/version.o ./src/version.c -I./src/ -fPIC
 if errorlevel 1 (
     echo [Error] Failed to compile version.c!
     exit /b 1
 )
 
+:: Compile workers.c
+echo [16/20] Compiling workers.c. . .
+gcc -c -o ./build/workers.o ./src/workers.c -I./src/ -fPIC
+if errorlevel 1 (
+    echo [Error] Failed to compile workers.c!
+    exit /b 1
+)
+
+:: Compile zmem.c
+echo [17/20] Compiling zmem.c. . .
+gcc -c -o ./build/zmem.o ./src/zmem.c -I./src/ -I./include/zstd/ -fPIC
+if errorlevel 1 (
+    echo [Error] Failed to compile zmem.c!
+    exit /b 1
+)
+
 :: Compile zstandard.c
-echo [7/9] Compiling zstandard.c. . .
+echo [18/20] Compiling zstandard.c. . .
 gcc -c -o ./build/zstandard.o ./src/zstandard.c -I./src/ -I./include/zstd/ -fPIC
 if errorlevel 1 (
     echo [Error] Failed to compile zstandard.c!
@@ -66,7 +154,7 @@ if errorlevel 1 (
 )
 
 :: Compile main.c
-echo [8/9] Compiling main.c. . .
+echo [19/20] Compiling main.c. . .
 gcc -c -o ./build/main.o ./src/main.c -I./include/ -I./include/zstd/ -fPIC
 if errorlevel 1 (
     echo [Error] Failed to compile main.c!
@@ -74,7 +162,7 @@ if errorlevel 1 (
 )
 
 :: Compile the icon file
-echo [9/9] Compiling icon file. . .
+echo [20/20] Compiling icon file. . .
 windres ./icon.rc -O coff -o ./build/icon.o
 if errorlevel 1 (
     echo [Error] Failed to compile icon file!
@@ -84,7 +172,7 @@ if errorlevel 1 (
 :: Linking all object files directly into the executable
 echo.
 echo Creating AoV_Zstd.exe. . .
-gcc -o AoV_Zstd.exe ./build/*.o
+gcc -o AoV_Zstd.exe ./build/*.o -pthread
 if errorlevel 1 (
     echo [Error] Failed to create executable!
     exit /b 1
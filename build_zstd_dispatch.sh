@@ -0,0 +1,100 @@
+#!/bin/bash
+
+# Generates the runtime dispatcher of the bundled Zstandard.
+#
+# The release build compiles ./lib/zstd/zstd.c once per ISA level and renames
+# every global symbol of each copy to "zstd_<isa>_<symbol>". This script reads
+# the public API (ZSTD_* and ZDICT_* functions) from one of those copies and
+# prints a C file binding each public name, through a GNU ifunc, to the copy
+# of the best ISA level the CPU supports. The choice is made once, while the
+# program is loaded and before the environment is readable, so it cannot be
+# overridden at run time; build with fewer levels to compare them.
+#
+# Usage: build_zstd_dispatch.sh <object of the first isa> <isa>...
+# The levels are listed from the lowest, which must run on any x86-64 CPU.
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <object> <isa>..." >&2
+    exit 1
+fi
+
+OBJECT=$1
+shift
+
+ISAS=("$@")
+FIRST=${ISAS[0]}
+
+SYMBOLS=$(nm -g --defined-only "$OBJECT" | awk -v p="zstd_${FIRST}_" '$2 == "T" && index($3, p) == 1 { s = substr($3, length(p) + 1); if (s ~ /^(ZSTD|ZDICT)_/) print s }')
+
+if [ -z "$SYMBOLS" ]; then
+    echo "No Zstandard symbols found in $OBJECT. Exiting. . ." >&2
+    exit 1
+fi
+
+cat <<EOF
+/* Generated by build_zstd_dispatch.sh from $(basename "$OBJECT"), do not edit. */
+
+#include <string.h>
+
+static const char *const zstd_isas[] = {
+EOF
+
+for isa in "${ISAS[@]}"; do
+    echo "    \"$isa\","
+done
+
+cat <<EOF
+};
+
+static int zstd_isa = -1;
+
+/* Whether the CPU (and the OS, for the wider registers) runs code built for the level. */
+static int zstd_supports(int i) {
+
+    const char *isa = zstd_isas[i];
+
+    if (strcmp(isa, "v2") == 0) return __builtin_cpu_supports("x86-64-v2");
+    if (strcmp(isa, "v3") == 0) return __builtin_cpu_supports("x86-64-v3");
+    if (strcmp(isa, "v4") == 0) return __builtin_cpu_supports("x86-64-v4");
+
+    return 1;
+}
+
+/* Resolvers run before constructors, so the CPU model is initialized here. */
+static int zstd_select(void) {
+
+    if (zstd_isa < 0) {
+
+        __builtin_cpu_init();
+
+        int isa = 0;
+
+        for (int i = 1; i < (int)(sizeof(zstd_isas) / sizeof(zstd_isas[0])) && zstd_supports(i); i++) {
+            isa = i;
+        }
+
+        zstd_isa = isa;
+    }
+
+    return zstd_isa;
+}
+
+/* Name of the ISA level the Zstandard calls run on. */
+const char *ZSTD_aov_isa(void) {
+    return zstd_isas[zstd_select()];
+}
+
+EOF
+
+for sym in $SYMBOLS; do
+    decls=""
+    table=""
+    for isa in "${ISAS[@]}"; do
+        decls+="${decls:+, }zstd_${isa}_${sym}[]"
+        table+="${table:+, }zstd_${isa}_${sym}"
+    done
+    echo "extern char $decls;"
+    echo "static void *resolve_${sym}(void) { void *v[] = { $table }; return v[zstd_select()]; }"
+    echo "void ${sym}(void) __attribute__((ifunc(\"resolve_${sym}\")));"
+    echo
+done
@@ -0,0 +1,8 @@
+
+
+#include "aes.h"
+#include "types.h"
+
+
+/* This header is used to identify the uncompressed data.*/
+const byte AES_HEADER[HEADER_SIZE] = {0x22, 0x4A, 0x67, 0x00};
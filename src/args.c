@@ -6,6 +6,9 @@
 #include <string.h>
 
 #include "args.h"
+#include "estimate.h"
+#include "io.h"
+#include "log.h"
 #include "message.h"
 #include "utils.h"
 #include "version.h"
@@ -24,9 +27,74 @@ extern void args_init(arguments *args) {
     args->compressionlevel = 0;      /* Compression level defaults to 0. */
     args->dir = NULL;                /* Directory is NULL by default. */
     args->file = NULL;               /* File is NULL by default. */
+    args->fileslist = NULL;          /* File list is NULL by default. */
     args->output = NULL;             /* Output file path is NULL by default. */
+    args->serve = NULL;              /* Not running as a daemon by default. */
     args->verbose = false;           /* Verbose output is off by default. */
+    args->threads = 0;               /* One worker thread per processor by default. */
+    args->maxmemory = -1;            /* Memory budget from the memory limit by default. */
+    args->verify = false;            /* Files are written by default. */
+    args->scan = false;              /* Files are processed by default. */
+    args->matchoriginal = false;     /* No settings search by default. */
+    args->estimate = 0;              /* No estimate by default. */
+    args->batch = false;             /* Interactive output by default. */
+    args->hugepages = false;         /* Regular pages by default. */
+    args->pin = false;               /* Worker threads float between processors by default. */
+    args->profile = NULL;            /* No compression profile by default. */
+    args->zstdparams = NULL;         /* No parameter overrides by default. */
+    args->dict = NULL;               /* Dictionary found in bin/ by default. */
+    args->dictdir = NULL;            /* A single dictionary by default. */
+    args->patchfrom = NULL;          /* Whole files, no patches, by default. */
+    memset(&args->params, 0, sizeof(args->params));
     args->version = false;           /* Version flag is off by default. */
+    args->loglevel = -1;             /* Log level follows the verbose flag by default. */
+    args->logjson = false;           /* Logs are human readable by default. */
+    args->_conflict = 0;             /* No conflicting options yet. */
+}
+
+
+/**
+ * Parses a size in bytes with an optional binary suffix (K, M, G or T).
+ *
+ * @param text: The size as given on the command line.
+ * @param size: Receives the size in bytes.
+ * @return: `true` if `text` is a valid size, `false` otherwise.
+ */
+static bool parse_size(const char *text, long long *size) {
+
+    char *end = NULL;
+    unsigned long long n = strtoull(text, &end, 10);
+
+    if (end == text || *text == '-') {
+        return false;
+    }
+
+    int shift = 0;
+
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        case 't': case 'T': shift = 40; end++; break;
+        default: break;
+    }
+
+    /* Accept "M" as well as "MiB" or "MB", all in binary units. */
+    if (shift && (*end == 'i' || *end == 'I')) {
+        end++;
+    }
+
+    if (shift && (*end == 'b' || *end == 'B')) {
+        end++;
+    }
+
+    if (*end != '\0' || n > (unsigned long long)(LLONG_MAX >> shift)) {
+        return false;
+    }
+
+    *size = (long long)(n << shift);
+
+    return true;
 }
 
 
@@ -40,7 +108,7 @@ extern void args_init(arguments *args) {
 extern void args_parse(int argc, char *argv[], arguments *args) {
 
     /* The short options string. */
-    static const char *options = "cdl:D:f:o:Vhv";
+    static const char *options = "cdl:D:f:o:j:Vhv";
 
     /* The long options structure. */
     static const struct option long_options[] = {
@@ -53,6 +121,24 @@ extern void args_parse(int argc, char *argv[], arguments *args) {
         { "verbose",          no_argument,       NULL, OPT_VERBOSE }, 
         { "version",          no_argument,       NULL, OPT_VERSION }, 
         { "help",             no_argument,       NULL, OPT_HELP }, 
+        { "log-level",        required_argument, NULL, OPT_LOG_LEVEL }, 
+        { "log-json",         no_argument,       NULL, OPT_LOG_JSON }, 
+        { "files-from",       required_argument, NULL, OPT_FILES_FROM }, 
+        { "serve",            required_argument, NULL, OPT_SERVE }, 
+        { "threads",          required_argument, NULL, OPT_THREADS }, 
+        { "verify",           no_argument,       NULL, OPT_VERIFY }, 
+        { "scan",             no_argument,       NULL, OPT_SCAN }, 
+        { "huge-pages",       no_argument,       NULL, OPT_HUGE_PAGES }, 
+        { "profile",          required_argument, NULL, OPT_PROFILE }, 
+        { "zstd",             required_argument, NULL, OPT_ZSTD }, 
+        { "match-original",   no_argument,       NULL, OPT_MATCH_ORIGINAL }, 
+        { "patch-from",       required_argument, NULL, OPT_PATCH_FROM }, 
+        { "dict",             required_argument, NULL, OPT_DICT }, 
+        { "dict-dir",         required_argument, NULL, OPT_DICT_DIR }, 
+        { "batch",            no_argument,       NULL, OPT_BATCH }, 
+        { "max-memory",       required_argument, NULL, OPT_MAX_MEMORY }, 
+        { "pin",              no_argument,       NULL, OPT_PIN }, 
+        { "estimate",         optional_argument, NULL, OPT_ESTIMATE }, 
         { NULL,               0,                 NULL, OPT_NONE }
     };
 
@@ -67,7 +153,7 @@ extern void args_parse(int argc, char *argv[], arguments *args) {
 
     /* Track the position of options for conflict detection. */
     int pos = 1;
-    option_position optpos[] = {{-1}, {-1}, {-1}, {-1}, {-1}, {-1}, {-1}};
+    option_position optpos[] = {{-1}, {-1}, {-1}, {-1}, {-1}, {-1}, {-1}, {-1}};
 
     while ((option = getopt_long(argc, argv, options, long_options, NULL)) != -1) {
         switch (option) {
@@ -82,6 +168,14 @@ extern void args_parse(int argc, char *argv[], arguments *args) {
 
                 if (ZSTD_checkCLevel(clevel)) {
                     args->compressionlevel = clevel;
+                } else {
+                    char message[96];
+
+                    snprintf(message, sizeof(message), "expects a compression level between 1 and %d, not '%s'",
+                             ZSTD_maxCLevel(), optarg);
+                    opt_warn("-l", message);
+
+                    args->_conflict = IS_CONFLICT;
                 }
 
                 optpos->compressionlevel = pos++;
@@ -114,6 +208,84 @@ extern void args_parse(int argc, char *argv[], arguments *args) {
                 optpos->file = pos++;
                 break;
 
+            case OPT_FILES_FROM:
+                args->fileslist = optarg;
+                optpos->fileslist = pos++;
+                break;
+
+            case OPT_THREADS:
+                args->threads = atoi(optarg);
+
+                if (args->threads < 0) {
+                    opt_warn("-j", "expects a positive number of threads, or 0 for one per processor");
+                    args->_conflict = IS_CONFLICT;
+                }
+                break;
+
+            case OPT_MAX_MEMORY:
+                if (!parse_size(optarg, &args->maxmemory)) {
+                    opt_warn("--max-memory", "expects a size in bytes, with an optional K, M, G or T suffix, or 0 for no limit");
+                    args->_conflict = IS_CONFLICT;
+                }
+                break;
+
+            case OPT_VERIFY:
+                args->verify = true;
+                break;
+
+            case OPT_SCAN:
+                args->scan = true;
+                break;
+
+            case OPT_MATCH_ORIGINAL:
+                args->matchoriginal = true;
+                break;
+
+            case OPT_ESTIMATE:
+                args->estimate = optarg ? atoi(optarg) : ESTIMATE_SAMPLES;
+
+                if (args->estimate < 2) {
+                    opt_warn("--estimate", "expects a number of samples of at least 2, as in --estimate=500");
+                    args->_conflict = IS_CONFLICT;
+                }
+                break;
+
+            case OPT_PATCH_FROM:
+                args->patchfrom = optarg;
+                break;
+
+            case OPT_BATCH:
+                args->batch = true;
+                break;
+
+            case OPT_DICT:
+                args->dict = optarg;
+                break;
+
+            case OPT_DICT_DIR:
+                args->dictdir = optarg;
+                break;
+
+            case OPT_HUGE_PAGES:
+                args->hugepages = true;
+                break;
+
+            case OPT_PIN:
+                args->pin = true;
+                break;
+
+            case OPT_PROFILE:
+                args->profile = optarg;
+                break;
+
+            case OPT_ZSTD:
+                args->zstdparams = optarg;
+                break;
+
+            case OPT_SERVE:
+                args->serve = optarg;
+                break;
+
             case OPT_OUTPUT:
                 args->output = optarg;
                 optpos->output = pos++;
@@ -124,6 +296,19 @@ extern void args_parse(int argc, char *argv[], arguments *args) {
                 optpos->verbose = pos++;
                 break;
 
+            case OPT_LOG_LEVEL:
+                args->loglevel = log_parseLevel(optarg);
+
+                if (args->loglevel < 0) {
+                    opt_warn("--log-level", "expects one of error, warn, info or debug");
+                    args->_conflict = IS_CONFLICT;
+                }
+                break;
+
+            case OPT_LOG_JSON:
+                args->logjson = true;
+                break;
+
             case OPT_VERSION:
                 version();
                 exit(EXIT_SUCCESS);
@@ -190,6 +375,143 @@ extern void args_parse(int argc, char *argv[], arguments *args) {
         args->_conflict = IS_CONFLICT;
     }
 
+    if (args->fileslist && (args->dir || args->file)) {
+
+        printf("[%-7s] command line options: \033[0;31m--files-from -%c\n\033[0;37m", "ERROR", args->dir ? OPT_DIR : OPT_FILE);
+        printf("          cannot use --files-from together with -f (--file) or -D (--dir).\n");
+
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->fileslist && isstdio(args->output)) {
+        opt_warn("-o -", "cannot be used with --files-from");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->dir && isstdio(args->output)) {
+
+        opterr->pos_1 = optpos->dir;
+        opterr->pos_2 = optpos->output;
+
+        opterr->opt_1 = OPT_DIR;
+        opterr->opt_2 = OPT_OUTPUT;
+
+        opt_error(opterr);
+
+        printf("          cannot write a directory to stdout.\n");
+        printf("          use '-o -' together with -f (--file) only.\n");
+
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (isstdio(args->dir)) {
+        opt_warn("-D -", "is not supported, use -f - to read from stdin");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->serve && (args->dir || args->file || args->fileslist || args->output || args->decompress)) {
+        opt_warn("--serve", "takes requests from clients and cannot be combined with -d, -f, -D, --files-from or -o");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->verify && (args->decompress || args->output)) {
+        opt_warn("--verify", "writes nothing and cannot be combined with -d or -o");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->verify && (isstdio(args->file) || args->serve)) {
+        opt_warn("--verify", "needs files, it cannot read stdin or run as a daemon");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->scan && (args->compress || args->decompress || args->verify || args->output || args->serve)) {
+        opt_warn("--scan", "only reports files and cannot be combined with -c, -d, -o, --verify or --serve");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->scan && isstdio(args->file)) {
+        opt_warn("--scan", "needs files, it cannot read stdin");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->matchoriginal && (args->compress || args->decompress || args->verify || args->scan || args->output || args->serve)) {
+        opt_warn("--match-original", "only reports settings and cannot be combined with -c, -d, -o, --verify, --scan or --serve");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->matchoriginal && (isstdio(args->file) || args->compressionlevel || args->profile || args->zstdparams)) {
+        opt_warn("--match-original", "needs files and searches the level and parameters itself, without stdin, -l, --profile or --zstd");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->estimate && (args->decompress || args->verify || args->scan || args->matchoriginal || args->batch
+                           || args->output || args->serve || args->patchfrom)) {
+        opt_warn("--estimate", "only reports the expected size and time of compressing (-c) and cannot be combined "
+                 "with -d, -o, --verify, --scan, --match-original, --batch, --serve or --patch-from");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->estimate && isstdio(args->file)) {
+        opt_warn("--estimate", "needs files, it cannot read stdin");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->patchfrom && (args->verify || args->scan || args->matchoriginal || args->serve || args->profile || args->zstdparams)) {
+        opt_warn("--patch-from", "makes (-c) or applies (-d) patches and cannot be combined with --verify, --scan, "
+                 "--match-original, --serve, --profile or --zstd");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->patchfrom && (!args->output || isstdio(args->output) || isstdio(args->file))) {
+        opt_warn("--patch-from", "needs files and -o, so the inputs are not replaced by patches");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->batch && (args->verify || args->scan || args->matchoriginal || args->serve)) {
+        opt_warn("--batch", "reports files compressed (-c) or decompressed (-d) and cannot be combined with --verify, "
+                 "--scan, --match-original or --serve");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->batch && (isstdio(args->file) || isstdio(args->output))) {
+        opt_warn("--batch", "prints its records on stdout, so files cannot be read from stdin or written to stdout");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->dictdir && !isdir(args->dictdir)) {
+        opt_warn("--dict-dir", "expects a directory of dictionaries");
+        args->_conflict = IS_CONFLICT;
+    }
+
+    if (args->profile) {
+        const ZSTD_aov_profile *profile = ZSTD_aov_getProfile(args->profile);
+
+        if (profile == NULL) {
+            opt_warn("--profile", "expects fast-iterate, ship or max");
+            args->_conflict = IS_CONFLICT;
+        } else {
+            /* An explicit -l takes precedence over the level of the profile. */
+            if (!args->compressionlevel) {
+                args->compressionlevel = profile->compressionlevel;
+            }
+            args->params = profile->params;
+        }
+    }
+
+    if (args->zstdparams) {
+        char message[128];
+
+        if (!ZSTD_aov_parseParams(args->zstdparams, &args->params, message, sizeof(message))) {
+            opt_warn("--zstd", message);
+            args->_conflict = IS_CONFLICT;
+        }
+    }
+
+    if ((args->profile || args->zstdparams) && args->decompress) {
+        opt_warn("--profile/--zstd", "only apply to compression");
+        args->_conflict = IS_CONFLICT;
+    }
+
     /* Free memory allocated for option error tracking. */ 
     free(opterr);
 }
@@ -7,6 +7,8 @@
 #include <stdbool.h>
 #include <limits.h>
 
+#include "zstandard.h"
+
 
 struct arguments {
     /* Flag to indicate whether to compress the data. */
@@ -24,15 +26,72 @@ struct arguments {
     /* File path to be compress or decompress. */
     char *file;
 
+    /* Path of a file listing the files to compress or decompress ("-" for stdin). */
+    char *fileslist;
+
     /* Path for the output file or directory after compression or decompression. */
     char *output;
 
+    /* Path of the Unix domain socket to serve requests on, NULL when not a daemon. */
+    char *serve;
+
     /* Flag to indicate whether to enabling verbose output. */
     bool verbose;
 
+    /* Number of worker threads, 0 for one per processor. */
+    int threads;
+
+    /* Memory budget of the workers in bytes, 0 for none, -1 for the default from the memory limit. */
+    long long maxmemory;
+
+    /* Flag to indicate whether to round-trip files in memory instead of writing them. */
+    bool verify;
+
+    /* Flag to indicate whether to classify files from their headers only. */
+    bool scan;
+
+    /* Flag to indicate whether to search the settings that reproduce the original files. */
+    bool matchoriginal;
+
+    /* Number of samples to estimate the compressed size and time from, 0 when not estimating. */
+    int estimate;
+
+    /* Flag to indicate whether to print one NDJSON record per file, without terminal output. */
+    bool batch;
+
+    /* Flag to indicate whether to back Zstandard workspaces with huge pages. */
+    bool hugepages;
+
+    /* Flag to indicate whether to bind worker threads to processors, spread over the NUMA nodes. */
+    bool pin;
+
+    /* Name of the compression profile, NULL for none. */
+    char *profile;
+
+    /* Path of the dictionary to compress with, NULL for `bin/dict.zst`. */
+    char *dict;
+
+    /* Directory of more dictionaries, picked by ID to decompress, NULL for none. */
+    char *dictdir;
+
+    /* Previous version (file or directory) to make patches against or apply them to, NULL for none. */
+    char *patchfrom;
+
+    /* Compression parameter overrides as given on the command line, NULL for none. */
+    char *zstdparams;
+
+    /* Compression parameters resolved from the profile and the overrides. */
+    ZSTD_aov_params params;
+
     /* Flag to indicate whether to display the version information of the program. */ 
     bool version;
 
+    /* Most verbose log level to emit, or -1 to derive it from `verbose`. */
+    int loglevel;
+
+    /* Flag to indicate whether log records are written as NDJSON. */
+    bool logjson;
+
     int _conflict;
 };
 
@@ -55,6 +114,9 @@ struct option_position {
     /* Position of the file option in the argument list. */
     int file;
 
+    /* Position of the files-from option in the argument list. */
+    int fileslist;
+
     /* Position of the output option in the argument list. */
     int output;
 
@@ -111,7 +173,63 @@ enum {
     OPT_HELP                  = 104, 
 
     /* Option to display version information. */
-    OPT_VERSION               = 118
+    OPT_VERSION               = 118, 
+
+    /* Option to set the number of worker threads. */
+    OPT_THREADS               = 106, 
+
+    /* Long-only options start past the single character range. */
+
+    /* Option to set the log level. */
+    OPT_LOG_LEVEL             = 256, 
+
+    /* Option to write log records as NDJSON. */
+    OPT_LOG_JSON              = 257, 
+
+    /* Option to read the input files from a list. */
+    OPT_FILES_FROM            = 258, 
+
+    /* Option to run as a daemon on a Unix domain socket. */
+    OPT_SERVE                 = 259, 
+
+    /* Option to verify compression round trips without writing. */
+    OPT_VERIFY                = 260, 
+
+    /* Option to classify files without reading them fully. */
+    OPT_SCAN                  = 261, 
+
+    /* Option to back Zstandard workspaces with huge pages. */
+    OPT_HUGE_PAGES            = 262, 
+
+    /* Option to select a named compression profile. */
+    OPT_PROFILE               = 263, 
+
+    /* Option to override compression parameters. */
+    OPT_ZSTD                  = 264, 
+
+    /* Option to search the settings that reproduce the original files. */
+    OPT_MATCH_ORIGINAL        = 265, 
+
+    /* Option to make or apply patches against a previous version. */
+    OPT_PATCH_FROM            = 266, 
+
+    /* Option to select the dictionary. */
+    OPT_DICT                  = 267, 
+
+    /* Option to register a directory of dictionaries. */
+    OPT_DICT_DIR              = 268, 
+
+    /* Option to report one NDJSON record per file for scripts. */
+    OPT_BATCH                 = 269, 
+
+    /* Option to bound the memory of the workers. */
+    OPT_MAX_MEMORY            = 270, 
+
+    /* Option to bind worker threads to processors. */
+    OPT_PIN                   = 271, 
+
+    /* Option to estimate the compressed size and time from a sample. */
+    OPT_ESTIMATE              = 272
 };
 
 
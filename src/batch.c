@@ -0,0 +1,1458 @@
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#   include "dirent.h"
+#elif __linux__
+#   include <dirent.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/stat.h>
+#endif
+
+#include "aes.h"
+#include "args.h"
+#include "batch.h"
+#include "io.h"
+#include "log.h"
+#include "pool.h"
+#include "scan.h"
+#include "types.h"
+#include "utils.h"
+#include "workers.h"
+#include "zmem.h"
+#include "zstandard.h"
+
+
+/**
+ * Outcome of one file, reported as a record by `--batch`.
+ */
+struct batch_result {
+    /* Whether the file was left as it is. */
+    bool skipped;
+
+    /* Size of the output written. */
+    size_t outsize;
+
+    /* Why the file failed, NULL on success. */
+    const char *error;
+};
+
+typedef struct batch_result batch_result;
+
+
+/**
+ * A block of the arena holding the paths of a batch, so that listing a
+ * directory costs no allocation per file.
+ */
+struct batch_block {
+    struct batch_block *next;
+
+    size_t used;
+    size_t size;
+
+    char data[];
+};
+
+typedef struct batch_block batch_block;
+
+
+/**
+ * Returns the last component of a path without modifying it.
+ *
+ * @param path: The path.
+ * @return: A pointer into `path` to the file name.
+ */
+static const char *path_name(const char *path) {
+
+    const char *name = path;
+
+    for (const char *p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            name = p + 1;
+        }
+    }
+
+    return name;
+}
+
+
+/**
+ * Logs the verbose summary of one processed file as a single group, so
+ * lines from different files never interleave.
+ *
+ * @param args: The parsed command-line arguments.
+ * @param name: The input file name shown to the user.
+ * @param b: The processed data.
+ * @param path: The output path the data is written to.
+ */
+static void log_result(const arguments *args, const char *name, const bytes *b, const char *path) {
+
+    if (!log_enabled(LOG_INFO)) {
+        return;
+    }
+
+    log_hold();
+
+    log_block(LOG_INFO, "\n", 1);
+    log_info("%s: %s", "File", name);
+    log_info("%s: %s", "Mode", args->compress ? "compression": "decompression");
+
+    preview(b, 0, 128, 16);
+
+    if (args->compress) {
+        log_info("%s: %d", "compression level", args->compressionlevel);
+    }
+
+    log_info("%s: %zu bytes", "Size", b->size);
+    log_info("Output written to: %s", path);
+
+    log_release();
+}
+
+
+/**
+ * Initializes an empty batch.
+ *
+ * @param bt: The batch to initialize.
+ */
+extern void batch_init(batch *bt) {
+
+    bt->jobs = NULL;
+    bt->count = 0;
+    bt->capacity = 0;
+    bt->blocks = NULL;
+}
+
+
+/**
+ * Frees every job of a batch and the batch storage.
+ *
+ * @param bt: The batch to free.
+ */
+extern void batch_free(batch *bt) {
+
+    while (bt->blocks) {
+        batch_block *next = bt->blocks->next;
+        free(bt->blocks);
+        bt->blocks = next;
+    }
+
+    free(bt->jobs);
+
+    batch_init(bt);
+}
+
+
+/**
+ * Copies a path into the arena of a batch, joined to a directory when
+ * one is given, as `path_join` would.
+ *
+ * @param bt: The batch.
+ * @param dir: The directory, or NULL to copy `name` alone.
+ * @param name: The file name or path.
+ * @return: The path, valid until the batch is freed, or NULL if memory
+ *          could not be allocated.
+ */
+static char *batch_intern(batch *bt, const char *dir, const char *name) {
+
+    size_t dirlen = dir ? strlen(dir) : 0;
+    size_t namelen = strlen(name);
+
+    bool separator = dirlen && dir[dirlen - 1] != SEPARATOR[0];
+    size_t size = dirlen + separator + namelen + 1;
+
+    batch_block *block = bt->blocks;
+
+    if (block == NULL || block->size - block->used < size) {
+        size_t capacity = size > BATCH_BLOCK_SIZE ? size : BATCH_BLOCK_SIZE;
+
+        block = (batch_block *)malloc(sizeof(batch_block) + capacity);
+        if (block == NULL) {
+            return NULL;
+        }
+
+        block->used = 0;
+        block->size = capacity;
+
+        /* A path that does not fit gets its own block, behind the one still filling. */
+        if (bt->blocks && size > BATCH_BLOCK_SIZE) {
+            block->next = bt->blocks->next;
+            bt->blocks->next = block;
+        } else {
+            block->next = bt->blocks;
+            bt->blocks = block;
+        }
+    }
+
+    char *path = block->data + block->used;
+
+    if (dirlen) {
+        memcpy(path, dir, dirlen);
+    }
+
+    if (separator) {
+        path[dirlen] = SEPARATOR[0];
+    }
+
+    memcpy(path + dirlen + separator, name, namelen + 1);
+
+    block->used += size;
+
+    return path;
+}
+
+
+/**
+ * Appends a job whose paths are already in the arena of the batch. An
+ * output equal to the input is made the same string, which marks the
+ * job as in place; callers check outputs that may name the input under
+ * another spelling.
+ */
+static bool batch_push(batch *bt, char *input, char *output) {
+
+    if (bt->count == bt->capacity) {
+        size_t capacity = bt->capacity ? bt->capacity * 2 : 64;
+
+        job *jobs = (job *)realloc(bt->jobs, capacity * sizeof(job));
+        if (jobs == NULL) {
+            return false;
+        }
+
+        bt->jobs = jobs;
+        bt->capacity = capacity;
+    }
+
+    job *j = &bt->jobs[bt->count++];
+
+    j->input = input;
+    j->output = output && strcmp(output, input) != 0 ? output : input;
+    j->info = (file_info){ FILE_UNREADABLE, 0, 0 };
+
+    return true;
+}
+
+
+/**
+ * Appends a job to a batch. Both paths are copied. An output naming the
+ * same file as the input, however it is spelled, writes in place.
+ *
+ * @param bt: The batch.
+ * @param input: Path of the file to read.
+ * @param output: Path of the file to write, or NULL to overwrite the input.
+ * @return: `true` on success, `false` if memory could not be allocated.
+ */
+extern bool batch_add(batch *bt, const char *input, const char *output) {
+
+    bool inplace = output == NULL || strcmp(output, input) == 0 || samefile(input, output);
+
+    char *in = batch_intern(bt, NULL, input);
+    char *out = inplace ? in : batch_intern(bt, NULL, output);
+
+    return in && out && batch_push(bt, in, out);
+}
+
+
+/**
+ * Appends a single file, into the `output` directory when `outdir` is set.
+ */
+static bool batch_addTo(batch *bt, const char *file, const char *output, bool outdir) {
+
+    if (output == NULL || !outdir) {
+        return batch_add(bt, file, output);
+    }
+
+    char *in = batch_intern(bt, NULL, file);
+    char *out = in ? batch_intern(bt, output, path_name(file)) : NULL;
+
+    if (out && samefile(in, out)) {
+        out = in;
+    }
+
+    return out && batch_push(bt, in, out);
+}
+
+
+/**
+ * Appends a single file. When `output` is a directory, the file keeps
+ * its name inside it.
+ *
+ * @param bt: The batch.
+ * @param file: Path of the file to read.
+ * @param output: Output file or directory, or NULL to overwrite the input.
+ * @return: `true` on success, `false` on allocation failure.
+ */
+extern bool batch_addFile(batch *bt, const char *file, const char *output) {
+
+    return batch_addTo(bt, file, output, output && isdir(output));
+}
+
+
+/**
+ * Tells whether a directory entry is a regular file, or a link to one,
+ * from its type when the file system reports it and with a `stat`
+ * relative to the directory otherwise.
+ */
+static bool batch_isRegular(DIR *dp, const char *dir, const struct dirent *entry) {
+
+    #ifdef DT_REG
+        if (entry->d_type == DT_REG) {
+            return true;
+        }
+
+        if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+            return false;
+        }
+    #endif
+
+    #ifdef _WIN32
+        char *path = path_join(dir, entry->d_name);
+        bool regular = isfile(path);
+
+        free(path);
+
+        return regular;
+    #else
+        (void)dir;
+
+        struct stat st;
+
+        return fstatat(dirfd(dp), entry->d_name, &st, 0) == 0 && S_ISREG(st.st_mode);
+    #endif
+}
+
+
+/**
+ * Appends every regular file of a directory (not recursive), in one pass
+ * over its entries: file types come from the entries, and the paths are
+ * built in the arena of the batch.
+ *
+ * @param bt: The batch.
+ * @param dir: The directory to read.
+ * @param output: Output directory, or NULL to overwrite the inputs.
+ * @return: `true` on success, `false` if the directory cannot be read.
+ */
+extern bool batch_addDir(batch *bt, const char *dir, const char *output) {
+
+    #ifdef _WIN32
+        DIR *dp = opendir(dir);
+    #else
+        int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR *dp = fd >= 0 ? fdopendir(fd) : NULL;
+
+        if (dp == NULL && fd >= 0) {
+            close(fd);
+        }
+    #endif
+
+    if (dp == NULL) {
+        return false;
+    }
+
+    /* An output directory that is the input one under another name writes in place. */
+    if (output && samefile(dir, output)) {
+        output = NULL;
+    }
+
+    struct dirent *entry;
+    bool ok = true;
+
+    while (ok && (entry = readdir(dp)) != NULL) {
+        const char *name = entry->d_name;
+
+        /* Skip the current directory (.) and parent directory (..). */
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        if (!batch_isRegular(dp, dir, entry)) {
+            continue;
+        }
+
+        char *path = batch_intern(bt, dir, name);
+        char *opath = output && path ? batch_intern(bt, output, name) : NULL;
+
+        ok = path && (output == NULL || opath) && batch_push(bt, path, opath);
+    }
+
+    /* Close the directory stream, and the descriptor it was opened on. */
+    closedir(dp);
+
+    return ok;
+}
+
+
+/**
+ * Appends the files named in a list file.
+ *
+ * Records are separated by newlines, or by NUL bytes when the list
+ * contains any (as written by `find -print0`). Each record is an input
+ * path, optionally followed by a tab and an output path. Records without
+ * an output path go to the `output` directory, or overwrite the input.
+ *
+ * @param bt: The batch.
+ * @param list: Path of the list file, or "-" for stdin.
+ * @param output: Output directory for records without an output path, or NULL.
+ * @return: `true` on success, `false` if the list cannot be read.
+ */
+extern bool batch_addList(batch *bt, const char *list, const char *output) {
+
+    bytes *b;
+
+    if (isstdio(list)) {
+        b = read_stream(open_stream(list, "rb"));
+    } else {
+        b = read_file(list);
+    }
+
+    if (b == NULL) {
+        return false;
+    }
+
+    char separator = memchr(b->data, '\0', b->size) ? '\0' : '\n';
+
+    /* Records are cut in place, the last one needs room for its terminator. */
+    if (!bytes_reserve(b, b->size + 1)) {
+        bytes_free(b);
+        return false;
+    }
+
+    char *record = (char *)b->data;
+    char *end = (char *)b->data + b->size;
+    bool outdir = output && isdir(output);
+    bool ok = true;
+
+    *end = '\0';
+
+    while (ok && record < end) {
+        char *next = memchr(record, separator, (size_t)(end - record));
+        size_t len = next ? (size_t)(next - record) : (size_t)(end - record);
+
+        char *line = record;
+        line[len] = '\0';
+
+        if (len && separator == '\n' && line[len - 1] == '\r') {
+            line[--len] = '\0';
+        }
+
+        char *tab = strchr(line, '\t');
+
+        if (tab) {
+            *tab = '\0';
+            ok = line[0] == '\0' || batch_add(bt, line, tab[1] ? tab + 1 : NULL);
+        } else if (len) {
+            ok = batch_addTo(bt, line, output, outdir);
+        }
+
+        record = next ? next + 1 : end;
+    }
+
+    bytes_free(b);
+
+    return ok;
+}
+
+
+/**
+ * Decompresses AoV data straight into a memory-mapped output file sized
+ * from the stored decompressed size.
+ *
+ * @return: `true` on success, `false` if the data is invalid or the output
+ *          cannot be mapped (`mapped` tells which).
+ */
+static bool batch_decompressMapped(const job *j, const arguments *args, ZSTD_aov_ctx *ctx, const ZSTD_aov_dict *d,
+                                   const bytes *b, const ZSTD_aov_header *h, bool *mapped, batch_result *r) {
+
+    mapped_file m;
+
+    *mapped = map_output(j->output, h->dsize, &m);
+
+    if (!*mapped) {
+        return false;
+    }
+
+    bool ok = ZSTD_aov_decompressInto(ctx, b, h, d, m.data);
+
+    if (ok) {
+        bytes view = { m.data, m.size, m.size };
+        log_result(args, path_name(j->input), &view, j->output);
+    } else {
+        r->error = "decompression failed";
+    }
+
+    if (!unmap_output(&m, j->output, ok)) {
+        r->error = r->error ? r->error : "cannot write the output";
+        return false;
+    }
+
+    r->outsize = m.size;
+
+    return true;
+}
+
+
+/**
+ * Compresses or decompresses one large file as a stream, in constant
+ * memory whatever its size. When the output replaces the input it is
+ * written next to it first and renamed over it once complete, so a
+ * failure leaves the input as it was.
+ *
+ * @param passthrough: Whether the file is only copied, as it already is in
+ *                     the target form or is AES-wrapped.
+ * @return: `true` on success, `false` if the file could not be processed.
+ */
+static bool batch_stream(const job *j, const arguments *args, ZSTD_aov_ctx *ctx, const ZSTD_aov_dict *d,
+                         bool passthrough, batch_result *r) {
+
+    bool inplace = j->output == j->input;
+
+    char *tmp = inplace ? (char *)malloc(strlen(j->output) + sizeof(".tmp")) : NULL;
+
+    if (tmp != NULL) {
+        strcpy(tmp, j->output);
+        strcat(tmp, ".tmp");
+    }
+
+    const char *path = inplace ? tmp : j->output;
+
+    FILE *in = path ? fopen(j->input, "rb") : NULL;
+    FILE *out = in ? fopen(path, "wb") : NULL;
+
+    long long written = -1;
+
+    if (in && out) {
+        if (args->decompress) {
+            /* Input without the AoV header is copied as it is. */
+            written = ZSTD_aov_decompressStream(ctx, in, out, d);
+        } else {
+            /* AoV (damaged included) and AES-wrapped input is copied as it is. */
+            const byte *keep = passthrough && j->info.kind != FILE_AES ? HEADER : AES_HEADER;
+            written = ZSTD_aov_compressStream(ctx, in, out, d, keep);
+        }
+    }
+
+    if (in) {
+        fclose(in);
+    }
+
+    if (out && fclose(out) != 0) {
+        written = -1;
+    }
+
+    bool ok = written >= 0;
+
+    if (ok && inplace) {
+        #ifdef _WIN32
+            /* Windows does not rename over an existing file. */
+            remove(j->output);
+        #endif
+
+        ok = rename(path, j->output) == 0;
+    }
+
+    if (!ok && out) {
+        remove(path);
+    }
+
+    free(tmp);
+
+    if (!ok) {
+        log_error("Failed to %s: %s", args->compress ? "compress" : "decompress", j->input);
+        r->error = in == NULL ? "cannot read file" : out == NULL ? "cannot write the output"
+                 : args->compress ? "compression failed" : "decompression failed";
+        return false;
+    }
+
+    log_info("Streamed %s: %lld bytes written to %s", path_name(j->input), written, j->output);
+
+    r->outsize = (size_t)written;
+
+    return true;
+}
+
+
+/**
+ * Reads the content of a file, as decompression would give it: AoV data
+ * is decompressed, other data (AES-wrapped included) is taken as it is.
+ *
+ * @return: The content, or NULL with `error` set.
+ */
+static bytes *batch_readContent(const char *path, ZSTD_aov_ctx *ctx, const ZSTD_aov_dict *d, const char **error) {
+
+    bytes *b = read_file(path);
+
+    if (b == NULL) {
+        *error = "cannot read file";
+    } else if (b->size >= HEADER_SIZE && ZSTD_isHeader(b->data)) {
+        b = ZSTD_aov_decompress_usingDict(ctx, b, d);
+        if (b == NULL) {
+            *error = "cannot decompress";
+        }
+    }
+
+    return b;
+}
+
+
+/**
+ * Makes (`-c`) or applies (`-d`) the patch of one file against its
+ * previous version: `--patch-from` itself, or the file of the same name
+ * in it when it is a directory. A file without a previous version is
+ * patched against nothing, so the patch holds all of it.
+ *
+ * @return: `true` on success, `false` if the file could not be processed.
+ */
+static bool batch_patch(const job *j, const arguments *args, ZSTD_aov_ctx *ctx, const ZSTD_aov_dict *d, batch_result *r) {
+
+    const char *error = NULL;
+
+    char *refpath = isdir(args->patchfrom) ? path_join(args->patchfrom, path_name(j->input)) : strdup(args->patchfrom);
+    bytes *ref = NULL;
+
+    if (refpath == NULL) {
+        log_error("Cannot find the previous version of: %s", j->input);
+        r->error = "out of memory";
+        return false;
+    }
+
+    if (!isfile(refpath)) {
+        log_info("No previous version of %s, the patch holds all of it", j->input);
+        ref = bytes_init(0);
+    } else if ((ref = batch_readContent(refpath, ctx, d, &error)) == NULL) {
+        log_error("Cannot read the previous version %s: %s", refpath, error);
+    }
+
+    free(refpath);
+
+    if (ref == NULL) {
+        r->error = "cannot read the previous version";
+        return false;
+    }
+
+    bytes *b;
+
+    if (args->compress) {
+        b = batch_readContent(j->input, ctx, d, &error);
+
+        size_t size = b ? b->size : 0;
+
+        if (b != NULL && (b = ZSTD_aov_compressPatch(ctx, ref, b, args->compressionlevel)) == NULL) {
+            error = "compression failed";
+        }
+
+        if (b != NULL) {
+            log_info("Patch of %s: %zu bytes for %zu bytes of content", path_name(j->input), b->size, size);
+        }
+    } else {
+        b = read_file(j->input);
+
+        if (b == NULL) {
+            error = "cannot read file";
+        } else {
+            b = ZSTD_aov_decompressPatch(ctx, ref, b, &error);
+        }
+    }
+
+    bytes_free(ref);
+
+    if (b == NULL) {
+        log_error("Failed to %s the patch of %s: %s", args->compress ? "make" : "apply", j->input, error);
+        r->error = error;
+        return false;
+    }
+
+    log_result(args, path_name(j->input), b, j->output);
+
+    bool written = write_file(j->output, b);
+
+    r->outsize = b->size;
+
+    bytes_free(b);
+
+    if (!written) {
+        log_error("Cannot write file: %s", j->output);
+        r->error = "cannot write the output";
+    }
+
+    return written;
+}
+
+
+/**
+ * Tells whether a file is only copied, or left as it is in place: when it
+ * is AES-wrapped, or already in the target form. Compression counts damaged
+ * AoV files as compressed, as `--scan` does, rather than wrapping them in
+ * a second AoV header.
+ */
+static bool batch_passthrough(const arguments *args, file_kind kind) {
+
+    if (kind == FILE_AES) {
+        return true;
+    }
+
+    return args->compress ? kind == FILE_AOV || kind == FILE_DAMAGED : kind == FILE_PLAIN;
+}
+
+
+/**
+ * Compresses or decompresses one file.
+ *
+ * @return: `true` on success, `false` if the file could not be processed.
+ */
+static bool batch_process(const job *j, const arguments *args, ZSTD_aov_ctx *ctx, const ZSTD_aov_dict *d, batch_result *r) {
+
+    if (args->patchfrom) {
+        return batch_patch(j, args, ctx, d, r);
+    }
+
+    file_kind kind = j->info.kind;
+
+    /**
+     * Files that are already in the target form, or AES-wrapped, stay as
+     * they are. Damaged AoV files still go through the decoder, which
+     * looks further for the frame, but are not compressed a second time.
+     */
+    bool passthrough = batch_passthrough(args, kind);
+
+    if (args->compress && kind == FILE_DAMAGED) {
+        log_warn("Damaged AoV file left as it is: %s", j->input);
+    }
+
+    if (passthrough && j->output == j->input) {
+        log_debug("Skipping %s file: %s", scan_kindName(kind), j->input);
+        r->skipped = true;
+        return true;
+    }
+
+    /* The AoV header stores the size in 32 bits, larger content cannot be compressed into it. */
+    if (args->compress && !passthrough && j->info.size > HEADER_DSIZE_MAX) {
+        log_error("Larger than the 4 GiB the AoV header can describe: %s", j->input);
+        r->error = "larger than the 4 GiB the AoV header can describe";
+        return false;
+    }
+
+    /* So are large outputs that replace their input, which cannot be decoded into a mapping of it. */
+    if (j->info.size >= STREAM_INPUT_MIN || (args->decompress && j->info.dsize >= STREAM_INPUT_MIN && j->output == j->input)) {
+        return batch_stream(j, args, ctx, d, passthrough, r);
+    }
+
+    bytes *b = read_file(j->input);
+
+    if (b == NULL) {
+        log_error("Cannot read file: %s", j->input);
+        r->error = "cannot read file";
+        return false;
+    }
+
+    if (passthrough) {
+        /* Pass, only copy the file elsewhere. */
+    } else if (args->compress) {
+        /* Compress the data. */
+        b = ZSTD_aov_compress_usingDict(ctx, b, d);
+    } else if (args->decompress) {
+        ZSTD_aov_header h;
+
+        if (!ZSTD_aov_parseHeader(b->data, b->size, &h)) {
+            log_error("Invalid AoV header or stored size: %s", j->input);
+            r->error = "invalid AoV header or stored size";
+            bytes_free(b);
+            return false;
+        }
+
+        /* Large outputs are decoded straight into the mapped output file. */
+        if (h.dsize >= MAP_OUTPUT_MIN && j->output != j->input) {
+            bool mapped;
+            bool ok = batch_decompressMapped(j, args, ctx, d, b, &h, &mapped, r);
+
+            if (mapped) {
+                if (!ok) {
+                    log_error("Failed to decompress: %s", j->input);
+                }
+                bytes_free(b);
+                return ok;
+            }
+        }
+
+        /* Decompress the data. */
+        b = ZSTD_aov_decompress_usingDict(ctx, b, d);
+    }
+
+    if (b == NULL) {
+        log_error("Failed to %s: %s", args->compress ? "compress" : "decompress", j->input);
+        r->error = args->compress ? "compression failed" : "decompression failed";
+        return false;
+    }
+
+    log_result(args, path_name(j->input), b, j->output);
+
+    bool written = write_file(j->output, b);
+
+    r->outsize = b->size;
+
+    /* Free the allocated memory for the bytes. */
+    bytes_free(b);
+
+    if (!written) {
+        log_error("Cannot write file: %s", j->output);
+        r->error = "cannot write the output";
+    }
+
+    return written;
+}
+
+
+/**
+ * Round-trips one file in memory: compresses it, decompresses the result
+ * with the same dictionary and compares the hash of the output with the
+ * hash of the source. Sources that are already AoV-compressed are
+ * decompressed first; AES-wrapped files are skipped. Nothing is written.
+ */
+static void batch_verify(const job *j, const arguments *args, ZSTD_aov_ctx *ctx, const ZSTD_aov_dict *d, batch_stats *stats) {
+
+    const char *name = path_name(j->input);
+    const char *error = NULL;
+
+    size_t csize = 0;
+    size_t size = 0;
+    uint64_t hash = 0;
+
+    bytes *b = read_file(j->input);
+
+    if (b == NULL) {
+        error = "cannot read file";
+    } else if (b->size >= HEADER_SIZE && ZSTD_isNotDecompressedData(b->data, AES_HEADER)) {
+        log_info("SKIP %s (AES-wrapped)", name);
+        atomic_fetch_add(&stats->skipped, 1);
+        bytes_free(b);
+        return;
+    } else if (b->size >= HEADER_SIZE && ZSTD_isHeader(b->data)) {
+        b = ZSTD_aov_decompress_usingDict(ctx, b, d);
+        if (b == NULL) {
+            error = "cannot decompress source";
+        }
+    }
+
+    if (error == NULL) {
+        size = b->size;
+        hash = hash64(b->data, b->size, 0);
+
+        b = ZSTD_aov_compress_usingDict(ctx, b, d);
+
+        if (b == NULL) {
+            error = "compression failed";
+        } else {
+            csize = b->size;
+            b = ZSTD_aov_decompress_usingDict(ctx, b, d);
+
+            if (b == NULL) {
+                error = "decompression failed";
+            } else if (b->size != size || hash64(b->data, b->size, 0) != hash) {
+                error = "round trip mismatch";
+            }
+        }
+    }
+
+    bytes_free(b);
+
+    if (error) {
+        log_error("FAIL %s: %s", name, error);
+        atomic_fetch_add(&stats->failed, 1);
+        return;
+    }
+
+    log_info("PASS %s: %zu -> %zu bytes, level %d, xxh64 %016llx", name, size, csize,
+             args->compressionlevel, (unsigned long long)hash);
+
+    atomic_fetch_add(&stats->passed, 1);
+    atomic_fetch_add(&stats->insize, size);
+    atomic_fetch_add(&stats->outsize, csize);
+}
+
+
+static void batch_probeWorker(size_t index, int worker, void *arg) {
+
+    batch *bt = (batch *)arg;
+
+    (void)worker;
+
+    scan_probe(bt->jobs[index].input, &bt->jobs[index].info);
+}
+
+
+/**
+ * Classifies every job of a batch from its size and header, in parallel,
+ * so the run can be planned before any file is read in full.
+ *
+ * @param bt: The batch.
+ * @param threads: Requested number of worker threads, 0 for one per processor.
+ */
+extern void batch_probe(batch *bt, int threads) {
+
+    workers_run(workers_count(threads, bt->count), bt->count, batch_probeWorker, bt);
+}
+
+
+/**
+ * Returns the bytes a job holds in memory at once: the input, plus the
+ * output buffer sized from the stored size (decompression) or the
+ * compression bound, plus the working memory of the zstd contexts for
+ * the parameters of the file. Outputs that are mapped are not counted.
+ *
+ * @param contexts: Receives, when not NULL, the part held by the zstd
+ *                  contexts, which the worker keeps for its next files.
+ */
+static uint64_t batch_footprint(const job *j, const arguments *args, const ZSTD_aov_dict *d, uint64_t *contexts) {
+
+    const file_info *info = &j->info;
+    uint64_t unused;
+
+    contexts = contexts ? contexts : &unused;
+
+    if (args->verify) {
+        /* The content, its compressed copy and both contexts. */
+        uint64_t size = info->kind == FILE_AOV ? info->dsize : info->size;
+
+        *contexts = ZSTD_aov_estimateCompress(d, size, false) + ZSTD_aov_estimateDecompress(size, false);
+
+        return info->size + size + ZSTD_compressBound((size_t)size) + *contexts;
+    }
+
+    bool passthrough = batch_passthrough(args, info->kind);
+
+    /* Large files are streamed through fixed buffers, as in `batch_process`. */
+    bool streaming = !args->patchfrom
+                  && (info->size >= STREAM_INPUT_MIN
+                      || (args->decompress && info->dsize >= STREAM_INPUT_MIN && j->output == j->input));
+
+    *contexts = 0;
+
+    if (!passthrough) {
+        *contexts = args->compress ? ZSTD_aov_estimateCompress(d, info->size, streaming)
+                                   : ZSTD_aov_estimateDecompress(info->dsize, streaming);
+    }
+
+    if (streaming) {
+        return ZSTD_CStreamInSize() + ZSTD_CStreamOutSize() + *contexts;
+    }
+
+    if (args->compress && !passthrough) {
+        return info->size + HEADER_SIZE + FRAME_HEADER_SIZE + ZSTD_compressBound((size_t)info->size) + *contexts;
+    }
+
+    if (info->kind == FILE_AOV && (info->dsize < MAP_OUTPUT_MIN || j->output == j->input)) {
+        return info->size + info->dsize + *contexts;
+    }
+
+    return info->size + *contexts;
+}
+
+
+/**
+ * Compression time per byte by level, in nanoseconds, measured on game
+ * files with the default dictionary. Negative levels cost as level 1.
+ */
+static const unsigned batch_levelCost[23] = {
+    2, 2, 3, 5, 7, 9, 11, 12, 13, 15, 18, 30, 34, 70, 75, 80, 120, 125, 140, 215, 220, 320, 430
+};
+
+
+static uint64_t batch_compressCost(const ZSTD_aov_dict *d, uint64_t size) {
+
+    int level = d->compressionlevel;
+
+    if (level < 1) {
+        level = 1;
+    } else if (level > 22) {
+        level = 22;
+    }
+
+    return (size + BATCH_COST_FILE_BYTES) * batch_levelCost[level];
+}
+
+
+/**
+ * Estimates the time a job takes, in nanoseconds, from the sizes found by
+ * `batch_probe`: compression by level and input size, decompression by
+ * the size stored in the AoV header, and copies by input size. Only the
+ * order of the estimates matters for scheduling, the absolute values are
+ * reported as the predicted makespan.
+ */
+static uint64_t batch_cost(const job *j, const arguments *args, const ZSTD_aov_dict *d) {
+
+    const file_info *info = &j->info;
+
+    if (args->verify) {
+        uint64_t size = info->kind == FILE_AOV ? info->dsize : info->size;
+
+        return BATCH_COST_FILE + batch_compressCost(d, size) + size * 2;
+    }
+
+    bool passthrough = batch_passthrough(args, info->kind);
+
+    if (passthrough) {
+        return BATCH_COST_FILE + (j->output == j->input ? 0 : info->size);
+    }
+
+    if (args->compress) {
+        /* A patch also matches against the previous version, about as large. */
+        return BATCH_COST_FILE + batch_compressCost(d, args->patchfrom ? info->size * 2 : info->size);
+    }
+
+    return BATCH_COST_FILE + info->size + info->dsize;
+}
+
+
+struct batch_slot {
+    uint64_t cost;
+    size_t index;
+};
+
+typedef struct batch_slot batch_slot;
+
+
+/* Longest first, then in batch order. */
+static int batch_compareSlots(const void *a, const void *b) {
+
+    const batch_slot *x = (const batch_slot *)a;
+    const batch_slot *y = (const batch_slot *)b;
+
+    if (x->cost != y->cost) {
+        return x->cost < y->cost ? 1 : -1;
+    }
+
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+
+/**
+ * Returns the makespan of running jobs of the given costs, in order, on
+ * `nthreads` workers that each take the next job when they become free.
+ */
+static uint64_t batch_simulate(const batch_slot *slots, size_t count, int nthreads, uint64_t *finish) {
+
+    memset(finish, 0, (size_t)nthreads * sizeof(uint64_t));
+
+    uint64_t makespan = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        int idle = 0;
+
+        for (int k = 1; k < nthreads; k++) {
+            if (finish[k] < finish[idle]) {
+                idle = k;
+            }
+        }
+
+        finish[idle] += slots[i].cost;
+
+        if (finish[idle] > makespan) {
+            makespan = finish[idle];
+        }
+    }
+
+    return makespan;
+}
+
+
+/**
+ * Orders the jobs of a batch longest expected first (LPT), so that a large
+ * file found last by the directory walk does not run alone while the other
+ * workers are idle, and predicts the makespan of both orders.
+ *
+ * @param order: Receives the indexes of the jobs in dispatch order.
+ * @param predicted: Receives the predicted makespan, in nanoseconds.
+ * @param unordered: Receives the predicted makespan in batch order.
+ * @return: `true` on success, `false` if there is a single job or processor, so
+ *          nothing to gain, or if out of memory (`order` is then the batch order).
+ */
+static bool batch_schedule(const batch *bt, const arguments *args, const ZSTD_aov_dict *d, int nthreads,
+                           size_t *order, uint64_t *predicted, uint64_t *unordered) {
+
+    for (size_t i = 0; i < bt->count; i++) {
+        order[i] = i;
+    }
+
+    if (bt->count < 2 || nthreads < 2) {
+        return false;
+    }
+
+    batch_slot *slots = (batch_slot *)malloc((bt->count ? bt->count : 1) * sizeof(batch_slot));
+    uint64_t *finish = (uint64_t *)malloc((size_t)nthreads * sizeof(uint64_t));
+
+    if (slots == NULL || finish == NULL) {
+        free(slots);
+        free(finish);
+        return false;
+    }
+
+    for (size_t i = 0; i < bt->count; i++) {
+        slots[i].cost = batch_cost(&bt->jobs[i], args, d);
+        slots[i].index = i;
+    }
+
+    *unordered = batch_simulate(slots, bt->count, nthreads, finish);
+
+    qsort(slots, bt->count, sizeof(batch_slot), batch_compareSlots);
+
+    *predicted = batch_simulate(slots, bt->count, nthreads, finish);
+
+    for (size_t i = 0; i < bt->count; i++) {
+        order[i] = slots[i].index;
+    }
+
+    free(finish);
+    free(slots);
+
+    return true;
+}
+
+
+/**
+ * Logs the totals of a batch before it runs: the bytes to read, the bytes
+ * decompression will write (known from the AoV headers), the peak memory
+ * of the buffers when the largest jobs run side by side, and the memory
+ * budget that caps it.
+ */
+static void batch_logPlan(const batch *bt, const arguments *args, const ZSTD_aov_dict *d, int nthreads, uint64_t budget) {
+
+    if (!log_enabled(LOG_INFO) || nthreads <= 0) {
+        return;
+    }
+
+    uint64_t *peaks = (uint64_t *)calloc((size_t)nthreads, sizeof(uint64_t));
+    if (peaks == NULL) {
+        return;
+    }
+
+    uint64_t insize = 0;
+    uint64_t outsize = 0;
+    size_t count[FILE_KINDS] = { 0 };
+
+    for (size_t i = 0; i < bt->count; i++) {
+        const job *j = &bt->jobs[i];
+
+        insize += j->info.size;
+        outsize += j->info.kind == FILE_AOV ? j->info.dsize : j->info.size;
+        count[j->info.kind]++;
+
+        /* Keep the `nthreads` largest footprints, smallest first. */
+        uint64_t footprint = batch_footprint(j, args, d, NULL);
+
+        for (int k = 0; k < nthreads && footprint > peaks[k]; k++) {
+            if (k > 0) {
+                peaks[k - 1] = peaks[k];
+            }
+            peaks[k] = footprint;
+        }
+    }
+
+    uint64_t peak = 0;
+
+    for (int k = 0; k < nthreads; k++) {
+        peak += peaks[k];
+    }
+
+    free(peaks);
+
+    log_hold();
+
+    log_info("Planned %zu files (%d threads): %zu plain, %zu aov, %zu aes, %zu unreadable",
+             bt->count, nthreads, count[FILE_PLAIN], count[FILE_AOV] + count[FILE_DAMAGED], count[FILE_AES],
+             count[FILE_UNREADABLE]);
+
+    if (args->decompress) {
+        log_info("Planned %llu bytes to read, %llu bytes after decompression, peak buffers %llu bytes",
+                 (unsigned long long)insize, (unsigned long long)outsize, (unsigned long long)peak);
+    } else {
+        log_info("Planned %llu bytes to read, peak buffers %llu bytes",
+                 (unsigned long long)insize, (unsigned long long)peak);
+    }
+
+    if (budget && peak > budget) {
+        log_info("Memory budget %llu bytes, fewer files run at once", (unsigned long long)budget);
+    } else if (budget) {
+        log_info("Memory budget %llu bytes", (unsigned long long)budget);
+    }
+
+    log_release();
+}
+
+
+/**
+ * State shared by the workers of a batch run.
+ */
+struct batch_state {
+    const batch *bt;
+    const arguments *args;
+
+    /* The digested dictionary of each NUMA node the workers run on. */
+    const ZSTD_aov_dict **dicts;
+
+    /* One context set per worker thread. */
+    ZSTD_aov_ctx **ctxs;
+
+    /* Indexes of the jobs in dispatch order. */
+    const size_t *order;
+
+    batch_stats *stats;
+
+    /* Admits jobs while their footprints fit the memory budget. */
+    workers_budget *budget;
+
+    /* Keeps the `--batch` records of different workers on separate lines. */
+    pthread_mutex_t records;
+};
+
+typedef struct batch_state batch_state;
+
+
+/**
+ * Prints the NDJSON record of one file for `--batch`: status, input and
+ * output sizes, time spent and paths, with the reason of a failure.
+ */
+static void batch_record(batch_state *state, const job *j, const batch_result *r, bool ok, uint64_t elapsed) {
+
+    const char *status = !ok ? "failed" : r->skipped ? "skipped" : "ok";
+
+    pthread_mutex_lock(&state->records);
+
+    printf("{\"status\":\"%s\",\"size\":%llu,\"outsize\":%zu,\"us\":%llu,\"path\":", status,
+           (unsigned long long)j->info.size, ok ? r->outsize : 0, (unsigned long long)(elapsed / 1000));
+    log_jsonString(stdout, j->input);
+    printf(",\"output\":");
+    log_jsonString(stdout, j->output);
+
+    if (!ok) {
+        printf(",\"error\":");
+        log_jsonString(stdout, r->error ? r->error : "failed");
+    }
+
+    printf("}\n");
+
+    pthread_mutex_unlock(&state->records);
+}
+
+
+static void batch_worker(size_t index, int worker, void *arg) {
+
+    batch_state *state = (batch_state *)arg;
+    const job *j = &state->bt->jobs[state->order[index]];
+    const ZSTD_aov_dict *d = state->dicts[workers_node(worker)];
+
+    /* The contexts of every worker are reserved for the whole run, by `batch_run`. */
+    uint64_t contexts;
+    uint64_t footprint = batch_footprint(j, state->args, d, &contexts) - contexts;
+
+    if (state->args->verify) {
+        workers_budgetAcquire(state->budget, footprint);
+        batch_verify(j, state->args, state->ctxs[worker], d, state->stats);
+        workers_budgetRelease(state->budget, footprint);
+        return;
+    }
+
+    batch_result r = { false, 0, NULL };
+
+    workers_budgetAcquire(state->budget, footprint);
+
+    uint64_t start = state->args->batch ? time_ns() : 0;
+
+    bool ok = batch_process(j, state->args, state->ctxs[worker], d, &r);
+
+    workers_budgetRelease(state->budget, footprint);
+
+    if (state->args->batch) {
+        batch_record(state, j, &r, ok, time_ns() - start);
+    }
+
+    if (!ok) {
+        atomic_fetch_add(&state->stats->failed, 1);
+    } else if (r.skipped) {
+        atomic_fetch_add(&state->stats->skipped, 1);
+    } else {
+        atomic_fetch_add(&state->stats->passed, 1);
+    }
+}
+
+
+/**
+ * Returns the largest context memory a job of the batch needs, which
+ * every worker may end up keeping.
+ */
+static uint64_t batch_contexts(const batch *bt, const arguments *args, const ZSTD_aov_dict *d) {
+
+    uint64_t largest = 0;
+
+    for (size_t i = 0; i < bt->count; i++) {
+        uint64_t contexts;
+
+        batch_footprint(&bt->jobs[i], args, d, &contexts);
+
+        if (contexts > largest) {
+            largest = contexts;
+        }
+    }
+
+    return largest;
+}
+
+
+/**
+ * Gives the free buffers and workspaces back to the system, as a job
+ * waits for memory that they may be holding.
+ */
+static void batch_trimCaches(void) {
+
+    pool_trim();
+    zmem_trim();
+}
+
+
+/**
+ * Processes every job of a batch on `args->threads` workers (one per
+ * processor by default). Each worker owns a set of reusable contexts and
+ * all of them share the digested dictionary. With `args->verify`, files
+ * are round-tripped in memory instead of written.
+ *
+ * @param bt: The batch to process.
+ * @param args: The parsed command-line arguments.
+ * @param d: The digested dictionary.
+ * @param stats: Receives the counts of the run.
+ * @return: The number of files that failed.
+ */
+extern size_t batch_run(const batch *bt, const arguments *args, const ZSTD_aov_dict *d, batch_stats *stats) {
+
+    int nthreads = workers_count(args->threads, bt->count);
+
+    /* A share of the memory limit of the process unless `--max-memory` is given, 0 for none. */
+    uint64_t limit = args->maxmemory >= 0 ? (uint64_t)args->maxmemory
+                   : workers_memoryLimit() / 100 * BATCH_MEMORY_SHARE;
+
+    /**
+     * Memory held for the whole run rather than by each job: the caches of
+     * buffers and workspaces, the digested dictionary of each node, and
+     * the contexts each worker keeps sized for the largest file it met.
+     * It is taken out of the budget of the jobs, with fewer workers when
+     * their contexts would not fit.
+     */
+    uint64_t caches = limit / BATCH_CACHE_SHARE;
+    uint64_t dicts = (uint64_t)workers_nodes() * ZSTD_aov_estimateDict(d, args->compress, args->decompress || args->verify);
+    uint64_t contexts = batch_contexts(bt, args, d);
+    int requested = nthreads;
+
+    while (limit && nthreads > 1 && caches + dicts + (uint64_t)nthreads * contexts > limit) {
+        nthreads--;
+    }
+
+    uint64_t held = caches + dicts + (uint64_t)nthreads * contexts;
+    uint64_t budgetlimit = limit == 0 ? 0 : limit > held ? limit - held : 1;
+
+    batch_logPlan(bt, args, d, nthreads, limit);
+
+    if (nthreads < requested) {
+        log_info("Memory budget fits the contexts of %d of %d workers", nthreads, requested);
+    }
+
+    if (limit) {
+        log_debug("Memory held for the run: %llu bytes of caches, %llu of dictionaries, %llu of contexts on %d workers",
+                  (unsigned long long)caches, (unsigned long long)dicts,
+                  (unsigned long long)((uint64_t)nthreads * contexts), nthreads);
+
+        pool_setCacheMax(caches / 2);
+        zmem_setCacheMax(caches / 2);
+    }
+
+    atomic_init(&stats->passed, 0);
+    atomic_init(&stats->failed, 0);
+    atomic_init(&stats->skipped, 0);
+    atomic_init(&stats->insize, 0);
+    atomic_init(&stats->outsize, 0);
+
+    stats->makespan = 0;
+    stats->predicted = 0;
+    stats->scheduled = false;
+
+    ZSTD_aov_ctx **ctxs = (ZSTD_aov_ctx **)calloc((size_t)nthreads, sizeof(ZSTD_aov_ctx *));
+    size_t *order = (size_t *)malloc((bt->count ? bt->count : 1) * sizeof(size_t));
+
+    if (ctxs == NULL || order == NULL) {
+        free(ctxs);
+        free(order);
+        atomic_store(&stats->failed, bt->count);
+        return bt->count;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        ctxs[i] = ZSTD_aov_createCtx();
+
+        if (ctxs[i] == NULL) {
+            nthreads = i;
+            break;
+        }
+    }
+
+    if (nthreads > 0) {
+        uint64_t predicted = 0;
+        uint64_t unordered = 0;
+
+        /* Threads beyond the processors do not run at once, the prediction counts the processors. */
+        int ncores = nthreads < workers_default() ? nthreads : workers_default();
+
+        bool scheduled = batch_schedule(bt, args, d, ncores, order, &predicted, &unordered);
+
+        /* Pinned workers on other NUMA nodes digest their own copy of the dictionary. */
+        const ZSTD_aov_dict *dicts[WORKERS_NODES_MAX] = { d };
+        ZSTD_aov_dict *copies[WORKERS_NODES_MAX] = { NULL };
+
+        for (int n = 1; n < workers_nodes(); n++) {
+            copies[n] = ZSTD_aov_cloneDict(d);
+            dicts[n] = copies[n] ? copies[n] : d;
+        }
+
+        workers_budget budget;
+        workers_budgetInit(&budget, budgetlimit);
+
+        budget.trim = batch_trimCaches;
+
+        batch_state state = { bt, args, dicts, ctxs, order, stats, &budget, PTHREAD_MUTEX_INITIALIZER };
+
+        uint64_t start = time_ns();
+
+        workers_run(nthreads, bt->count, batch_worker, &state);
+
+        stats->makespan = (double)(time_ns() - start) / 1e9;
+        stats->predicted = (double)predicted / 1e9;
+        stats->scheduled = scheduled;
+
+        if (scheduled) {
+            log_info("Makespan %.3f s, predicted %.3f s largest first on %d processors (%.3f s in batch order)",
+                     stats->makespan, stats->predicted, ncores, (double)unordered / 1e9);
+        }
+
+        log_debug("Memory budget of the files: peak %llu of %llu bytes, %zu files waited for memory",
+                  (unsigned long long)budget.peak, (unsigned long long)budgetlimit, budget.waits);
+
+        workers_budgetDestroy(&budget);
+        pthread_mutex_destroy(&state.records);
+
+        for (int n = 1; n < workers_nodes(); n++) {
+            ZSTD_aov_freeDict(copies[n]);
+        }
+    } else {
+        atomic_store(&stats->failed, bt->count);
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        ZSTD_aov_freeCtx(ctxs[i]);
+    }
+
+    free(order);
+    free(ctxs);
+
+    return atomic_load(&stats->failed);
+}
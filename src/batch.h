@@ -0,0 +1,105 @@
+
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "args.h"
+#include "scan.h"
+#include "types.h"
+#include "zstandard.h"
+
+
+/* Size of the blocks the paths of a batch are allocated from. */
+#define BATCH_BLOCK_SIZE          (64 * 1024)
+
+/* Time of opening, probing and writing a file, in nanoseconds, on top of its bytes. */
+#define BATCH_COST_FILE           20000
+
+/* Bytes a compressed file costs on top of its own, for setting up the context with the dictionary. */
+#define BATCH_COST_FILE_BYTES     (16 * 1024)
+
+/* Under a memory budget, the free buffers and workspaces kept for reuse add up to at most 1/N of it. */
+#define BATCH_CACHE_SHARE         8
+
+/* Percentage of the memory limit of the process taken as the default budget, the rest left as headroom. */
+#define BATCH_MEMORY_SHARE        90
+
+
+struct job {
+    /* Path of the file to read. */
+    char *input;
+
+    /* Path of the file to write, may be the same as `input`. */
+    char *output;
+
+    /* Kind and sizes of the input, filled in by `batch_probe`. */
+    file_info info;
+};
+
+typedef struct job job;
+
+
+struct batch_block;
+
+
+struct batch {
+    /* Files to process, in insertion order. */
+    job *jobs;
+
+    /* Number of jobs in the batch. */
+    size_t count;
+
+    /* Number of jobs the `jobs` array can hold. */
+    size_t capacity;
+
+    /* Blocks holding the paths of the jobs, the newest first, freed with the batch. */
+    struct batch_block *blocks;
+};
+
+typedef struct batch batch;
+
+
+/**
+ * Counters of a batch run, updated concurrently by the workers.
+ */
+struct batch_stats {
+    /* Files processed (or verified) successfully. */
+    _Atomic size_t passed;
+
+    /* Files that failed. */
+    _Atomic size_t failed;
+
+    /* Files left untouched, such as AES-wrapped files when verifying. */
+    _Atomic size_t skipped;
+
+    /* Decompressed and compressed bytes of the verified files. */
+    _Atomic size_t insize;
+    _Atomic size_t outsize;
+
+    /* Time the workers took from the first job to the last, and the time the cost model predicted, in seconds. */
+    double makespan;
+    double predicted;
+
+    /* Whether the jobs were scheduled, so `predicted` holds a prediction. */
+    bool scheduled;
+};
+
+typedef struct batch_stats batch_stats;
+
+
+extern void batch_init(batch *bt);
+extern void batch_free(batch *bt);
+
+extern bool batch_add(batch *bt, const char *input, const char *output);
+extern bool batch_addFile(batch *bt, const char *file, const char *output);
+extern bool batch_addDir(batch *bt, const char *dir, const char *output);
+extern bool batch_addList(batch *bt, const char *list, const char *output);
+
+extern void batch_probe(batch *bt, int threads);
+extern size_t batch_run(const batch *bt, const arguments *args, const ZSTD_aov_dict *d, batch_stats *stats);
+
+#endif
@@ -0,0 +1,68 @@
+
+
+#include <stddef.h>
+
+#include "embed.h"
+#include "types.h"
+
+
+#ifndef AOV_NO_EMBED_DICT
+
+#define EMBED_STRING_(x)          #x
+#define EMBED_STRING(x)           EMBED_STRING_(x)
+
+/* Assembler name of a C symbol, "_name" where the target prefixes them. */
+#define EMBED_SYMBOL(name)        EMBED_STRING(__USER_LABEL_PREFIX__) #name
+
+#ifdef _WIN32
+#   define EMBED_SECTION          ".section .rdata,\"dr\"\n"
+#else
+#   define EMBED_SECTION          ".section .rodata\n"
+#endif
+
+/**
+ * The dictionary file is copied into the read-only data of the executable
+ * by the assembler, so it is part of the image the loader maps and the
+ * program reads no file to get it.
+ */
+__asm__(
+    EMBED_SECTION
+    ".balign 16\n"
+    ".globl " EMBED_SYMBOL(embed_dict_start) "\n"
+    EMBED_SYMBOL(embed_dict_start) ":\n"
+    ".incbin \"" EMBED_DICT_FILE "\"\n"
+    ".globl " EMBED_SYMBOL(embed_dict_end) "\n"
+    EMBED_SYMBOL(embed_dict_end) ":\n"
+    ".byte 0\n"
+    ".text\n"
+);
+
+extern const byte embed_dict_start[];
+extern const byte embed_dict_end[];
+
+#endif
+
+
+/**
+ * Returns the dictionary built into the executable.
+ *
+ * The data lives as long as the program and must not be freed.
+ *
+ * @return: The dictionary, or NULL when built with `AOV_NO_EMBED_DICT`.
+ */
+extern const bytes *embed_dictionary(void) {
+
+    #ifndef AOV_NO_EMBED_DICT
+        static bytes dict;
+
+        if (dict.data == NULL) {
+            dict.data = (byte *)embed_dict_start;
+            dict.size = (size_t)(embed_dict_end - embed_dict_start);
+            dict.capacity = dict.size;
+        }
+
+        return dict.size ? &dict : NULL;
+    #else
+        return NULL;
+    #endif
+}
@@ -0,0 +1,17 @@
+
+
+#ifndef EMBED_H
+#define EMBED_H
+
+#include "types.h"
+
+
+/* Dictionary built into the executable, relative to the directory the build runs from. */
+#ifndef EMBED_DICT_FILE
+#   define EMBED_DICT_FILE        "bin/dict.zst"
+#endif
+
+
+extern const bytes *embed_dictionary(void);
+
+#endif
@@ -0,0 +1,543 @@
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "args.h"
+#include "batch.h"
+#include "estimate.h"
+#include "io.h"
+#include "log.h"
+#include "scan.h"
+#include "types.h"
+#include "utils.h"
+#include "workers.h"
+#include "zstandard.h"
+
+
+/* Bytes the AoV header and stored size add to every compressed file. */
+#define ESTIMATE_FILE_OVERHEAD    (HEADER_SIZE + FRAME_HEADER_SIZE)
+
+
+/**
+ * A block of content compressed by `--estimate`: a whole file, or one
+ * block of a larger one.
+ */
+struct estimate_unit {
+    /* Index of the file in the batch, and the content the block covers. */
+    size_t job;
+    uint64_t offset;
+    size_t size;
+
+    /* Times the sample drew the block, 1 when every block is measured. */
+    size_t draws;
+
+    /* Compressed size without the headers of the file, and the time it took, in nanoseconds. */
+    uint64_t csize;
+    uint64_t ns;
+    bool ok;
+};
+
+typedef struct estimate_unit estimate_unit;
+
+
+/**
+ * State shared by the workers of an estimate, one job per sampled file.
+ */
+struct estimate_state {
+    const batch *bt;
+    const ZSTD_aov_dict *d;
+    estimate_unit *units;
+
+    /* The blocks of the i-th sampled file are units[first[i]] to units[first[i + 1]]. */
+    size_t *first;
+
+    /* One context set per worker thread. */
+    ZSTD_aov_ctx **ctxs;
+};
+
+typedef struct estimate_state estimate_state;
+
+
+/**
+ * Returns the bytes a file holds for compression: the content of AoV
+ * files, which a repack decompresses first, and the file itself for plain
+ * (and damaged) files. AES-wrapped files are kept as they are and
+ * unreadable ones skipped, so they have none.
+ */
+static uint64_t estimate_content(const file_info *info) {
+
+    switch (info->kind) {
+        case FILE_AOV:
+            return info->dsize;
+        case FILE_PLAIN:
+        case FILE_DAMAGED:
+            return info->size;
+        default:
+            return 0;
+    }
+}
+
+
+/**
+ * Returns the next number of a SplitMix64 sequence. The sample is drawn
+ * from a seed taken from the batch, so the same files give the same
+ * estimate.
+ */
+static uint64_t estimate_random(uint64_t *state) {
+
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+
+    return z ^ (z >> 31);
+}
+
+
+static int estimate_compareOffsets(const void *a, const void *b) {
+
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * Returns the two-sided 95% quantile of Student's t distribution with `df`
+ * degrees of freedom, from the normal one (Cornish-Fisher expansion, within
+ * 1% from 3 degrees of freedom).
+ */
+static double estimate_quantile(size_t df) {
+
+    double z = ESTIMATE_Z95;
+    double n = (double)(df ? df : 1);
+
+    return z + (z * z * z + z) / (4 * n) + (5 * pow(z, 5) + 16 * z * z * z + 3 * z) / (96 * n * n);
+}
+
+
+/**
+ * Reads a block of a plain file.
+ *
+ * @return: The block, or NULL if it cannot be read in full.
+ */
+static bytes *estimate_readBlock(FILE *fptr, uint64_t offset, size_t size) {
+
+    #ifdef _WIN32
+        bool seeked = _fseeki64(fptr, (long long)offset, SEEK_SET) == 0;
+    #else
+        bool seeked = fseeko(fptr, (off_t)offset, SEEK_SET) == 0;
+    #endif
+
+    bytes *b = seeked ? bytes_init(size) : NULL;
+
+    if (b != NULL && fread(b->data, 1, size, fptr) != size) {
+        bytes_free(b);
+        b = NULL;
+    }
+
+    return b;
+}
+
+
+/**
+ * Compresses the sampled blocks of one file, and times them. The time of
+ * reading and decompressing an AoV file is shared among its blocks by
+ * size, as the full run pays it once per file.
+ */
+static void estimate_measure(size_t index, int worker, void *arg) {
+
+    estimate_state *state = (estimate_state *)arg;
+    ZSTD_aov_ctx *ctx = state->ctxs[worker];
+
+    estimate_unit *first = &state->units[state->first[index]];
+    estimate_unit *last = &state->units[state->first[index + 1]];
+
+    const job *j = &state->bt->jobs[first->job];
+    uint64_t content = estimate_content(&j->info);
+
+    uint64_t start = time_ns();
+
+    bytes *whole = NULL;
+    FILE *fptr = NULL;
+
+    if (j->info.kind == FILE_AOV) {
+        whole = read_file(j->input);
+        whole = whole ? ZSTD_aov_decompress_usingDict(ctx, whole, state->d) : NULL;
+
+        if (whole != NULL && whole->size != content) {
+            bytes_free(whole);
+            whole = NULL;
+        }
+    } else {
+        fptr = fopen(j->input, "rb");
+    }
+
+    uint64_t prepare = time_ns() - start;
+
+    if (whole == NULL && fptr == NULL) {
+        log_error("Cannot %s: %s", j->info.kind == FILE_AOV ? "decompress" : "read file", j->input);
+        return;
+    }
+
+    for (estimate_unit *u = first; u < last; u++) {
+        start = time_ns();
+
+        bytes *b = NULL;
+
+        if (whole != NULL) {
+            b = bytes_init(u->size);
+
+            if (b != NULL) {
+                memcpy(b->data, whole->data + u->offset, u->size);
+            }
+        } else {
+            b = estimate_readBlock(fptr, u->offset, u->size);
+        }
+
+        b = b ? ZSTD_aov_compress_usingDict(ctx, b, state->d) : NULL;
+
+        if (b == NULL) {
+            log_error("Failed to compress the block at %llu: %s", (unsigned long long)u->offset, j->input);
+            continue;
+        }
+
+        u->csize = b->size - ESTIMATE_FILE_OVERHEAD;
+        u->ns = time_ns() - start + (content ? prepare * u->size / content : 0);
+        u->ok = true;
+
+        log_debug("Sampled %s at %llu: %zu -> %llu bytes in %.3f ms", j->input, (unsigned long long)u->offset,
+                  u->size, (unsigned long long)u->csize, u->ns / 1e6);
+
+        bytes_free(b);
+    }
+
+    bytes_free(whole);
+
+    if (fptr != NULL) {
+        fclose(fptr);
+    }
+}
+
+
+/**
+ * Picks the blocks to compress: every block when there are no more than
+ * `samples`, else `samples` draws of a byte of content at random, each
+ * picking the block that holds it, so blocks are drawn with probability
+ * proportional to their size. The blocks are listed in batch order, each
+ * once with the times it was drawn.
+ *
+ * @param files: Indexes of the files with content, in batch order.
+ * @param starts: Offset of each file in the content of all of them.
+ * @param total: The content of all the files.
+ * @param census: Receives whether every block is measured.
+ * @return: The number of blocks picked, or 0 if out of memory.
+ */
+static size_t estimate_pick(const batch *bt, const size_t *files, const uint64_t *starts, size_t nfiles,
+                            uint64_t total, size_t samples, estimate_unit **units, bool *census) {
+
+    uint64_t nblocks = 0;
+
+    for (size_t i = 0; i < nfiles; i++) {
+        uint64_t size = estimate_content(&bt->jobs[files[i]].info);
+        nblocks += (size + ESTIMATE_BLOCK_SIZE - 1) / ESTIMATE_BLOCK_SIZE;
+    }
+
+    *census = nblocks <= samples;
+
+    size_t count = *census ? (size_t)nblocks : samples;
+
+    estimate_unit *u = (estimate_unit *)calloc(count ? count : 1, sizeof(estimate_unit));
+    uint64_t *offsets = *census ? NULL : (uint64_t *)malloc(count * sizeof(uint64_t));
+
+    if (u == NULL || (!*census && offsets == NULL)) {
+        free(u);
+        free(offsets);
+        return 0;
+    }
+
+    size_t n = 0;
+
+    if (*census) {
+        for (size_t i = 0; i < nfiles; i++) {
+            uint64_t size = estimate_content(&bt->jobs[files[i]].info);
+
+            for (uint64_t offset = 0; offset < size; offset += ESTIMATE_BLOCK_SIZE) {
+                u[n].job = files[i];
+                u[n].offset = offset;
+                u[n].size = (size_t)(size - offset < ESTIMATE_BLOCK_SIZE ? size - offset : ESTIMATE_BLOCK_SIZE);
+                u[n++].draws = 1;
+            }
+        }
+    } else {
+        uint64_t seed = total ^ ((uint64_t)bt->count << 32);
+
+        for (size_t i = 0; i < count; i++) {
+            offsets[i] = estimate_random(&seed) % total;
+        }
+
+        qsort(offsets, count, sizeof(uint64_t), estimate_compareOffsets);
+
+        size_t f = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            while (f + 1 < nfiles && starts[f + 1] <= offsets[i]) {
+                f++;
+            }
+
+            uint64_t size = estimate_content(&bt->jobs[files[f]].info);
+            uint64_t offset = (offsets[i] - starts[f]) / ESTIMATE_BLOCK_SIZE * ESTIMATE_BLOCK_SIZE;
+
+            if (n > 0 && u[n - 1].job == files[f] && u[n - 1].offset == offset) {
+                u[n - 1].draws++;
+                continue;
+            }
+
+            u[n].job = files[f];
+            u[n].offset = offset;
+            u[n].size = (size_t)(size - offset < ESTIMATE_BLOCK_SIZE ? size - offset : ESTIMATE_BLOCK_SIZE);
+            u[n++].draws = 1;
+        }
+
+        free(offsets);
+    }
+
+    *units = u;
+
+    return n;
+}
+
+
+/**
+ * Estimates the output size and the time of compressing a probed batch at
+ * the requested level, from a sample of its content compressed with the
+ * real dictionary, and prints them with 95% confidence intervals: as
+ * text, or as an NDJSON record with `--log-json`. AoV files count as
+ * repacked (decompressed, then compressed again) and AES-wrapped files as
+ * kept as they are. Nothing is written.
+ *
+ * Blocks are drawn with probability proportional to their size, so the
+ * totals are estimated as the content times the mean ratio (or time per
+ * byte) of the draws (Hansen-Hurwitz), with a Student's t interval. When
+ * the sample would hold every block, every block is measured instead and
+ * the size is exact. The time is the processor time spread over the
+ * workers the run would use, and never less than the largest file takes
+ * alone; it leaves out writing the files.
+ *
+ * @param bt: The files to estimate, classified by `batch_probe`.
+ * @param args: The parsed command-line arguments, `args->estimate` giving the number of samples.
+ * @param d: The digested dictionary, at the requested level.
+ * @return: The number of files that could not be read or sampled.
+ */
+extern size_t estimate_run(const batch *bt, const arguments *args, const ZSTD_aov_dict *d) {
+
+    uint64_t begin = time_ns();
+
+    size_t *files = (size_t *)malloc((bt->count ? bt->count : 1) * sizeof(size_t));
+    uint64_t *starts = (uint64_t *)malloc((bt->count ? bt->count : 1) * sizeof(uint64_t));
+
+    if (files == NULL || starts == NULL) {
+        log_error("Cannot set up the estimate: %s", "out of memory");
+        free(files);
+        free(starts);
+        return bt->count;
+    }
+
+    size_t nfiles = 0;
+    size_t naes = 0;
+    size_t nunreadable = 0;
+    uint64_t aes = 0;
+    uint64_t total = 0;
+    uint64_t largest = 0;
+
+    for (size_t i = 0; i < bt->count; i++) {
+        const file_info *info = &bt->jobs[i].info;
+
+        if (info->kind == FILE_AES) {
+            naes++;
+            aes += info->size;
+            continue;
+        }
+
+        if (info->kind == FILE_UNREADABLE) {
+            log_error("Cannot read file: %s", bt->jobs[i].input);
+            nunreadable++;
+            continue;
+        }
+
+        uint64_t size = estimate_content(info);
+
+        files[nfiles] = i;
+        starts[nfiles++] = total;
+        total += size;
+
+        if (size > largest) {
+            largest = size;
+        }
+    }
+
+    estimate_unit *units = NULL;
+    bool census = true;
+    size_t nunits = total ? estimate_pick(bt, files, starts, nfiles, total, (size_t)args->estimate, &units, &census) : 0;
+
+    /* The sampled files, each with the range of its blocks. */
+    size_t *first = (size_t *)malloc((nunits + 1) * sizeof(size_t));
+    size_t nsampled = 0;
+
+    for (size_t i = 0; first != NULL && i < nunits; i++) {
+        if (i == 0 || units[i].job != units[i - 1].job) {
+            first[nsampled++] = i;
+        }
+    }
+
+    if (first != NULL) {
+        first[nsampled] = nunits;
+    }
+
+    /* Measure on no more threads than processors, so the time of each block is its processor time. */
+    int nthreads = workers_count(args->threads, nsampled);
+
+    if (nthreads > workers_default()) {
+        nthreads = workers_default();
+    }
+
+    ZSTD_aov_ctx **ctxs = (ZSTD_aov_ctx **)calloc((size_t)(nthreads > 0 ? nthreads : 1), sizeof(ZSTD_aov_ctx *));
+
+    if ((total && units == NULL) || first == NULL || ctxs == NULL) {
+        log_error("Cannot set up the estimate: %s", "out of memory");
+        nthreads = 0;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        ctxs[i] = ZSTD_aov_createCtx();
+
+        if (ctxs[i] == NULL) {
+            nthreads = i;
+            break;
+        }
+    }
+
+    estimate_state state = { bt, d, units, first, ctxs };
+
+    if (nthreads > 0) {
+        workers_run(nthreads, nsampled, estimate_measure, &state);
+    } else if (nsampled > 0) {
+        log_error("Cannot set up the estimate: %s", "no worker context");
+    }
+
+    /* Totals of the draws: compressed size and time, each scaled to the whole content. */
+    size_t ndraws = 0;
+    size_t nfailed = 0;
+    size_t failedjob = SIZE_MAX;
+    uint64_t sampled = 0;
+    double size = 0, sizesq = 0;
+    double work = 0, worksq = 0;
+
+    for (size_t i = 0; i < nunits; i++) {
+        const estimate_unit *u = &units[i];
+
+        if (!u->ok) {
+            nfailed += u->job != failedjob;
+            failedjob = u->job;
+            continue;
+        }
+
+        sampled += u->size;
+
+        double y = census ? (double)u->csize : (double)total * u->csize / u->size;
+        double t = census ? (double)u->ns : (double)total * u->ns / u->size;
+
+        ndraws += u->draws;
+        size += y * u->draws;
+        sizesq += y * y * u->draws;
+        work += t * u->draws;
+        worksq += t * t * u->draws;
+    }
+
+    double sizeerror = 0;
+    double workerror = 0;
+
+    if (!census && ndraws > 0) {
+        size /= ndraws;
+        work /= ndraws;
+
+        if (ndraws > 1) {
+            double q = estimate_quantile(ndraws - 1);
+
+            sizeerror = q * sqrt(fmax(sizesq / ndraws - size * size, 0) * ndraws / (ndraws - 1) / ndraws);
+            workerror = q * sqrt(fmax(worksq / ndraws - work * work, 0) * ndraws / (ndraws - 1) / ndraws);
+        }
+    }
+
+    /* Every compressed file has the AoV headers, AES-wrapped files stay as they are. */
+    double overhead = (double)nfiles * ESTIMATE_FILE_OVERHEAD + (double)aes;
+
+    /* The run spreads the files over its workers, on as many processors as there are. */
+    int workers = workers_count(args->threads, bt->count);
+    int cores = workers < workers_default() ? workers : workers_default();
+
+    if (cores < 1) {
+        cores = 1;
+    }
+
+    double alone = total ? work * largest / total : 0;
+    double seconds = fmax(work / cores, alone) / 1e9;
+    double seconds_low = fmax((work - workerror) / cores, alone * (work - workerror) / (work > 0 ? work : 1)) / 1e9;
+    double seconds_high = fmax((work + workerror) / cores, alone * (work + workerror) / (work > 0 ? work : 1)) / 1e9;
+
+    double ratio = total ? size / total : 0;
+    double elapsed = (double)(time_ns() - begin) / 1e9;
+
+    if (args->logjson) {
+        printf("{\"summary\":\"estimate\",\"files\":%zu,\"aes\":%zu,\"unreadable\":%zu,\"failed\":%zu,\"content\":%llu,"
+               "\"level\":%d,\"threads\":%d,\"census\":%s,\"blocks\":%zu,\"draws\":%zu,\"sampled\":%llu,"
+               "\"size\":%.0f,\"size_low\":%.0f,\"size_high\":%.0f,\"ratio\":%.6f,"
+               "\"seconds\":%.6f,\"seconds_low\":%.6f,\"seconds_high\":%.6f,\"cpu_seconds\":%.6f,\"elapsed\":%.6f}\n",
+               nfiles, naes, nunreadable, nfailed, (unsigned long long)total, args->compressionlevel, workers,
+               census ? "true" : "false", nunits, ndraws, (unsigned long long)sampled,
+               size + overhead, fmax(size - sizeerror, 0) + overhead, size + sizeerror + overhead, ratio,
+               seconds, fmax(seconds_low, 0), seconds_high, work / 1e9, elapsed);
+    } else {
+        printf("Estimated compression of %zu files (%llu bytes of content) at level %d on %d thread%s:\n",
+               nfiles, (unsigned long long)total, args->compressionlevel, workers, workers > 1 ? "s" : "");
+
+        if (census) {
+            printf("  Output  %.0f bytes (ratio %.4f), measured on every block\n", size + overhead, ratio);
+        } else {
+            printf("  Output  %.0f bytes (ratio %.4f), 95%% CI %.0f - %.0f\n", size + overhead, ratio,
+                   fmax(size - sizeerror, 0) + overhead, size + sizeerror + overhead);
+        }
+
+        printf("  Time    %.3f s, 95%% CI %.3f - %.3f (%.3f s of processor time, without writing)\n",
+               seconds, fmax(seconds_low, 0), seconds_high, work / 1e9);
+
+        printf("  Sample  %zu block%s of %llu bytes (%.1f%% of the content) from %zu draws, in %.3f s\n",
+               nunits, nunits != 1 ? "s" : "", (unsigned long long)sampled,
+               total ? 100.0 * sampled / total : 0, ndraws, elapsed);
+
+        if (naes || nunreadable || nfailed) {
+            printf("  Kept %zu AES-wrapped files as they are (%llu bytes), skipped %zu unreadable, %zu failed.\n",
+                   naes, (unsigned long long)aes, nunreadable, nfailed);
+        }
+    }
+
+    fflush(stdout);
+
+    for (int i = 0; i < nthreads; i++) {
+        ZSTD_aov_freeCtx(ctxs[i]);
+    }
+
+    free(ctxs);
+    free(first);
+    free(units);
+    free(starts);
+    free(files);
+
+    return nunreadable + nfailed;
+}
@@ -0,0 +1,26 @@
+
+
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include <stddef.h>
+
+#include "args.h"
+#include "zstandard.h"
+
+struct batch;
+
+
+/* Number of samples `--estimate` draws unless given. */
+#define ESTIMATE_SAMPLES          256
+
+/* Size of the blocks larger files are sampled by; smaller files are sampled whole. */
+#define ESTIMATE_BLOCK_SIZE       (128 * 1024)
+
+/* Normal quantile of the two-sided 95% confidence intervals. */
+#define ESTIMATE_Z95              1.959964
+
+
+extern size_t estimate_run(const struct batch *bt, const arguments *args, const ZSTD_aov_dict *d);
+
+#endif
@@ -1,14 +1,192 @@
 
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#endif
+
+#ifdef _WIN32
+#   include <fcntl.h>
+    /* Declared here because `<io.h>` is shadowed by this project's io.h. */
+    extern int _setmode(int fd, int mode);
+#endif
 
 #include "io.h"
 #include "types.h"
 
 
+/**
+ * Checks whether a path refers to the standard streams ("-").
+ *
+ * @param path: The path to check.
+ * @return: `true` for "-", `false` otherwise.
+ */
+extern bool isstdio(const char *path) {
+
+    return path != NULL && strcmp(path, STDIO_PATH) == 0;
+}
+
+
+/**
+ * Opens a file for streaming, mapping "-" to stdin or stdout depending
+ * on the mode. Standard streams are switched to binary mode.
+ *
+ * @param path: The path to open, or "-".
+ * @param mode: An fopen mode, "rb" or "wb".
+ * @return: The opened stream, or NULL on failure.
+ */
+extern FILE *open_stream(const char *path, const char *mode) {
+
+    if (!isstdio(path)) {
+        return fopen(path, mode);
+    }
+
+    FILE *fptr = mode[0] == 'r' ? stdin : stdout;
+
+    #ifdef _WIN32
+        _setmode(_fileno(fptr), _O_BINARY);
+    #endif
+
+    return fptr;
+}
+
+
+/**
+ * Closes a stream returned by `open_stream`. Standard streams are only
+ * flushed, never closed.
+ *
+ * @param fptr: The stream to close.
+ */
+extern void close_stream(FILE *fptr) {
+
+    if (fptr == NULL) {
+        return;
+    }
+
+    if (fptr == stdin || fptr == stdout) {
+        fflush(fptr);
+        return;
+    }
+
+    fclose(fptr);
+}
+
+
+/**
+ * Reads a stream of unknown length (such as a pipe) until end of file.
+ *
+ * @param fptr: The stream to read.
+ * @return: A pointer to a `bytes` structure with the data, or NULL on failure.
+ */
+extern bytes *read_stream(FILE *fptr) {
+
+    bytes *result = bytes_init(64 * 1024);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    size_t size = 0;
+
+    for (;;) {
+        size += fread(result->data + size, 1, result->capacity - size, fptr);
+
+        if (size < result->capacity) {
+            break;
+        }
+
+        if (!bytes_reserve(result, result->capacity * 2)) {
+            bytes_free(result);
+            return NULL;
+        }
+    }
+
+    if (ferror(fptr)) {
+        bytes_free(result);
+        return NULL;
+    }
+
+    result->size = size;
+
+    return result;
+}
+
+
+/**
+ * Gets the size of the regular file behind a stream from its metadata,
+ * with 64-bit sizes on every platform (`ftell` returns a `long`, 32 bits
+ * on Windows).
+ *
+ * @param fptr: The stream to inspect.
+ * @param size: Receives the size of the file.
+ * @return: `true` for a regular file, `false` for pipes, terminals and errors.
+ */
+extern bool file_size(FILE *fptr, uint64_t *size) {
+
+    #ifdef _WIN32
+        struct _stat64 st;
+
+        if (_fstat64(_fileno(fptr), &st) != 0 || (st.st_mode & _S_IFMT) != _S_IFREG) {
+            return false;
+        }
+    #else
+        struct stat st;
+
+        if (fstat(fileno(fptr), &st) != 0 || !S_ISREG(st.st_mode)) {
+            return false;
+        }
+    #endif
+
+    *size = (uint64_t)st.st_size;
+
+    return true;
+}
+
+
+/**
+ * Gets the number of bytes left to read in a regular file, from its size
+ * and the 64-bit position of the stream.
+ *
+ * @param fptr: The stream to inspect.
+ * @param remaining: Receives the number of bytes left.
+ * @return: `true` for a regular file, `false` for pipes, terminals and errors.
+ */
+extern bool stream_remaining(FILE *fptr, uint64_t *remaining) {
+
+    uint64_t size;
+
+    if (!file_size(fptr, &size)) {
+        return false;
+    }
+
+    #ifdef _WIN32
+        long long pos = _ftelli64(fptr);
+    #else
+        long long pos = (long long)ftello(fptr);
+    #endif
+
+    if (pos < 0 || (uint64_t)pos > size) {
+        return false;
+    }
+
+    *remaining = size - (uint64_t)pos;
+
+    return true;
+}
+
+
 /**
  * Reads the contents of a binary file and returns it as a `bytes` structure.
  *
+ * The file is sized from its metadata, so files past 2 GiB (where `ftell`
+ * overflows a 32-bit `long`) read whole on 64-bit hosts; files larger than
+ * the address space fail. Other files, such as pipes, are read to the end.
+ *
  * @param path: The path to the file to be read.
  * @return: A pointer to a `bytes` structure containing the file data, 
  *          or `NULL` if the file could not be read or an error occurred.
@@ -20,21 +198,35 @@ extern bytes *read_file(const char *path) {
     if (fptr == NULL) {
         return NULL;
     }
-    
-    fseek(fptr, 0, SEEK_END);
 
-    long size = ftell(fptr);
+    uint64_t size;
+
+    if (!file_size(fptr, &size)) {
+        bytes *result = read_stream(fptr);
+        fclose(fptr);
+        return result;
+    }
 
-    bytes *result = bytes_init((size_t)size);
+    bytes *result = size <= SIZE_MAX ? bytes_init((size_t)size) : NULL;
 
     if (result == NULL || result->data == NULL) {
+        bytes_free(result);
         fclose(fptr);
         return NULL;
     }
 
-    fseek(fptr, 0, SEEK_SET);
+    size_t rsize = 0;
+
+    /* A single call may return less than asked for, at most about 2 GiB on some systems. */
+    while (rsize < result->size) {
+        size_t n = fread(result->data + rsize, 1, result->size - rsize, fptr);
 
-    size_t rsize = fread(result->data, 1, result->size, fptr);
+        if (n == 0) {
+            break;
+        }
+
+        rsize += n;
+    }
 
     if (rsize != result->size) {
         bytes_free(result);
@@ -53,16 +245,104 @@ extern bytes *read_file(const char *path) {
  *
  * @param path: The path to the file where the data should be written.
  * @param b: The `bytes` structure containing the data to write.
+ * @return: `true` if all of the data reached the file, `false` otherwise.
  */
-extern void write_file(const char *path, bytes *b) {
+extern bool write_file(const char *path, bytes *b) {
 
     FILE *fptr = fopen(path, "wb");
 
-    if (fptr == NULL || b->data == NULL) {
-        return;
+    if (fptr == NULL) {
+        return false;
     }
 
-    fwrite(b->data, 1, b->size, fptr);
+    bool ok = b->size == 0 || (b->data != NULL && fwrite(b->data, 1, b->size, fptr) == b->size);
 
-    fclose(fptr);
-}
\ No newline at end of file
+    /* Buffered data is only written, and its errors seen, on close. */
+    ok = fclose(fptr) == 0 && ok;
+
+    return ok;
+}
+
+/**
+ * Creates (or truncates) an output file at its final size and maps it in
+ * memory, so data can be decoded straight into the page cache instead of
+ * a buffer that is written afterwards. The blocks are reserved first, so
+ * a full disk or quota fails here rather than with a SIGBUS on a write
+ * to the mapping.
+ *
+ * @param path: The path of the output file.
+ * @param size: The final size of the file, must not be 0.
+ * @param m: Receives the mapping.
+ * @return: `true` on success, `false` if the file cannot be mapped (the
+ *          caller should fall back to `write_file`).
+ */
+extern bool map_output(const char *path, size_t size, mapped_file *m) {
+
+    #ifdef __linux__
+
+        m->data = NULL;
+        m->size = size;
+        m->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+        if (m->fd < 0) {
+            return false;
+        }
+
+        if (posix_fallocate(m->fd, 0, (off_t)size) == 0) {
+            void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+
+            if (data != MAP_FAILED) {
+                m->data = (byte *)data;
+                return true;
+            }
+        }
+
+        close(m->fd);
+        m->fd = -1;
+
+        return false;
+
+    #else
+
+        (void)path;
+        (void)size;
+        (void)m;
+
+        return false;
+
+    #endif
+}
+
+
+/**
+ * Unmaps and closes a file mapped by `map_output`.
+ *
+ * @param m: The mapping.
+ * @param path: The path of the output file.
+ * @param keep: `false` to remove the file, when its contents are incomplete.
+ * @return: `true` if the file was kept and closed without error.
+ */
+extern bool unmap_output(mapped_file *m, const char *path, bool keep) {
+
+    #ifdef __linux__
+
+        bool ok = munmap(m->data, m->size) == 0;
+
+        ok = close(m->fd) == 0 && ok;
+
+        if (!keep || !ok) {
+            unlink(path);
+            return false;
+        }
+
+        return true;
+
+    #else
+
+        (void)m;
+        (void)path;
+
+        return keep;
+
+    #endif
+}
@@ -3,10 +3,53 @@
 #ifndef IO_H
 #define IO_H
 
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "types.h"
 
 
+/* Path that stands for stdin (as input) or stdout (as output). */
+#define STDIO_PATH                "-"
+
+/* Outputs at least this large are written through a memory mapping. */
+#define MAP_OUTPUT_MIN            (256 * 1024)
+
+/* Inputs at least this large are streamed in constant memory instead of read whole. */
+#define STREAM_INPUT_MIN          (64ull * 1024 * 1024)
+
+
+/**
+ * An output file mapped in memory at its final size.
+ */
+struct mapped_file {
+    /* The mapped contents of the file. */
+    byte *data;
+
+    /* Size of the file and of the mapping. */
+    size_t size;
+
+    /* Descriptor of the open file. */
+    int fd;
+};
+
+typedef struct mapped_file mapped_file;
+
+
+extern bool isstdio(const char *path);
+
+extern FILE *open_stream(const char *path, const char *mode);
+extern void close_stream(FILE *fptr);
+
+extern bool file_size(FILE *fptr, uint64_t *size);
+extern bool stream_remaining(FILE *fptr, uint64_t *remaining);
+
+extern bytes *read_stream(FILE *fptr);
 extern bytes *read_file(const char *path);
-extern void write_file(const char *path, bytes *b);
+extern bool write_file(const char *path, bytes *b);
+
+extern bool map_output(const char *path, size_t size, mapped_file *m);
+extern bool unmap_output(mapped_file *m, const char *path, bool keep);
 
 #endif
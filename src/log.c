@@ -0,0 +1,789 @@
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "log.h"
+#include "types.h"
+
+
+/* Record flag: the message is a pre-formatted block printed without prefix. */
+#define LOG_FLAG_BLOCK            0x01
+
+/* Record flag: filler up to the end of the ring, skip to offset 0. */
+#define LOG_FLAG_PAD              0x02
+
+/* Records are aligned to the size of their header, so a header always fits before the end of the ring. */
+#define LOG_ALIGN                 32
+
+
+/**
+ * Header written in front of every message stored in a ring buffer.
+ */
+struct log_record {
+    /* Total size of the record including this header, aligned to LOG_ALIGN. */
+    uint32_t size;
+
+    /* Length of the message that follows the header. */
+    uint32_t len;
+
+    /* Global sequence number used to merge rings in emission order. */
+    uint64_t seq;
+
+    /* Wall clock time of the call, in nanoseconds since the epoch. */
+    uint64_t ts;
+
+    /* One of LogLevel. */
+    uint8_t level;
+
+    /* Combination of LOG_FLAG_*. */
+    uint8_t flags;
+
+    uint8_t _reserved[6];
+};
+
+typedef struct log_record log_record;
+
+_Static_assert(sizeof(log_record) <= LOG_ALIGN && LOG_RING_SIZE % LOG_ALIGN == 0,
+               "a record header must fit in the room left before the end of the ring");
+
+
+/**
+ * Single-producer/single-consumer ring owned by one logging thread and
+ * drained by the flusher thread. Positions grow monotonically and are
+ * reduced modulo LOG_RING_SIZE when addressing `data`.
+ */
+struct log_ring {
+    byte data[LOG_RING_SIZE];
+
+    /* Position up to which records are visible to the flusher. */
+    _Atomic size_t head;
+
+    /* Position up to which records have been consumed by the flusher. */
+    _Atomic size_t tail;
+
+    /* Producer-local write position (ahead of `head` while held). */
+    size_t pending;
+
+    /* Nesting depth of log_hold() on the owning thread. */
+    int hold;
+
+    /* Small thread number reported in NDJSON output. */
+    unsigned id;
+
+    /* Set once the owning thread has exited; the flusher frees the ring when drained. */
+    _Atomic bool retired;
+
+    struct log_ring *next;
+};
+
+typedef struct log_ring log_ring;
+
+
+static struct {
+    FILE *stream;
+    int level;
+    int format;
+
+    bool running;
+    bool stop;
+
+    /* Incremented on every log_init(), invalidates stale thread rings. */
+    unsigned generation;
+
+    pthread_t flusher;
+
+    /* Thread-specific key whose destructor retires the ring of an exiting thread. */
+    pthread_key_t key;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t flushed;
+
+    /* log_flush() requests and the request number covered by the last drain. */
+    uint64_t flush_requested;
+    uint64_t flush_done;
+
+    log_ring *rings;
+    unsigned nrings;
+
+    _Atomic uint64_t seq;
+
+    /* Output staging buffer owned by the flusher. */
+    char *out;
+    size_t outsize;
+    size_t outcap;
+} g_log = {
+    .level = LOG_INFO,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .flushed = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread log_ring *tls_ring;
+static __thread unsigned tls_generation;
+static __thread char tls_message[LOG_MESSAGE_MAX];
+
+static pthread_once_t g_log_key_once = PTHREAD_ONCE_INIT;
+
+
+static const char *level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+static const char *level_json[] = { "error", "warn", "info", "debug" };
+
+
+/**
+ * Converts a level name (error, warn, info, debug) into a LogLevel.
+ *
+ * @param name: The level name, case sensitive.
+ * @return: The matching LogLevel, or -1 if the name is unknown.
+ */
+extern int log_parseLevel(const char *name) {
+
+    for (int i = LOG_ERROR; i <= LOG_DEBUG; i++) {
+        if (strcmp(name, level_json[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+static uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+
+static void out_reserve(size_t n) {
+
+    if (g_log.outsize + n <= g_log.outcap) {
+        return;
+    }
+
+    size_t cap = g_log.outcap ? g_log.outcap : LOG_RING_SIZE;
+
+    while (cap < g_log.outsize + n) {
+        cap *= 2;
+    }
+
+    char *out = (char *)realloc(g_log.out, cap);
+    if (out == NULL) {
+        /* Drop what cannot be staged rather than abort the run. */
+        return;
+    }
+
+    g_log.out = out;
+    g_log.outcap = cap;
+}
+
+
+static void out_append(const char *s, size_t n) {
+
+    out_reserve(n);
+
+    if (g_log.outsize + n > g_log.outcap) {
+        return;
+    }
+
+    memcpy(g_log.out + g_log.outsize, s, n);
+    g_log.outsize += n;
+}
+
+
+static void out_json_string(const char *s, size_t n) {
+
+    static const char hex[] = "0123456789abcdef";
+
+    out_append("\"", 1);
+
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)s[i];
+        char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0F] };
+
+        switch (c) {
+            case '"':  out_append("\\\"", 2); break;
+            case '\\': out_append("\\\\", 2); break;
+            case '\n': out_append("\\n", 2); break;
+            case '\r': out_append("\\r", 2); break;
+            case '\t': out_append("\\t", 2); break;
+            default:
+                if (c < 0x20) {
+                    out_append(esc, sizeof(esc));
+                } else {
+                    out_append((const char *)&s[i], 1);
+                }
+                break;
+        }
+    }
+
+    out_append("\"", 1);
+}
+
+
+/**
+ * Writes a string to a stream as a quoted JSON string, for reports that
+ * are printed directly rather than logged.
+ *
+ * @param stream: The stream to write to.
+ * @param s: The NUL-terminated string.
+ */
+extern void log_jsonString(FILE *stream, const char *s) {
+
+    fputc('"', stream);
+
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+
+        switch (c) {
+            case '"':  fputs("\\\"", stream); break;
+            case '\\': fputs("\\\\", stream); break;
+            case '\n': fputs("\\n", stream); break;
+            case '\r': fputs("\\r", stream); break;
+            case '\t': fputs("\\t", stream); break;
+            default:
+                if (c < 0x20) {
+                    fprintf(stream, "\\u%04x", c);
+                } else {
+                    fputc(c, stream);
+                }
+                break;
+        }
+    }
+
+    fputc('"', stream);
+}
+
+
+static bool is_blank(const char *s, size_t n) {
+
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] != '\n') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * Renders one record into the flusher's staging buffer.
+ */
+static void out_record(const log_ring *ring, const log_record *rec, const char *msg) {
+
+    char prefix[96];
+    int n;
+
+    if (g_log.format == LOG_FORMAT_JSON) {
+        /* Blank separator lines only make sense in text mode. */
+        if ((rec->flags & LOG_FLAG_BLOCK) && is_blank(msg, rec->len)) {
+            return;
+        }
+
+        n = snprintf(prefix, sizeof(prefix), "{\"ts\":%llu.%06llu,\"level\":\"%s\",\"thread\":%u,\"msg\":",
+                     (unsigned long long)(rec->ts / 1000000000ull),
+                     (unsigned long long)(rec->ts % 1000000000ull / 1000ull),
+                     level_json[rec->level], ring->id);
+
+        out_append(prefix, (size_t)n);
+        out_json_string(msg, rec->len);
+        out_append("}\n", 2);
+        return;
+    }
+
+    if (rec->flags & LOG_FLAG_BLOCK) {
+        out_append(msg, rec->len);
+        return;
+    }
+
+    n = snprintf(prefix, sizeof(prefix), "[%-7s] ", level_names[rec->level]);
+
+    out_append(prefix, (size_t)n);
+    out_append(msg, rec->len);
+    out_append("\n", 1);
+}
+
+
+/**
+ * Moves every published record from all rings to the output stream,
+ * merging rings by sequence number so the output follows call order.
+ */
+static void drain(void) {
+
+    pthread_mutex_lock(&g_log.mutex);
+    log_ring *rings = g_log.rings;
+    pthread_mutex_unlock(&g_log.mutex);
+
+    /* Other threads only prepend rings and only the flusher unlinks them, so the snapshot stays valid. */
+    for (;;) {
+        log_ring *best = NULL;
+        const log_record *best_rec = NULL;
+
+        for (log_ring *ring = rings; ring; ring = ring->next) {
+            size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+            while (tail != head) {
+                const log_record *rec = (const log_record *)(ring->data + tail % LOG_RING_SIZE);
+
+                if (rec->flags & LOG_FLAG_PAD) {
+                    tail += rec->size;
+                    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+                    continue;
+                }
+
+                if (best_rec == NULL || rec->seq < best_rec->seq) {
+                    best = ring;
+                    best_rec = rec;
+                }
+                break;
+            }
+        }
+
+        if (best == NULL) {
+            break;
+        }
+
+        out_record(best, best_rec, (const char *)(best_rec + 1));
+
+        atomic_fetch_add_explicit(&best->tail, best_rec->size, memory_order_release);
+
+        if (g_log.outsize >= LOG_RING_SIZE) {
+            fwrite(g_log.out, 1, g_log.outsize, g_log.stream);
+            g_log.outsize = 0;
+        }
+    }
+
+    if (g_log.outsize) {
+        fwrite(g_log.out, 1, g_log.outsize, g_log.stream);
+        g_log.outsize = 0;
+    }
+
+    fflush(g_log.stream);
+}
+
+
+/**
+ * Unlinks and frees the rings of exited threads once they are drained, so
+ * short-lived threads (e.g. daemon connections) do not keep theirs.
+ * Called by the flusher only, the one thread walking the rings unlocked.
+ */
+static void reclaim(void) {
+
+    pthread_mutex_lock(&g_log.mutex);
+
+    for (log_ring **link = &g_log.rings; *link;) {
+        log_ring *ring = *link;
+
+        /* The last records are published before the ring is marked retired. */
+        if (atomic_load_explicit(&ring->retired, memory_order_acquire) &&
+            atomic_load_explicit(&ring->tail, memory_order_relaxed) ==
+            atomic_load_explicit(&ring->head, memory_order_relaxed)) {
+            *link = ring->next;
+            free(ring);
+            continue;
+        }
+
+        link = &ring->next;
+    }
+
+    pthread_mutex_unlock(&g_log.mutex);
+}
+
+
+static void *flusher_main(void *arg) {
+
+    (void)arg;
+
+    pthread_mutex_lock(&g_log.mutex);
+
+    for (;;) {
+        bool stop = g_log.stop;
+        uint64_t requested = g_log.flush_requested;
+
+        if (!stop && requested == g_log.flush_done) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+
+            deadline.tv_nsec += 50 * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000L;
+            }
+
+            pthread_cond_timedwait(&g_log.wake, &g_log.mutex, &deadline);
+
+            stop = g_log.stop;
+            requested = g_log.flush_requested;
+        }
+
+        pthread_mutex_unlock(&g_log.mutex);
+
+        drain();
+        reclaim();
+
+        pthread_mutex_lock(&g_log.mutex);
+
+        g_log.flush_done = requested;
+        pthread_cond_broadcast(&g_log.flushed);
+
+        if (stop) {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&g_log.mutex);
+
+    return NULL;
+}
+
+
+/**
+ * Returns the calling thread's ring, registering a new one on first use.
+ */
+static log_ring *thread_ring(void) {
+
+    if (tls_ring && tls_generation == g_log.generation) {
+        return tls_ring;
+    }
+
+    log_ring *ring = (log_ring *)calloc(1, sizeof(log_ring));
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_log.mutex);
+
+    ring->id = g_log.nrings++;
+    ring->next = g_log.rings;
+    g_log.rings = ring;
+
+    pthread_mutex_unlock(&g_log.mutex);
+
+    tls_ring = ring;
+    tls_generation = g_log.generation;
+
+    pthread_setspecific(g_log.key, ring);
+
+    return ring;
+}
+
+
+static void publish(log_ring *ring) {
+
+    atomic_store_explicit(&ring->head, ring->pending, memory_order_release);
+
+    /* Wake the flusher early once a ring is half full. */
+    if (ring->pending - atomic_load_explicit(&ring->tail, memory_order_relaxed) >= LOG_RING_SIZE / 2) {
+        pthread_cond_signal(&g_log.wake);
+    }
+}
+
+
+/**
+ * Destructor of the thread-specific key, run when a thread that logged
+ * exits. Publishes what the thread held back and hands its ring over to
+ * the flusher. The ring is looked up through the thread-local variables,
+ * which are still valid here, and under the lock log_shutdown() frees the
+ * rings with, so a freed ring is never touched.
+ */
+static void ring_retire(void *value) {
+
+    (void)value;
+
+    pthread_mutex_lock(&g_log.mutex);
+
+    log_ring *ring = tls_ring;
+
+    if (g_log.running && ring && tls_generation == g_log.generation) {
+        publish(ring);
+
+        atomic_store_explicit(&ring->retired, true, memory_order_release);
+        pthread_cond_signal(&g_log.wake);
+    }
+
+    tls_ring = NULL;
+
+    pthread_mutex_unlock(&g_log.mutex);
+}
+
+
+static void key_create(void) {
+
+    pthread_key_create(&g_log.key, ring_retire);
+}
+
+
+/**
+ * Blocks until `size` bytes starting at the producer position are free.
+ */
+static void wait_space(log_ring *ring, size_t size) {
+
+    while (ring->pending + size - atomic_load_explicit(&ring->tail, memory_order_acquire) > LOG_RING_SIZE) {
+        /* Unpublished records can never be drained; give them up first. */
+        if (ring->pending != atomic_load_explicit(&ring->head, memory_order_relaxed)) {
+            publish(ring);
+        }
+
+        pthread_cond_signal(&g_log.wake);
+        sched_yield();
+    }
+}
+
+
+static void ring_push(log_ring *ring, int level, uint8_t flags, const char *msg, size_t len) {
+
+    size_t size = (sizeof(log_record) + len + LOG_ALIGN - 1) & ~(size_t)(LOG_ALIGN - 1);
+    size_t room = LOG_RING_SIZE - ring->pending % LOG_RING_SIZE;
+
+    if (size > room) {
+        wait_space(ring, room);
+
+        log_record *pad = (log_record *)(ring->data + ring->pending % LOG_RING_SIZE);
+        pad->size = (uint32_t)room;
+        pad->flags = LOG_FLAG_PAD;
+
+        ring->pending += room;
+    }
+
+    wait_space(ring, size);
+
+    log_record *rec = (log_record *)(ring->data + ring->pending % LOG_RING_SIZE);
+
+    rec->size = (uint32_t)size;
+    rec->len = (uint32_t)len;
+    rec->seq = atomic_fetch_add_explicit(&g_log.seq, 1, memory_order_relaxed);
+    rec->ts = now_ns();
+    rec->level = (uint8_t)level;
+    rec->flags = flags;
+
+    memcpy(rec + 1, msg, len);
+
+    ring->pending += size;
+
+    if (ring->hold == 0) {
+        publish(ring);
+    }
+}
+
+
+/**
+ * Starts the background flusher. Until this is called (and after
+ * log_shutdown()), log calls write synchronously to stdout.
+ *
+ * @param stream: Destination of the log output (stdout or stderr).
+ * @param level: Most verbose LogLevel that is emitted.
+ * @param format: One of LogFormat.
+ */
+extern void log_init(FILE *stream, int level, int format) {
+
+    if (g_log.running) {
+        log_shutdown();
+    }
+
+    g_log.stream = stream;
+    g_log.level = level;
+    g_log.format = format;
+    g_log.stop = false;
+    g_log.flush_requested = 0;
+    g_log.flush_done = 0;
+    g_log.generation++;
+
+    pthread_once(&g_log_key_once, key_create);
+
+    if (pthread_create(&g_log.flusher, NULL, flusher_main, NULL) == 0) {
+        g_log.running = true;
+    }
+}
+
+
+/**
+ * Drains all pending records, stops the flusher and releases the rings.
+ * No other thread may log while this runs.
+ */
+extern void log_shutdown(void) {
+
+    if (!g_log.running) {
+        return;
+    }
+
+    if (tls_ring && tls_generation == g_log.generation) {
+        publish(tls_ring);
+    }
+
+    pthread_mutex_lock(&g_log.mutex);
+    g_log.stop = true;
+    pthread_cond_signal(&g_log.wake);
+    pthread_mutex_unlock(&g_log.mutex);
+
+    pthread_join(g_log.flusher, NULL);
+
+    pthread_mutex_lock(&g_log.mutex);
+
+    while (g_log.rings) {
+        log_ring *next = g_log.rings->next;
+        free(g_log.rings);
+        g_log.rings = next;
+    }
+
+    free(g_log.out);
+
+    g_log.out = NULL;
+    g_log.outsize = 0;
+    g_log.outcap = 0;
+    g_log.nrings = 0;
+    g_log.running = false;
+
+    pthread_mutex_unlock(&g_log.mutex);
+
+    tls_ring = NULL;
+}
+
+
+/**
+ * Blocks until every record logged before the call has been written.
+ * Use before printing to the log stream directly.
+ */
+extern void log_flush(void) {
+
+    if (!g_log.running) {
+        fflush(stdout);
+        return;
+    }
+
+    if (tls_ring && tls_generation == g_log.generation) {
+        publish(tls_ring);
+    }
+
+    pthread_mutex_lock(&g_log.mutex);
+
+    uint64_t request = ++g_log.flush_requested;
+    pthread_cond_signal(&g_log.wake);
+
+    while (g_log.flush_done < request) {
+        pthread_cond_wait(&g_log.flushed, &g_log.mutex);
+    }
+
+    pthread_mutex_unlock(&g_log.mutex);
+}
+
+
+/**
+ * Checks whether records of the given level are emitted. Callers can
+ * use it to skip building expensive messages.
+ */
+extern bool log_enabled(int level) {
+
+    return level <= g_log.level;
+}
+
+
+/**
+ * Defers publication of the calling thread's records until the matching
+ * log_release(), so a group of lines is never interleaved with another
+ * thread's output.
+ */
+extern void log_hold(void) {
+
+    log_ring *ring = g_log.running ? thread_ring() : NULL;
+
+    if (ring) {
+        ring->hold++;
+    }
+}
+
+
+extern void log_release(void) {
+
+    log_ring *ring = g_log.running ? thread_ring() : NULL;
+
+    if (ring && ring->hold > 0 && --ring->hold == 0) {
+        publish(ring);
+    }
+}
+
+
+extern void log_vwrite(int level, const char *fmt, va_list ap) {
+
+    if (!log_enabled(level)) {
+        return;
+    }
+
+    log_ring *ring = g_log.running ? thread_ring() : NULL;
+
+    if (ring == NULL) {
+        printf("[%-7s] ", level_names[level]);
+        vprintf(fmt, ap);
+        printf("\n");
+        return;
+    }
+
+    int len = vsnprintf(tls_message, sizeof(tls_message), fmt, ap);
+
+    if (len < 0) {
+        return;
+    }
+
+    if ((size_t)len >= sizeof(tls_message)) {
+        len = sizeof(tls_message) - 1;
+    }
+
+    ring_push(ring, level, 0, tls_message, (size_t)len);
+}
+
+
+/**
+ * Formats and logs a single line at the given level.
+ *
+ * @param level: One of LogLevel.
+ * @param fmt: printf-style format of the message, without trailing newline.
+ */
+extern void log_write(int level, const char *fmt, ...) {
+
+    va_list ap;
+
+    va_start(ap, fmt);
+    log_vwrite(level, fmt, ap);
+    va_end(ap);
+}
+
+
+/**
+ * Logs a pre-formatted, possibly multi-line block. In text mode the block
+ * is written verbatim; in NDJSON mode it becomes the record's message.
+ *
+ * @param level: One of LogLevel.
+ * @param text: The block to log.
+ * @param len: Length of `text` in bytes.
+ */
+extern void log_block(int level, const char *text, size_t len) {
+
+    if (!log_enabled(level)) {
+        return;
+    }
+
+    log_ring *ring = g_log.running ? thread_ring() : NULL;
+
+    if (ring == NULL) {
+        fwrite(text, 1, len, stdout);
+        return;
+    }
+
+    if (len > LOG_MESSAGE_MAX) {
+        len = LOG_MESSAGE_MAX;
+    }
+
+    ring_push(ring, level, LOG_FLAG_BLOCK, text, len);
+}
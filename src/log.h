@@ -0,0 +1,63 @@
+
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+
+/* Capacity in bytes of the ring buffer owned by each logging thread. */
+#define LOG_RING_SIZE             (64 * 1024)
+
+/* Longest message accepted by a single log record (longer ones are truncated). */
+#define LOG_MESSAGE_MAX           4096
+
+
+enum LogLevel {
+    /* Failures that abort processing of a file or of the whole run. */
+    LOG_ERROR                 = 0,
+
+    /* Suspicious conditions that do not stop processing. */
+    LOG_WARN,
+
+    /* Progress information, enabled by `--verbose`. */
+    LOG_INFO,
+
+    /* Developer diagnostics. */
+    LOG_DEBUG
+};
+
+
+enum LogFormat {
+    /* Human readable `[LEVEL  ] message` lines. */
+    LOG_FORMAT_TEXT           = 0,
+
+    /* One JSON object per line (NDJSON). */
+    LOG_FORMAT_JSON
+};
+
+
+extern int log_parseLevel(const char *name);
+
+extern void log_init(FILE *stream, int level, int format);
+extern void log_shutdown(void);
+extern void log_flush(void);
+
+extern bool log_enabled(int level);
+extern void log_hold(void);
+extern void log_release(void);
+
+extern void log_write(int level, const char *fmt, ...);
+extern void log_vwrite(int level, const char *fmt, va_list ap);
+extern void log_block(int level, const char *text, size_t len);
+
+extern void log_jsonString(FILE *stream, const char *s);
+
+#define log_error(...)            log_write(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...)             log_write(LOG_WARN, __VA_ARGS__)
+#define log_info(...)             log_write(LOG_INFO, __VA_ARGS__)
+#define log_debug(...)            log_write(LOG_DEBUG, __VA_ARGS__)
+
+#endif
@@ -4,232 +4,465 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <time.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#   include <unistd.h>
+#endif
 
 #include "aes.h"
 #include "args.h"
+#include "batch.h"
+#include "embed.h"
+#include "estimate.h"
 #include "io.h"
-
-#ifdef _WIN32
-#   include "dirent.h"
-#elif __linux__
-#   include <dirent.h>
-#endif
-
+#include "log.h"
+#include "match.h"
 #include "message.h"
+#include "pool.h"
+#include "scan.h"
+#include "server.h"
 #include "types.h"
 #include "utils.h"
 #include "version.h"
+#include "workers.h"
+#include "zmem.h"
 #include "zstandard.h"
 
 
-int main(int argc, char *argv[]) {
+/* Dictionary of the game files, relative to the working directory or the executable, in builds without one built in. */
+#define DICT_PATH "bin/dict.zst"
+
+
+/**
+ * Clears the terminal screen.
+ */
+static void clear_screen(void) {
 
-    /* Clear screen. */ 
-    #ifdef _WIN32 
+    #ifdef _WIN32
         system("cls");
     #else
         system("clear");
     #endif
+}
+
+
+/**
+ * Creates an output directory if it does not exist yet.
+ *
+ * @param path: The directory to create.
+ */
+static void make_output_dir(const char *path) {
+
+    if (/* If the specified output path does not exist. */
+        !isdir(path)) {
+
+        #ifdef _WIN32
+            mkdir(path);
+        #elif __linux__
+            mkdir(path, 0700);
+        #endif
+    }
+}
+
+
+/**
+ * Finds the dictionary to compress with: the one given with `--dict`, else
+ * the one built into the executable. Builds without one look for
+ * `bin/dict.zst` in the working directory, then next to the executable, so
+ * the tool can be run from any directory.
+ *
+ * @param args: The parsed command-line arguments.
+ * @param path: Buffer for the path found.
+ * @param size: Size of `path`.
+ * @return: The path of the dictionary, or NULL for the built-in one.
+ */
+static const char *find_dictionary(const arguments *args, char *path, size_t size) {
+
+    if (args->dict) {
+        return args->dict;
+    }
+
+    if (embed_dictionary() != NULL) {
+        return NULL;
+    }
+
+    snprintf(path, size, "./%s", DICT_PATH);
+
+    #ifdef __linux__
+        char exe[4096];
+        ssize_t n = isfile(path) ? -1 : readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+
+        if (n > 0) {
+            exe[n] = '\0';
+
+            char *slash = strrchr(exe, '/');
+
+            if (slash) {
+                *slash = '\0';
+                snprintf(path, size, "%s/%s", exe, DICT_PATH);
+            }
+
+            /* Errors still name the usual place when neither exists. */
+            if (!isfile(path)) {
+                snprintf(path, size, "./%s", DICT_PATH);
+            }
+        }
+    #endif
+
+    return path;
+}
+
+
+/**
+ * Compresses or decompresses between a file and a pipe without holding
+ * the data in memory.
+ *
+ * @return: `true` on success, `false` on failure.
+ */
+static bool run_stream(const arguments *args, const ZSTD_aov_dict *d) {
+
+    const char *output = args->output ? args->output : args->file;
+
+    ZSTD_aov_ctx *ctx = ZSTD_aov_createCtx();
+
+    FILE *in = ctx ? open_stream(args->file, "rb") : NULL;
+    FILE *out = in ? open_stream(output, "wb") : NULL;
+
+    long long written = -1;
+
+    if (in && out) {
+        if (args->compress) {
+            written = ZSTD_aov_compressStream(ctx, in, out, d, AES_HEADER);
+        } else {
+            written = ZSTD_aov_decompressStream(ctx, in, out, d);
+        }
+    }
+
+    close_stream(in);
+    close_stream(out);
+
+    ZSTD_aov_freeCtx(ctx);
+
+    if (written < 0) {
+        log_error("Failed to %s: %s", args->compress ? "compress" : "decompress", args->file);
+        return false;
+    }
+
+    log_info("%s: %s", "File", isstdio(args->file) ? "<stdin>" : args->file);
+    log_info("%s: %s", "Mode", args->compress ? "compression": "decompression");
+    log_info("%s: %lld bytes", "Size", written);
+    log_info("Output written to: %s", isstdio(output) ? "<stdout>" : output);
+
+    return true;
+}
+
+
+/**
+ * Prints the summary of a `--verify` run once the logger is drained, so
+ * it is always the last line of the output.
+ *
+ * @param stats: The counters of the run.
+ * @param json: Whether to print it as a JSON object.
+ * @param seconds: The wall-clock time of the run.
+ */
+static void report_verify(batch_stats *stats, bool json, double seconds) {
+
+    size_t passed = atomic_load(&stats->passed);
+    size_t failed = atomic_load(&stats->failed);
+    size_t skipped = atomic_load(&stats->skipped);
+    size_t insize = atomic_load(&stats->insize);
+    size_t outsize = atomic_load(&stats->outsize);
+
+    double mbs = seconds > 0 ? (double)insize / seconds / 1e6 : 0;
+
+    if (json) {
+        printf("{\"summary\":\"verify\",\"passed\":%zu,\"failed\":%zu,\"skipped\":%zu,"
+               "\"bytes\":%zu,\"compressed\":%zu,\"seconds\":%.6f}\n",
+               passed, failed, skipped, insize, outsize, seconds);
+    } else {
+        printf("Verified %zu files: %zu passed, %zu failed, %zu skipped (%zu -> %zu bytes, %.1f MB/s).\n",
+               passed + failed, passed, failed, skipped, insize, outsize, mbs);
+    }
+
+    fflush(stdout);
+}
+
+
+/**
+ * Prints the summary record of `--batch`, after the records of the files.
+ */
+static void report_batch(batch_stats *stats, double seconds) {
+
+    size_t passed = atomic_load(&stats->passed);
+    size_t failed = atomic_load(&stats->failed);
+    size_t skipped = atomic_load(&stats->skipped);
+
+    printf("{\"summary\":\"batch\",\"files\":%zu,\"ok\":%zu,\"skipped\":%zu,\"failed\":%zu,\"seconds\":%.6f,"
+           "\"makespan\":%.6f,\"predicted\":",
+           passed + skipped + failed, passed, skipped, failed, seconds, stats->makespan);
+
+    /* No prediction when the jobs were not scheduled (a single file or processor). */
+    if (stats->scheduled) {
+        printf("%.6f}\n", stats->predicted);
+    } else {
+        printf("null}\n");
+    }
+
+    fflush(stdout);
+}
+
+
+int main(int argc, char *argv[]) {
 
     arguments args;
 
+    int status = EXIT_SUCCESS;
+
     /* Extract the program name from the full path. */
     argv[0] = basename(argv[0]);
 
     /* Initialize argument structure. */
     args_init(&args);
 
-    /* This header is used to identify the uncompressed data.*/
-    const byte AES_HEADER[HEADER_SIZE] = {0x22, 0x4A, 0x67, 0x00};
-
-    /* Load the compression dictionary from the specified file. */
-    bytes *dict = ZSTD_loadDictionary("./bin/dict.zst");
+    /* The compression dictionary, built in or loaded once the options are known. */
+    const bytes *dict = NULL;
+    bytes *loaded = NULL;
 
     if (argc > 1) {
 
-        clock_t start = clock();
+        uint64_t start = time_ns();
 
         args_parse(argc, argv, &args);
 
         if (args._conflict == IS_CONFLICT) {
-            /* Free the loaded dictionary. */ 
-            bytes_free(dict);
             return EXIT_FAILURE;
         }
 
-        if (!args.version) {
-            version();
-        }
+        /* When data goes to stdout, every message must stay off it. */
+        bool tostdout = isstdio(args.output) || (isstdio(args.file) && !args.output) || args.scan || args.matchoriginal || args.batch || args.estimate;
+
+        /* Scripts get the records alone, without clearing the terminal or a banner. */
+        if (!tostdout) {
+
+            /* Clear screen, unless running as a daemon. */
+            if (!args.serve) {
+                clear_screen();
+            }
 
-        /* Display information about the options used. */ 
-        opt_info(argc, argv, &args);
+            if (!args.version) {
+                version();
+            }
+
+            /* Display information about the options used. */
+            opt_info(argc, argv, &args);
+        }
 
         /**
-         * Requires the user to specify one of the following modes: 
+         * Requires the user to specify one of the following modes:
          *      `--compress`   (-c) for compression
          *      `--decompress` (-d) for decompression
          */
-        if (!(args.compress || args.decompress) || (args.compress && args.decompress)) {
+        if ((!(args.compress || args.decompress) || (args.compress && args.decompress)) && !args.serve && !args.verify && !args.scan && !args.matchoriginal && !args.estimate) {
             usage(argv[0]);
             return EXIT_FAILURE;
         }
 
-        /* Default compression level of Arena Of Valor. */
-        if (args.compress && !args.compressionlevel) {
-            args.compressionlevel = ZSTD_aov_compressionlevel;
+        /* Zstandard workspaces come from a pool of mappings, set up before any context exists. */
+        zmem_init(args.hugepages);
+
+        /* Per-file records go through the asynchronous logger from here on. */
+        log_init(tostdout ? stderr : stdout, args.loglevel >= 0 ? args.loglevel : (args.verbose ? LOG_INFO : LOG_WARN),
+                 args.logjson ? LOG_FORMAT_JSON : LOG_FORMAT_TEXT);
+
+        /* Pinned workers are spread over the processors and NUMA nodes the process may use. */
+        if (!workers_init(args.pin)) {
+            log_warn("Cannot bind worker threads to processors on this system: %s", "running unpinned");
+        } else if (args.pin) {
+            log_info("Binding worker threads to processors over %d NUMA nodes", workers_nodes());
         }
 
-        if (args.dir) {
+        /* Load the compression dictionary, and the dictionaries picked by ID to decompress. */
+        char dictpath[4096];
+        const char *dictfile = find_dictionary(&args, dictpath, sizeof(dictpath));
 
-            struct dirent *entry;
+        if (dictfile) {
+            dict = loaded = ZSTD_loadDictionary(dictfile);
+        } else {
+            dict = embed_dictionary();
+            dictfile = "(built in)";
+        }
 
-            DIR *dir = opendir(args.dir);
+        ZSTD_aov_registry *registry = NULL;
 
-            if (dir == NULL) {
-                return EXIT_FAILURE;
-            }
+        if (args.dictdir) {
+            registry = ZSTD_aov_createRegistry();
 
-            /* Determine output path if specified. */ 
-            if (args.output) {
-                if (/* If the specified output path does not exist. */ 
-                    !isdir(args.output)) {
+            size_t registered = registry ? ZSTD_aov_registerDir(registry, args.dictdir) : 0;
 
-                    #ifdef _WIN32
-                        mkdir(args.output);
-                    #elif __linux__
-                        mkdir(args.output, 0700);
-                    #endif
-                }
+            if (registered) {
+                log_info("Registered %zu dictionaries from %s", registered, args.dictdir);
+            } else {
+                log_warn("No dictionary with an ID in: %s", args.dictdir);
             }
+        }
 
-            while ((entry = readdir(dir)) != NULL) {
-                /* Skip the current directory (.) and parent directory (..). */ 
-                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-                    continue;
-                }
-                
-                char *path = path_join(args.dir, entry->d_name);
-                bytes *b = read_file(path);
- 
-                /* Perform compression or decompression based on the flags. */ 
-                if (args.compress) {
-
-                    if (ZSTD_isNotDecompressedData(b->data, AES_HEADER)) {
-                        continue;
-                    } else {
-                        /* Compress the data. */
-                        b = ZSTD_aov_compress(b, dict, args.compressionlevel);
-                    }
+        /* Verifying and estimating both go through compression. */
+        if (args.verify || args.estimate) {
+            args.compress = true;
+        }
 
-                } else if (args.decompress) {
-                    /* Decompress the data. */ 
-                    b = ZSTD_aov_decompress(b, dict);
-                }
+        /* Default compression level of Arena Of Valor. */
+        if (args.compress && !args.compressionlevel) {
+            args.compressionlevel = ZSTD_aov_compressionlevel;
+        }
 
-                /* Determine output path if specified. */ 
-                if (args.output) {
+        if (args.serve) {
 
-                    free(path);
+            /* The daemon keeps its own digested dictionaries per level. */
+            status = server_run(args.serve, &args, dict, registry);
 
-                    path = path_join(args.output, entry->d_name);
-                }
+            log_shutdown();
+            ZSTD_aov_freeRegistry(registry);
+            bytes_free(loaded);
 
-                if (args.verbose) {
+            return status;
+        }
 
-                    printf("\n[%-7s] %s: %s\n", "INFO", "File", entry->d_name);
-                    printf("[%-7s] %s: %s\n\n", "INFO", "Mode", args.compress ? "compression": "decompression");
+        /* Digest the dictionary once for every file of the run, a scan or a search needs none. */
+        bool digest = !args.scan && !args.matchoriginal;
 
-                    preview(b, 0, 128, 16);
+        ZSTD_aov_dict *d = !digest ? NULL : ZSTD_aov_createDict_advanced(dict, args.compress ? args.compressionlevel : 0, &args.params);
 
-                    if (args.compress) {
-                        printf("\n[%-7s] %s: %d\n", "INFO", "compression level", args.compressionlevel);
-                    }
+        if (d != NULL) {
+            d->registry = registry;
+        }
 
-                    printf(args.decompress ? "\n" : "");
-                    printf("[%-7s] %s: %zu bytes\n", "INFO", "Size", b->size);
-                    printf("[%-7s] Output written to: %s\n", "INFO", path);
+        if (d != NULL && d->advanced) {
+            const ZSTD_compressionParameters *cp = &d->cparams;
 
-                }
+            log_info("Compression parameters: level %d, wlog=%u, clog=%u, hlog=%u, slog=%u, mml=%u, tlen=%u, strat=%d, lcm=%d",
+                     args.compressionlevel, cp->windowLog, cp->chainLog, cp->hashLog, cp->searchLog, cp->minMatch,
+                     cp->targetLength, (int)cp->strategy, d->literalCompressionMode);
+        }
 
-                write_file(path, b);
+        #ifdef __linux__
+            if (ZSTD_aov_isa) {
+                log_debug("Zstandard ISA: %s", ZSTD_aov_isa());
+            }
+        #endif
 
-                /* Free the allocated memory for the bytes. */
-                bytes_free(b);
+        batch bt;
+        batch_init(&bt);
 
-                free(path);
-            }
+        batch_stats stats;
+        bool ran = false;
 
-            /* Close the directory stream. */ 
-            closedir(dir);
+        if (d == NULL && digest) {
 
-        } else if (args.file) {
+            log_error("Cannot load the dictionary: %s", dictfile);
+            status = EXIT_FAILURE;
 
-            char *path = args.file;
-            bytes *b = read_file(path);
+        } else if (args.file && (isstdio(args.file) || isstdio(args.output))) {
 
-            /* Perform compression or decompression based on the flags. */ 
-            if (args.compress) {
+            if (!run_stream(&args, d)) {
+                status = EXIT_FAILURE;
+            }
 
-                if (ZSTD_isNotDecompressedData(b->data, AES_HEADER)) {
-                    /* Pass. */
-                } else {
-                    /* Compress the data. */
-                    b = ZSTD_aov_compress(b, dict, args.compressionlevel);
-                }
+        } else {
+
+            /* Determine output path if specified. */
+            if (args.output && (args.dir || args.fileslist)) {
+                make_output_dir(args.output);
+            }
 
-            } else if (args.decompress) {
-                /* Decompress the data. */ 
-                b = ZSTD_aov_decompress(b, dict);
+            bool listed = true;
+
+            if (args.dir) {
+                listed = batch_addDir(&bt, args.dir, args.output);
+            } else if (args.fileslist) {
+                listed = batch_addList(&bt, args.fileslist, args.output);
+            } else if (args.file) {
+                listed = batch_addFile(&bt, args.file, args.output);
             }
 
-            /* Determine output path if specified. */ 
-            if (args.output) {
-                /* If output is a directory, join it with the file's base name. */ 
-                if (isdir(args.output)) {
-                    path = path_join(args.output, basename(args.file));
+            if (!listed) {
+                log_error("Cannot read the input list: %s", args.dir ? args.dir : args.fileslist ? args.fileslist : args.file);
+                status = EXIT_FAILURE;
+            } else {
+                /* Classify every file from its header first, so the run is planned up front. */
+                batch_probe(&bt, args.threads);
+
+                if (args.scan) {
+                    if (scan_run(&bt, &args) > 0) {
+                        status = EXIT_FAILURE;
+                    }
+                } else if (args.matchoriginal) {
+                    if (match_run(&bt, &args, dict) > 0) {
+                        status = EXIT_FAILURE;
+                    }
+                } else if (args.estimate) {
+                    if (estimate_run(&bt, &args, d) > 0) {
+                        status = EXIT_FAILURE;
+                    }
                 } else {
-                    /* Use the specified output path. */ 
-                    path = args.output;
+                    ran = true;
+
+                    /* A single file, an explicit list, a verification or a batch fails as a whole. */
+                    if (batch_run(&bt, &args, d, &stats) > 0 && (!args.dir || args.verify || args.batch)) {
+                        status = EXIT_FAILURE;
+                    }
                 }
             }
+        }
 
-            if (args.verbose) {
+        bool verified = bt.count > 0 && d != NULL;
 
-                printf("\n[%-7s] %s: %s\n", "INFO", "File", basename(args.file));
-                printf("[%-7s] %s: %s\n\n", "INFO", "Mode", args.compress ? "compression": "decompression");
+        batch_free(&bt);
+        ZSTD_aov_freeDict(d);
+        ZSTD_aov_freeRegistry(registry);
 
-                preview(b, 0, 128, 16);
+        double time_spent = (double)(time_ns() - start) / 1e9;
 
-                if (args.compress) {
-                    printf("\n[%-7s] %s: %d\n", "INFO", "compression level", args.compressionlevel);
-                }
+        pool_stats pool;
+        pool_getStats(&pool);
 
-                printf(args.decompress ? "\n" : "");
-                printf("[%-7s] %s: %zu bytes\n", "INFO", "Size", b->size);
-                printf("[%-7s] Output written to: %s\n", "INFO", path);
-            }
+        log_debug("Buffers: %zu acquired, %zu reused, %zu mallocs, %zu frees, %zu cached (%zu bytes)",
+                  pool.acquired, pool.reused, pool.mallocs, pool.frees, pool.cached, pool.cached_bytes);
 
-            write_file(path, b);
+        zmem_stats zmem;
+        zmem_getStats(&zmem);
 
-            /* Free the allocated memory for the bytes. */
-            bytes_free(b);
-        }
+        log_debug("Workspaces: %zu allocated, %zu reused, %zu mapped (%zu on huge pages), %zu cached (%zu bytes)",
+                  zmem.allocs, zmem.reused, zmem.maps, zmem.huge, zmem.cached, zmem.cached_bytes);
 
-        clock_t end = clock();
+        log_block(LOG_INFO, "\n", 1);
+        log_info("Execution time: %f seconds", time_spent);
+        log_block(LOG_INFO, "\n", 1);
 
-        double time_spent = (double)(end - start) / CLOCKS_PER_SEC;
+        log_shutdown();
 
-        if (args.verbose) {
-            printf("\n[%-7s] Execution time: %f seconds\n\n", "INFO", time_spent);
+        if (args.verify && verified) {
+            report_verify(&stats, args.logjson, time_spent);
+        }
+
+        if (args.batch && ran) {
+            report_batch(&stats, time_spent);
         }
 
     } else {
-        /* Handle case where no arguments are provided (optional). */ 
+        /* Handle case where no arguments are provided (optional). */
+
+        /* Clear screen. */
+        clear_screen();
     }
 
-    /* Free the loaded dictionary. */ 
-    bytes_free(dict);
+    /* Free the loaded dictionary. */
+    bytes_free(loaded);
+
+    pool_trim();
+    zmem_trim();
 
-    return EXIT_SUCCESS;
+    return status;
 }
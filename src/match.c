@@ -0,0 +1,411 @@
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "args.h"
+#include "batch.h"
+#include "io.h"
+#include "log.h"
+#include "match.h"
+#include "scan.h"
+#include "types.h"
+#include "workers.h"
+#include "zstandard.h"
+
+
+/**
+ * A setting tried by `--match-original`: what `-l` and `--zstd` would
+ * give, so the winner can be passed back to a repack as is.
+ */
+struct match_candidate {
+    int compressionlevel;
+    ZSTD_aov_params params;
+};
+
+typedef struct match_candidate match_candidate;
+
+
+/**
+ * An input file and the candidate that reproduces it.
+ */
+struct match_file {
+    /* The original file and its content, held while its window is searched. */
+    bytes *data;
+    bytes *content;
+
+    ZSTD_aov_header header;
+    match_status status;
+
+    /* Index of the winning candidate, valid when matched. */
+    size_t candidate;
+};
+
+typedef struct match_file match_file;
+
+
+/**
+ * State shared by the workers of a search.
+ */
+struct match_state {
+    const batch *bt;
+    match_file *files;
+
+    /* Files of the window still searched, by index in the batch. */
+    size_t *pending;
+
+    /* Decompression dictionary, and the candidate tried by the current round. */
+    const ZSTD_aov_dict *ddict;
+    const ZSTD_aov_dict *d;
+    size_t candidate;
+
+    /* One context set per worker thread. */
+    ZSTD_aov_ctx **ctxs;
+};
+
+typedef struct match_state match_state;
+
+
+/**
+ * Returns the name of a status, as printed by `--match-original`.
+ */
+static const char *match_statusName(match_status status) {
+
+    static const char *names[MATCH_STATUSES] = { "skipped", "matched", "unmatched", "damaged" };
+
+    return (unsigned)status < MATCH_STATUSES ? names[status] : "unknown";
+}
+
+
+/**
+ * Returns the i-th level tried: the level of the game files, then the
+ * others in increasing order.
+ */
+static int match_level(int i) {
+
+    if (i == 0) {
+        return ZSTD_aov_compressionlevel;
+    }
+
+    return i < ZSTD_aov_compressionlevel ? i : i + 1;
+}
+
+
+/**
+ * Lists the candidates in the order they are tried: the level of the game
+ * files first, then every other level alone, then each level with a window
+ * log set, then each level with literals forced compressed or raw. Most
+ * files match the first one, so later rounds only see the few left.
+ *
+ * @param count: Receives the number of candidates.
+ * @return: The candidates, to be freed by the caller, or NULL on failure.
+ */
+static match_candidate *match_candidates(size_t *count) {
+
+    int maxlevel = ZSTD_maxCLevel();
+    int nwlogs = ZSTD_aov_windowLogMax - MATCH_WINDOWLOG_MIN + 1;
+
+    match_candidate *c = (match_candidate *)calloc((size_t)maxlevel * (size_t)(1 + nwlogs + 2), sizeof(match_candidate));
+
+    if (c == NULL) {
+        return NULL;
+    }
+
+    int nlevels = maxlevel;
+    size_t n = 0;
+
+    for (int i = 0; i < nlevels; i++) {
+        c[n++].compressionlevel = match_level(i);
+    }
+
+    for (int i = 0; i < nlevels; i++) {
+        for (int w = MATCH_WINDOWLOG_MIN; w <= ZSTD_aov_windowLogMax; w++) {
+            c[n].compressionlevel = match_level(i);
+            c[n++].params.windowLog = w;
+        }
+    }
+
+    for (int i = 0; i < nlevels; i++) {
+        c[n].compressionlevel = match_level(i);
+        c[n++].params.literalCompressionMode = ZSTD_ps_enable;
+
+        c[n].compressionlevel = match_level(i);
+        c[n++].params.literalCompressionMode = ZSTD_ps_disable;
+    }
+
+    *count = n;
+
+    return c;
+}
+
+
+/**
+ * Releases the original and the content of a file.
+ */
+static void match_unload(match_file *f) {
+
+    bytes_free(f->data);
+    bytes_free(f->content);
+
+    f->data = NULL;
+    f->content = NULL;
+}
+
+
+/**
+ * Reads an AoV file of the window, checks that the frame starts right
+ * after the header, as in the files this tool writes, and decompresses
+ * it once for all the candidates.
+ */
+static void match_load(size_t index, int worker, void *arg) {
+
+    match_state *state = (match_state *)arg;
+    const job *j = &state->bt->jobs[state->pending[index]];
+    match_file *f = &state->files[state->pending[index]];
+
+    f->status = MATCH_DAMAGED;
+
+    f->data = read_file(j->input);
+
+    if (f->data == NULL
+        || !ZSTD_aov_parseHeader(f->data->data, f->data->size, &f->header)
+        || f->header.frame != HEADER_SIZE + FRAME_HEADER_SIZE) {
+        match_unload(f);
+        return;
+    }
+
+    f->content = bytes_init(f->header.dsize);
+
+    if (f->content == NULL
+        || !ZSTD_aov_decompressInto(state->ctxs[worker], f->data, &f->header, state->ddict, f->content->data)) {
+        match_unload(f);
+        return;
+    }
+
+    f->status = MATCH_UNMATCHED;
+}
+
+
+/**
+ * Tries the candidate of the current round on one pending file.
+ */
+static void match_try(size_t index, int worker, void *arg) {
+
+    match_state *state = (match_state *)arg;
+    match_file *f = &state->files[state->pending[index]];
+
+    if (ZSTD_aov_matchFrame(state->ctxs[worker], f->content->data, f->header.dsize, f->data->data + f->header.frame,
+                            f->data->size - f->header.frame, state->d)) {
+        f->status = MATCH_MATCHED;
+        f->candidate = state->candidate;
+        match_unload(f);
+    }
+}
+
+
+/**
+ * Searches the files of one window: tries the candidates one at a time
+ * on the files left, in parallel, until all of them match.
+ *
+ * @param npending: Number of files of the window, listed in `state->pending`.
+ * @return: The number of candidates tried.
+ */
+static size_t match_window(match_state *state, int nthreads, const match_candidate *candidates, size_t ncandidates,
+                           const bytes *dict, size_t npending) {
+
+    workers_run(nthreads, npending, match_load, state);
+
+    size_t tried = 0;
+
+    for (size_t c = 0; c <= ncandidates; c++) {
+        size_t left = 0;
+
+        for (size_t i = 0; i < npending; i++) {
+            if (state->files[state->pending[i]].status == MATCH_UNMATCHED) {
+                state->pending[left++] = state->pending[i];
+            }
+        }
+
+        if (c > 0 && left < npending) {
+            const match_candidate *mc = &candidates[c - 1];
+            char spec[128];
+
+            log_info("Level %d%s%s reproduces %zu files, %zu left", mc->compressionlevel,
+                     *ZSTD_aov_formatParams(&mc->params, spec, sizeof(spec)) ? " with " : "", spec,
+                     npending - left, left);
+        }
+
+        npending = left;
+
+        if (c == ncandidates || npending == 0) {
+            break;
+        }
+
+        ZSTD_aov_dict *d = ZSTD_aov_createDict_advanced(dict, candidates[c].compressionlevel, &candidates[c].params);
+
+        if (d == NULL) {
+            continue;
+        }
+
+        state->d = d;
+        state->candidate = c;
+
+        workers_run(nthreads, npending, match_try, state);
+
+        ZSTD_aov_freeDict(d);
+
+        tried++;
+    }
+
+    for (size_t i = 0; i < npending; i++) {
+        match_unload(&state->files[state->pending[i]]);
+    }
+
+    return tried;
+}
+
+
+/**
+ * Searches, for every AoV file of a probed batch, the compression level
+ * and parameters that reproduce its compressed bytes exactly, and prints
+ * them in batch order: tab-separated text (status, level, `--zstd`
+ * parameters, path), or NDJSON with `--log-json`. The files are searched
+ * by windows whose originals and contents fit in half the memory budget;
+ * in each, the candidates are tried one at a time on all the files left,
+ * in parallel, and each file stops at its first match.
+ *
+ * @param bt: The files to match, classified by `batch_probe`.
+ * @param args: The parsed command-line arguments.
+ * @param dict: The raw dictionary.
+ * @return: The number of AoV files left unmatched or damaged.
+ */
+extern size_t match_run(const batch *bt, const arguments *args, const bytes *dict) {
+
+    int nthreads = workers_count(args->threads, bt->count);
+
+    size_t ncandidates = 0;
+    match_candidate *candidates = match_candidates(&ncandidates);
+
+    match_file *files = (match_file *)calloc(bt->count ? bt->count : 1, sizeof(match_file));
+    size_t *pending = (size_t *)calloc(bt->count ? bt->count : 1, sizeof(size_t));
+    ZSTD_aov_ctx **ctxs = (ZSTD_aov_ctx **)calloc((size_t)(nthreads > 0 ? nthreads : 1), sizeof(ZSTD_aov_ctx *));
+
+    ZSTD_aov_dict *ddict = ZSTD_aov_createDict(dict, 0);
+
+    if (candidates == NULL || files == NULL || pending == NULL || ctxs == NULL || ddict == NULL) {
+        nthreads = 0;
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        ctxs[i] = ZSTD_aov_createCtx();
+
+        if (ctxs[i] == NULL) {
+            nthreads = i;
+            break;
+        }
+    }
+
+    match_state state = { bt, files, pending, ddict, NULL, 0, ctxs };
+
+    /* The originals and contents of a window take half the budget, the contexts and dictionaries the rest. */
+    uint64_t limit = args->maxmemory >= 0 ? (uint64_t)args->maxmemory
+                   : workers_memoryLimit() / 100 * BATCH_MEMORY_SHARE;
+    uint64_t window = limit ? limit / 2 : UINT64_MAX;
+
+    size_t tried = 0;
+    size_t next = 0;
+
+    if (nthreads == 0) {
+        log_error("Cannot set up the search: %s", "out of memory or dictionary");
+    }
+
+    while (nthreads > 0 && next < bt->count) {
+        size_t npending = 0;
+        uint64_t bytes = 0;
+
+        /* A window holds at least one file, whatever its size. */
+        for (; next < bt->count; next++) {
+            const file_info *info = &bt->jobs[next].info;
+
+            if (info->kind != FILE_AOV) {
+                files[next].status = MATCH_SKIPPED;
+                continue;
+            }
+
+            if (npending > 0 && bytes + info->size + info->dsize > window) {
+                break;
+            }
+
+            bytes += info->size + info->dsize;
+            pending[npending++] = next;
+        }
+
+        if (npending == 0) {
+            break;
+        }
+
+        if (next < bt->count || tried > 0) {
+            log_info("Searching %zu files (%llu bytes)", npending, (unsigned long long)bytes);
+        }
+
+        size_t n = match_window(&state, nthreads, candidates, ncandidates, dict, npending);
+
+        tried = n > tried ? n : tried;
+    }
+
+    size_t counts[MATCH_STATUSES] = { 0 };
+
+    for (size_t i = 0; i < bt->count; i++) {
+        const match_file *f = nthreads > 0 ? &files[i] : NULL;
+        match_status status = f ? f->status : MATCH_DAMAGED;
+
+        int level = 0;
+        char spec[128] = "";
+
+        if (status == MATCH_MATCHED) {
+            level = candidates[f->candidate].compressionlevel;
+            ZSTD_aov_formatParams(&candidates[f->candidate].params, spec, sizeof(spec));
+        }
+
+        counts[status]++;
+
+        if (args->logjson) {
+            printf("{\"status\":\"%s\",\"level\":%d,\"zstd\":\"%s\",\"path\":", match_statusName(status), level, spec);
+            log_jsonString(stdout, bt->jobs[i].input);
+            printf("}\n");
+        } else if (status == MATCH_MATCHED) {
+            printf("%-9s\t%2d\t%-24s\t%s\n", match_statusName(status), level, *spec ? spec : "-", bt->jobs[i].input);
+        } else {
+            printf("%-9s\t%2s\t%-24s\t%s\n", match_statusName(status), "-", "-", bt->jobs[i].input);
+        }
+    }
+
+    if (args->logjson) {
+        printf("{\"summary\":\"match\",\"files\":%zu", bt->count);
+        for (int s = 0; s < MATCH_STATUSES; s++) {
+            printf(",\"%s\":%zu", match_statusName((match_status)s), counts[s]);
+        }
+        printf(",\"candidates\":%zu}\n", tried);
+    } else {
+        printf("\nMatched %zu of %zu AoV files (%zu unmatched, %zu damaged) after %zu candidates, %zu other files skipped.\n",
+               counts[MATCH_MATCHED], counts[MATCH_MATCHED] + counts[MATCH_UNMATCHED] + counts[MATCH_DAMAGED],
+               counts[MATCH_UNMATCHED], counts[MATCH_DAMAGED], tried, counts[MATCH_SKIPPED]);
+    }
+
+    fflush(stdout);
+
+    for (int i = 0; i < nthreads; i++) {
+        ZSTD_aov_freeCtx(ctxs[i]);
+    }
+
+    ZSTD_aov_freeDict(ddict);
+
+    free(ctxs);
+    free(pending);
+    free(files);
+    free(candidates);
+
+    return counts[MATCH_UNMATCHED] + counts[MATCH_DAMAGED];
+}
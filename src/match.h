@@ -0,0 +1,39 @@
+
+
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stddef.h>
+
+#include "args.h"
+#include "types.h"
+
+struct batch;
+
+
+/* Smallest window log tried on top of each level, the window of small files. */
+#define MATCH_WINDOWLOG_MIN       10
+
+
+enum match_status {
+    /* Not an AoV file, nothing to reproduce. */
+    MATCH_SKIPPED             = 0,
+
+    /* Reproduced byte for byte by one of the candidates. */
+    MATCH_MATCHED             = 1,
+
+    /* No candidate reproduced it. */
+    MATCH_UNMATCHED           = 2,
+
+    /* Could not be read or decompressed, or holds more than the frame after the header. */
+    MATCH_DAMAGED             = 3
+};
+
+typedef enum match_status match_status;
+
+#define MATCH_STATUSES            4
+
+
+extern size_t match_run(const struct batch *bt, const arguments *args, const bytes *dict);
+
+#endif
@@ -70,7 +70,7 @@ extern void opt_error(option_error *opterr) {
 extern void simple(const char *program_name) {
 
     /* Print a basic usage guide with an example of the command options. */ 
-    printf("Usage: %s [-c | -d] [-f FILE | -D DIRECTORY]\n", program_name);
+    printf("Usage: %s [-c | -d] [-f FILE | -D DIRECTORY | --files-from LIST]\n", program_name);
 }
 
 
@@ -80,23 +80,63 @@ extern void simple(const char *program_name) {
  * @param program_name: The name of the program, typically argv[0].
  */
 extern void usage(const char *program_name) {
-    printf("\nUsage: %s [MODE] [OPTIONS] [-f FILE | -D DIRECTORY]\n", program_name);
+    printf("\nUsage: %s [MODE] [OPTIONS] [-f FILE | -D DIRECTORY | --files-from LIST]\n", program_name);
     printf("\nModes:\n");
     printf("  -c, --compress                Compress the specified file or directory.\n");
     printf("  -d, --decompress              Decompress the specified file or directory.\n");
+    printf("      --verify                  Round-trip every file in memory (compress, decompress, compare\n");
+    printf("                                hashes) and report PASS or FAIL per file. Nothing is written.\n");
+    printf("      --scan                    List the type (plain, aov, aes), stored decompressed size and\n");
+    printf("                                on-disk size of every file, reading only its first 12 bytes.\n");
+    printf("      --match-original          Search the level and --zstd parameters that reproduce each AoV\n");
+    printf("                                file byte for byte, and list them per file. Nothing is written.\n");
+    printf("      --estimate[=N]            Estimate the compressed size and time of compressing (repacking AoV\n");
+    printf("                                files) at the level of -l, with 95%% confidence intervals, from N\n");
+    printf("                                sampled blocks (default 256). Nothing is written.\n");
     
     printf("\nOptions:\n");
     printf("  -l, --clevel LEVEL            Set the compression level (e.g., 1-22, with 22 being the highest).\n");
     printf("                                Default level is based on preset configurations.\n");
+    printf("      --profile NAME            Compress with a named profile: fast-iterate (level 3, quick),\n");
+    printf("                                ship (level 19, as the game files) or max (level 22, smallest).\n");
+    printf("      --zstd PARAMS             Override compression parameters, as NAME=VALUE pairs separated by\n");
+    printf("                                commas: wlog, clog, hlog, slog, mml, tlen, strat, lcm.\n");
     printf("  -D, --dir DIRECTORY           Specify a directory to compress or decompress.\n");
     printf("                                Recommended for handling multiple files in a directory.\n");
     printf("  -f, --file FILE               Specify a single file to compress or decompress.\n");
+    printf("                                Use '-' to read from stdin.\n");
+    printf("      --files-from LIST         Process the files named in LIST, one per line (or NUL-separated),\n");
+    printf("                                each optionally followed by a tab and its output path.\n");
+    printf("                                Use '-' to read the list from stdin.\n");
+    printf("      --serve SOCKET            Run as a daemon serving compress and decompress requests on the\n");
+    printf("                                Unix domain socket SOCKET, with the dictionary kept digested.\n");
+    printf("      --dict FILE               Compress with the dictionary FILE instead of the one built into\n");
+    printf("                                the executable (bin/dict.zst at build time).\n");
+    printf("      --dict-dir DIR            Also decompress with the dictionaries in DIR, each picked by the\n");
+    printf("                                dictionary ID recorded in the frame, for mixed versions.\n");
+    printf("      --patch-from OLD          With -c, write patches against the previous version OLD (a file,\n");
+    printf("                                or a directory holding files of the same names). With -d, apply\n");
+    printf("                                them to OLD. Needs -o.\n");
     printf("  -o, --output OUTPUT           Specify the output path for the result (file or directory).\n");
     printf("                                If not provided, the input file or directory will be used.\n");
+    printf("                                Use '-' to write to stdout (default when reading stdin).\n");
+    printf("  -j, --threads N               Process files on N worker threads. Default is 0, one per processor.\n");
+    printf("      --max-memory SIZE         Run files side by side only while their estimated memory fits in\n");
+    printf("                                SIZE (K, M, G or T suffix). Default is the memory limit of the\n");
+    printf("                                process (cgroup or physical memory), 0 for no limit.\n");
+    printf("      --huge-pages              Back the Zstandard workspaces with huge pages (MAP_HUGETLB when\n");
+    printf("                                pages are reserved, transparent huge pages otherwise).\n");
+    printf("      --pin                     Bind worker threads to processors, spread over the NUMA nodes, each\n");
+    printf("                                node with its own dictionary copy and buffers.\n");
     printf("  -V, --verbose                 Enable verbose output, showing detailed progress.\n");
     printf("  -v, --version                 Display the program version and exit. This option cannot be used\n");
     printf("                                with any other options.\n");
     printf("  -h, --help                    Display this help message and exit.\n");
+    printf("      --log-level LEVEL         Set the log level: error, warn, info or debug.\n");
+    printf("                                Default is warn, or info with -V.\n");
+    printf("      --log-json                Write log records as NDJSON, one JSON object per line.\n");
+    printf("      --batch                   For scripts: print one NDJSON record per file and a summary, without\n");
+    printf("                                clearing the screen or a banner, and fail if any file fails.\n");
     
     printf("\nRecommendation:\n");
     printf("  For processing multiple files, it is recommended to use the '-D' option to specify a directory\n");
@@ -107,6 +147,24 @@ extern void usage(const char *program_name) {
     printf("      Compress 'input.txt' and save as 'output.zst'.\n");
     printf("  %s -d -D /input/dir -o /output/dir\n", program_name);
     printf("      Decompress all files in '/input/dir' to '/output/dir'.\n");
+    printf("  git diff --name-only | %s -c --files-from - -o /output/dir\n", program_name);
+    printf("      Compress only the changed files, in a single process.\n");
+    printf("  tar -xO -f assets.tar A1.xml | %s -d -f - | xmllint -\n", program_name);
+    printf("      Decompress a file streamed through a pipeline.\n");
+    printf("  %s --verify -D /input/dir -j 8\n", program_name);
+    printf("      Check that every file in '/input/dir' survives a round trip, on 8 threads.\n");
+    printf("  %s -c -D /mods --profile max --zstd tlen=256\n", program_name);
+    printf("      Compress '/mods' with the max profile and a custom target length.\n");
+    printf("  %s --scan -D /input/dir | grep ^plain\n", program_name);
+    printf("      List the files of '/input/dir' that are not compressed yet.\n");
+    printf("  %s -c -D /v2 --patch-from /v1 -o /patches\n", program_name);
+    printf("      Write the changes from '/v1' to '/v2' as patches, applied with -d --patch-from /v1.\n");
+    printf("  %s --batch -d -D /input/dir -o /output/dir | jq -c 'select(.status == \"failed\")'\n", program_name);
+    printf("      Decompress from a script and list the files that failed.\n");
+    printf("  %s --match-original -D /game/dir > settings.tsv\n", program_name);
+    printf("      Record the settings that recreate the shipped files, for repacks.\n");
+    printf("  %s --estimate -D /game/dir -l 22 -j 16\n", program_name);
+    printf("      Tell how large and how long a repack at level 22 on 16 threads would be.\n");
 
     // printf("\nNotes:\n");
     // printf("  1. The '-v' (version) option cannot be used in conjunction with other options.\n");
@@ -0,0 +1,270 @@
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "pool.h"
+#include "types.h"
+#include "workers.h"
+
+
+/**
+ * Free buffers of one size class. Each entry keeps its descriptor and its
+ * data together, so a reused buffer costs no allocation at all.
+ */
+struct pool_class {
+    bytes *free[POOL_CLASS_KEEP];
+    size_t count;
+};
+
+typedef struct pool_class pool_class;
+
+
+static struct {
+    pthread_mutex_t mutex;
+
+    /* Free buffers by NUMA node of the worker that released them, so a pinned worker reuses local memory. */
+    pool_class classes[WORKERS_NODES_MAX][POOL_CLASSES];
+
+    /* Total capacity of the free buffers, and the most it may reach. */
+    size_t cached_bytes;
+    size_t cache_max;
+
+    _Atomic size_t acquired;
+    _Atomic size_t reused;
+    _Atomic size_t mallocs;
+    _Atomic size_t frees;
+} g_pool = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cache_max = POOL_CACHE_MAX };
+
+
+/**
+ * Returns the size class that holds `size` bytes, or -1 if it is too
+ * large to be pooled.
+ */
+static int pool_class_of(size_t size) {
+
+    int shift = POOL_MIN_SHIFT;
+
+    while (shift <= POOL_MAX_SHIFT && ((size_t)1 << shift) < size) {
+        shift++;
+    }
+
+    return shift <= POOL_MAX_SHIFT ? shift - POOL_MIN_SHIFT : -1;
+}
+
+
+static size_t pool_class_size(int c) {
+
+    return (size_t)1 << (c + POOL_MIN_SHIFT);
+}
+
+
+/**
+ * Hands out a buffer of `size` bytes with a capacity of at least `size`,
+ * reusing a free buffer of the same size class when there is one.
+ * This backs `bytes_init`.
+ *
+ * @param size: The size of the buffer.
+ * @return: The buffer, or NULL if it cannot be allocated.
+ */
+extern bytes *pool_acquire(size_t size) {
+
+    int c = pool_class_of(size);
+
+    atomic_fetch_add_explicit(&g_pool.acquired, 1, memory_order_relaxed);
+
+    if (c >= 0) {
+        bytes *b = NULL;
+        pool_class *pc = &g_pool.classes[workers_currentNode()][c];
+
+        pthread_mutex_lock(&g_pool.mutex);
+
+        if (pc->count) {
+            b = pc->free[--pc->count];
+            g_pool.cached_bytes -= b->capacity;
+        }
+
+        pthread_mutex_unlock(&g_pool.mutex);
+
+        if (b != NULL) {
+            atomic_fetch_add_explicit(&g_pool.reused, 1, memory_order_relaxed);
+            b->size = size;
+            return b;
+        }
+    }
+
+    size_t capacity = c >= 0 ? pool_class_size(c) : size;
+
+    bytes *b = (bytes *)malloc(sizeof(bytes));
+    byte *data = b ? (byte *)malloc(capacity ? capacity : 1) : NULL;
+
+    atomic_fetch_add_explicit(&g_pool.mallocs, b ? 2 : 1, memory_order_relaxed);
+
+    if (data == NULL) {
+        free(b);
+        return NULL;
+    }
+
+    b->data = data;
+    b->size = size;
+    b->capacity = capacity;
+
+    return b;
+}
+
+
+/**
+ * Gives a buffer back. Buffers whose capacity is exactly a size class are
+ * kept for reuse while the pool has room, the others are freed. This backs
+ * `bytes_free`.
+ *
+ * @param b: The buffer, may be NULL.
+ */
+extern void pool_release(bytes *b) {
+
+    if (b == NULL) {
+        return;
+    }
+
+    int c = b->data ? pool_class_of(b->capacity) : -1;
+
+    if (c >= 0 && pool_class_size(c) == b->capacity) {
+        bool kept = false;
+        pool_class *pc = &g_pool.classes[workers_currentNode()][c];
+
+        pthread_mutex_lock(&g_pool.mutex);
+
+        if (pc->count < POOL_CLASS_KEEP && g_pool.cached_bytes + b->capacity <= g_pool.cache_max) {
+            pc->free[pc->count++] = b;
+            g_pool.cached_bytes += b->capacity;
+            kept = true;
+        }
+
+        pthread_mutex_unlock(&g_pool.mutex);
+
+        if (kept) {
+            return;
+        }
+    }
+
+    atomic_fetch_add_explicit(&g_pool.frees, b->data ? 2 : 1, memory_order_relaxed);
+
+    free(b->data);
+    free(b);
+}
+
+
+/**
+ * Grows the capacity of a buffer, keeping its contents and size. The new
+ * capacity is rounded up to a size class so the buffer stays poolable.
+ * This backs `bytes_reserve`.
+ *
+ * @param b: The buffer.
+ * @param capacity: The capacity needed.
+ * @return: Non-zero on success, 0 if memory could not be allocated
+ *          (the buffer is left unchanged).
+ */
+extern int pool_reserve(bytes *b, size_t capacity) {
+
+    if (capacity <= b->capacity) {
+        return true;
+    }
+
+    int c = pool_class_of(capacity);
+
+    if (c >= 0) {
+        capacity = pool_class_size(c);
+    }
+
+    byte *data = (byte *)realloc(b->data, capacity);
+
+    atomic_fetch_add_explicit(&g_pool.mallocs, 1, memory_order_relaxed);
+
+    if (data == NULL) {
+        return false;
+    }
+
+    b->data = data;
+    b->capacity = capacity;
+
+    return true;
+}
+
+
+/**
+ * Reads the counters of the pool.
+ *
+ * @param stats: Receives the counters.
+ */
+extern void pool_getStats(pool_stats *stats) {
+
+    stats->acquired = atomic_load(&g_pool.acquired);
+    stats->reused = atomic_load(&g_pool.reused);
+    stats->mallocs = atomic_load(&g_pool.mallocs);
+    stats->frees = atomic_load(&g_pool.frees);
+
+    pthread_mutex_lock(&g_pool.mutex);
+
+    stats->cached = 0;
+
+    for (int n = 0; n < WORKERS_NODES_MAX; n++) {
+        for (int c = 0; c < POOL_CLASSES; c++) {
+            stats->cached += g_pool.classes[n][c].count;
+        }
+    }
+
+    stats->cached_bytes = g_pool.cached_bytes;
+
+    pthread_mutex_unlock(&g_pool.mutex);
+}
+
+
+/**
+ * Lowers the bytes the pool keeps in free buffers, e.g. to a share of a
+ * memory budget, freeing them all if it already keeps more.
+ *
+ * @param bytes: The most bytes to keep, at most POOL_CACHE_MAX.
+ */
+extern void pool_setCacheMax(size_t bytes) {
+
+    pthread_mutex_lock(&g_pool.mutex);
+
+    g_pool.cache_max = bytes < POOL_CACHE_MAX ? bytes : POOL_CACHE_MAX;
+    bool over = g_pool.cached_bytes > g_pool.cache_max;
+
+    pthread_mutex_unlock(&g_pool.mutex);
+
+    if (over) {
+        pool_trim();
+    }
+}
+
+
+/**
+ * Frees every buffer kept in the pool.
+ */
+extern void pool_trim(void) {
+
+    pthread_mutex_lock(&g_pool.mutex);
+
+    for (int n = 0; n < WORKERS_NODES_MAX; n++) {
+        for (int c = 0; c < POOL_CLASSES; c++) {
+            pool_class *pc = &g_pool.classes[n][c];
+
+            while (pc->count) {
+                bytes *b = pc->free[--pc->count];
+
+                atomic_fetch_add_explicit(&g_pool.frees, 2, memory_order_relaxed);
+
+                free(b->data);
+                free(b);
+            }
+        }
+    }
+
+    g_pool.cached_bytes = 0;
+
+    pthread_mutex_unlock(&g_pool.mutex);
+}
@@ -0,0 +1,60 @@
+
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "types.h"
+
+
+/* Smallest size class, as a power of two (4 KiB). */
+#define POOL_MIN_SHIFT            12
+
+/* Largest size class, as a power of two (64 MiB). Larger buffers are not pooled. */
+#define POOL_MAX_SHIFT            26
+
+#define POOL_CLASSES              (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+/* Most free buffers kept per size class. */
+#define POOL_CLASS_KEEP           32
+
+/* Most bytes kept in free buffers across all classes, unless lowered by pool_setCacheMax(). */
+#define POOL_CACHE_MAX            ((size_t)256 * 1024 * 1024)
+
+
+/**
+ * Counters of the buffer pool, to check that a steady-state run does
+ * not reach the system allocator.
+ */
+struct pool_stats {
+    /* Buffers handed out by `bytes_init`. */
+    size_t acquired;
+
+    /* Of those, buffers reused from the pool. */
+    size_t reused;
+
+    /* Calls to the system allocator (buffers plus their descriptors). */
+    size_t mallocs;
+
+    /* Buffers given back to the system allocator. */
+    size_t frees;
+
+    /* Free buffers kept in the pool, and their total capacity. */
+    size_t cached;
+    size_t cached_bytes;
+};
+
+typedef struct pool_stats pool_stats;
+
+
+extern bytes *pool_acquire(size_t size);
+extern void pool_release(bytes *b);
+extern int pool_reserve(bytes *b, size_t capacity);
+
+extern void pool_getStats(pool_stats *stats);
+extern void pool_setCacheMax(size_t bytes);
+extern void pool_trim(void);
+
+#endif
@@ -0,0 +1,192 @@
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#   include <fcntl.h>
+#elif __linux__
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/stat.h>
+#endif
+
+#include "aes.h"
+#include "args.h"
+#include "batch.h"
+#include "log.h"
+#include "scan.h"
+#include "types.h"
+#include "zstandard.h"
+
+
+/**
+ * Returns the name of a file kind, as printed by `--scan`.
+ *
+ * @param kind: The kind.
+ * @return: A static string.
+ */
+extern const char *scan_kindName(file_kind kind) {
+
+    static const char *names[FILE_KINDS] = { "plain", "aov", "aes", "damaged", "unreadable" };
+
+    return (unsigned)kind < FILE_KINDS ? names[kind] : "unknown";
+}
+
+
+/**
+ * Classifies data from its first bytes only.
+ *
+ * @param probe: The first bytes of the file.
+ * @param size: Number of bytes in `probe`, at most `SCAN_PROBE_SIZE` are used.
+ * @param dsize: Receives the stored decompressed size of AoV data, or 0.
+ * @return: The kind of the data.
+ */
+extern file_kind scan_classify(const unsigned char *probe, size_t size, uint32_t *dsize) {
+
+    *dsize = 0;
+
+    if (size >= HEADER_SIZE && ZSTD_isNotDecompressedData((byte *)probe, AES_HEADER)) {
+        return FILE_AES;
+    }
+
+    if (size < HEADER_SIZE || !ZSTD_isHeader(probe)) {
+        return FILE_PLAIN;
+    }
+
+    if (size < SCAN_PROBE_SIZE
+        || memcmp(probe + HEADER_SIZE + FRAME_HEADER_SIZE, FRAME_HEADER, FRAME_HEADER_SIZE) != 0) {
+        return FILE_DAMAGED;
+    }
+
+    *dsize = ZSTD_getHeaderSize(probe);
+
+    return FILE_AOV;
+}
+
+
+/**
+ * Classifies a file by reading its size and first `SCAN_PROBE_SIZE` bytes,
+ * without reading the rest of it.
+ *
+ * @param path: The file to classify.
+ * @param info: Receives the classification.
+ * @return: `true` if the file could be read, `false` otherwise (the kind
+ *          is then `FILE_UNREADABLE`).
+ */
+extern bool scan_probe(const char *path, file_info *info) {
+
+    byte probe[SCAN_PROBE_SIZE];
+    size_t nread = 0;
+
+    info->kind = FILE_UNREADABLE;
+    info->size = 0;
+    info->dsize = 0;
+
+    #ifdef _WIN32
+
+        FILE *fptr = fopen(path, "rb");
+
+        if (fptr == NULL) {
+            return false;
+        }
+
+        nread = fread(probe, 1, sizeof(probe), fptr);
+
+        bool ok = !ferror(fptr) && _fseeki64(fptr, 0, SEEK_END) == 0;
+        info->size = ok ? (uint64_t)_ftelli64(fptr) : 0;
+
+        fclose(fptr);
+
+        if (!ok) {
+            return false;
+        }
+
+    #else
+
+        int fd = open(path, O_RDONLY);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        ssize_t n = -1;
+
+        if (fstat(fd, &st) == 0) {
+            n = pread(fd, probe, sizeof(probe), 0);
+        }
+
+        close(fd);
+
+        if (n < 0) {
+            return false;
+        }
+
+        nread = (size_t)n;
+        info->size = (uint64_t)st.st_size;
+
+    #endif
+
+    info->kind = scan_classify(probe, nread, &info->dsize);
+
+    return true;
+}
+
+
+/**
+ * Prints one line per file of a probed batch, in batch order, followed
+ * by the totals of each kind. Lines are tab-separated text, or NDJSON
+ * with `--log-json`.
+ *
+ * @param bt: The files to report, classified by `batch_probe`.
+ * @param args: The parsed command-line arguments.
+ * @return: The number of unreadable files.
+ */
+extern size_t scan_run(const batch *bt, const arguments *args) {
+
+    size_t files[FILE_KINDS] = { 0 };
+    uint64_t sizes[FILE_KINDS] = { 0 };
+    uint64_t dsizes = 0;
+
+    for (size_t i = 0; i < bt->count; i++) {
+        const file_info *info = &bt->jobs[i].info;
+
+        files[info->kind]++;
+        sizes[info->kind] += info->size;
+        dsizes += info->dsize;
+
+        if (args->logjson) {
+            printf("{\"type\":\"%s\",\"size\":%llu,\"dsize\":%lu,\"path\":", scan_kindName(info->kind),
+                   (unsigned long long)info->size, (unsigned long)info->dsize);
+            log_jsonString(stdout, bt->jobs[i].input);
+            printf("}\n");
+        } else {
+            printf("%-10s\t%12llu\t%12lu\t%s\n", scan_kindName(info->kind),
+                   (unsigned long long)info->size, (unsigned long)info->dsize, bt->jobs[i].input);
+        }
+    }
+
+    if (args->logjson) {
+        printf("{\"summary\":\"scan\",\"files\":%zu", bt->count);
+        for (int k = 0; k < FILE_KINDS; k++) {
+            printf(",\"%s\":%zu", scan_kindName((file_kind)k), files[k]);
+        }
+        printf(",\"size\":%llu,\"dsize\":%llu}\n",
+               (unsigned long long)(sizes[FILE_PLAIN] + sizes[FILE_AOV] + sizes[FILE_AES] + sizes[FILE_DAMAGED]),
+               (unsigned long long)dsizes);
+    } else {
+        printf("\nScanned %zu files:", bt->count);
+        for (int k = 0; k < FILE_KINDS; k++) {
+            printf(" %zu %s%s", files[k], scan_kindName((file_kind)k), k + 1 < FILE_KINDS ? "," : ".\n");
+        }
+        printf("AoV files hold %llu bytes that decompress to %llu bytes.\n",
+               (unsigned long long)sizes[FILE_AOV], (unsigned long long)dsizes);
+    }
+
+    fflush(stdout);
+
+    return files[FILE_UNREADABLE];
+}
@@ -0,0 +1,62 @@
+
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "args.h"
+
+struct batch;
+
+
+/* Bytes read to classify a file: AoV header, stored size and frame magic. */
+#define SCAN_PROBE_SIZE           12
+
+
+enum file_kind {
+    /* Neither compressed nor encrypted. */
+    FILE_PLAIN                = 0, 
+
+    /* AoV header followed by a Zstandard frame. */
+    FILE_AOV                  = 1, 
+
+    /* AES-wrapped, left untouched by every mode. */
+    FILE_AES                  = 2, 
+
+    /* AoV header without a Zstandard frame where one is expected. */
+    FILE_DAMAGED              = 3, 
+
+    /* Could not be opened or read. */
+    FILE_UNREADABLE           = 4
+};
+
+typedef enum file_kind file_kind;
+
+#define FILE_KINDS                5
+
+
+struct file_info {
+    /* Classification of the file. */
+    file_kind kind;
+
+    /* Size of the file on disk. */
+    uint64_t size;
+
+    /* Decompressed size stored in the AoV header, 0 for other kinds. */
+    uint32_t dsize;
+};
+
+typedef struct file_info file_info;
+
+
+extern const char *scan_kindName(file_kind kind);
+
+extern file_kind scan_classify(const unsigned char *probe, size_t size, uint32_t *dsize);
+extern bool scan_probe(const char *path, file_info *info);
+
+extern size_t scan_run(const struct batch *bt, const arguments *args);
+
+#endif
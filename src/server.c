@@ -0,0 +1,793 @@
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifndef _WIN32
+#   include <errno.h>
+#   include <limits.h>
+#   include <poll.h>
+#   include <pthread.h>
+#   include <signal.h>
+#   include <time.h>
+#   include <unistd.h>
+#   include <sys/socket.h>
+#   include <sys/stat.h>
+#   include <sys/types.h>
+#   include <sys/un.h>
+#endif
+
+#include "aes.h"
+#include "args.h"
+#include "io.h"
+#include "log.h"
+#include "server.h"
+#include "types.h"
+#include "zstandard.h"
+
+
+#ifdef _WIN32
+
+/**
+ * The daemon relies on Unix domain sockets and is not available on Windows.
+ */
+extern int server_run(const char *path, const arguments *args, const bytes *dict, const ZSTD_aov_registry *registry) {
+
+    (void)path;
+    (void)args;
+    (void)dict;
+    (void)registry;
+
+    log_error("--serve is not supported on this platform");
+
+    return EXIT_FAILURE;
+}
+
+#else
+
+/**
+ * State shared by every connection of the daemon: the digested
+ * dictionaries, kept warm per compression level, and a pool of
+ * reusable contexts.
+ */
+static struct {
+    const bytes *dict;
+    int compressionlevel;
+
+    /* Dictionaries of other IDs for decompression, or NULL. */
+    const ZSTD_aov_registry *registry;
+
+    /* Parameters of the default level, from --profile and --zstd. */
+    const ZSTD_aov_params *params;
+
+    /* dicts[0] only decompresses, dicts[level] is digested for `level`. */
+    ZSTD_aov_dict *dicts[SERVER_LEVELS];
+    pthread_mutex_t dicts_mutex;
+
+    /* Contexts not currently used by a request. */
+    ZSTD_aov_ctx **ctxs;
+    size_t nctxs;
+    size_t capacity;
+    pthread_mutex_t ctxs_mutex;
+
+    /* Sockets of the connections being served, each by its own thread. */
+    int *clients;
+    size_t nclients;
+    size_t clients_capacity;
+    pthread_mutex_t clients_mutex;
+    pthread_cond_t clients_done;
+
+    /**
+     * Pipe whose write end the shutdown closes, so threads waiting on a
+     * descriptor passed by a client see its read end ready and give up.
+     */
+    int wake[2];
+
+    volatile sig_atomic_t stop;
+} g_server = {
+    .dicts_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .ctxs_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .clients_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .clients_done = PTHREAD_COND_INITIALIZER,
+    .wake = { -1, -1 },
+};
+
+
+/**
+ * A client request parsed from one line of the protocol.
+ */
+struct request {
+    /* `true` to compress, `false` to decompress. */
+    bool compress;
+
+    /* Requested compression level, 0 for the server default. */
+    int compressionlevel;
+
+    /* Input and output paths, "-" when passed as file descriptors. */
+    char *input;
+    char *output;
+};
+
+typedef struct request request;
+
+
+static void on_signal(int signo) {
+
+    (void)signo;
+
+    g_server.stop = 1;
+}
+
+
+static uint64_t now_us(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000ull;
+}
+
+
+/**
+ * Returns the dictionary digested for a level, digesting it on first use.
+ */
+static ZSTD_aov_dict *server_getDict(int compressionlevel) {
+
+    pthread_mutex_lock(&g_server.dicts_mutex);
+
+    ZSTD_aov_dict *d = g_server.dicts[compressionlevel];
+
+    if (d == NULL) {
+        /* Profile and parameter overrides apply to the default level of the daemon. */
+        d = ZSTD_aov_createDict_advanced(g_server.dict, compressionlevel,
+                                         compressionlevel == g_server.compressionlevel ? g_server.params : NULL);
+        if (d != NULL) {
+            d->registry = g_server.registry;
+        }
+        g_server.dicts[compressionlevel] = d;
+    }
+
+    pthread_mutex_unlock(&g_server.dicts_mutex);
+
+    return d;
+}
+
+
+static ZSTD_aov_ctx *server_acquireCtx(void) {
+
+    ZSTD_aov_ctx *ctx = NULL;
+
+    pthread_mutex_lock(&g_server.ctxs_mutex);
+
+    if (g_server.nctxs) {
+        ctx = g_server.ctxs[--g_server.nctxs];
+    }
+
+    pthread_mutex_unlock(&g_server.ctxs_mutex);
+
+    return ctx ? ctx : ZSTD_aov_createCtx();
+}
+
+
+static void server_releaseCtx(ZSTD_aov_ctx *ctx) {
+
+    pthread_mutex_lock(&g_server.ctxs_mutex);
+
+    if (g_server.nctxs == g_server.capacity) {
+        size_t capacity = g_server.capacity ? g_server.capacity * 2 : 8;
+        ZSTD_aov_ctx **ctxs = (ZSTD_aov_ctx **)realloc(g_server.ctxs, capacity * sizeof(ZSTD_aov_ctx *));
+
+        if (ctxs == NULL) {
+            pthread_mutex_unlock(&g_server.ctxs_mutex);
+            ZSTD_aov_freeCtx(ctx);
+            return;
+        }
+
+        g_server.ctxs = ctxs;
+        g_server.capacity = capacity;
+    }
+
+    g_server.ctxs[g_server.nctxs++] = ctx;
+
+    pthread_mutex_unlock(&g_server.ctxs_mutex);
+}
+
+
+/**
+ * Registers the socket of a new connection, so a shutdown can wait for it.
+ *
+ * @return: `true` on success, `false` if out of memory.
+ */
+static bool server_addClient(int client) {
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+
+    if (g_server.nclients == g_server.clients_capacity) {
+        size_t capacity = g_server.clients_capacity ? g_server.clients_capacity * 2 : 8;
+        int *clients = (int *)realloc(g_server.clients, capacity * sizeof(int));
+
+        if (clients == NULL) {
+            pthread_mutex_unlock(&g_server.clients_mutex);
+            return false;
+        }
+
+        g_server.clients = clients;
+        g_server.clients_capacity = capacity;
+    }
+
+    g_server.clients[g_server.nclients++] = client;
+
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    return true;
+}
+
+
+/**
+ * Closes the socket of a connection once it is served, and wakes up a
+ * shutdown waiting for the last one. The socket is closed under the lock,
+ * so a shutdown never reaches a descriptor that was reused meanwhile.
+ */
+static void server_removeClient(int client) {
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+
+    for (size_t i = 0; i < g_server.nclients; i++) {
+        if (g_server.clients[i] == client) {
+            g_server.clients[i] = g_server.clients[--g_server.nclients];
+            break;
+        }
+    }
+
+    close(client);
+
+    if (g_server.nclients == 0) {
+        pthread_cond_broadcast(&g_server.clients_done);
+    }
+
+    pthread_mutex_unlock(&g_server.clients_mutex);
+}
+
+
+/**
+ * Ends every connection still open and waits until their threads are
+ * done with the dictionaries, the contexts and the logger, then frees
+ * the dictionaries and contexts. Requests being processed run to their
+ * end, but their replies are dropped, and those waiting on a passed
+ * descriptor (a pipe the client never writes to or reads from) fail.
+ */
+static void server_drain(void) {
+
+    pthread_mutex_lock(&g_server.clients_mutex);
+
+    if (g_server.nclients) {
+        log_info("Waiting for %zu connections", g_server.nclients);
+    }
+
+    close(g_server.wake[1]);
+
+    for (size_t i = 0; i < g_server.nclients; i++) {
+        shutdown(g_server.clients[i], SHUT_RDWR);
+    }
+
+    while (g_server.nclients) {
+        pthread_cond_wait(&g_server.clients_done, &g_server.clients_mutex);
+    }
+
+    free(g_server.clients);
+    g_server.clients = NULL;
+    g_server.clients_capacity = 0;
+
+    pthread_mutex_unlock(&g_server.clients_mutex);
+
+    close(g_server.wake[0]);
+    g_server.wake[0] = g_server.wake[1] = -1;
+
+    for (int i = 0; i < SERVER_LEVELS; i++) {
+        ZSTD_aov_freeDict(g_server.dicts[i]);
+        g_server.dicts[i] = NULL;
+    }
+
+    for (size_t i = 0; i < g_server.nctxs; i++) {
+        ZSTD_aov_freeCtx(g_server.ctxs[i]);
+    }
+
+    free(g_server.ctxs);
+    g_server.ctxs = NULL;
+    g_server.nctxs = 0;
+    g_server.capacity = 0;
+}
+
+
+/**
+ * Waits until a descriptor is ready, or the daemon shuts down.
+ *
+ * @param fd: The descriptor.
+ * @param events: `POLLIN` or `POLLOUT`.
+ * @return: `true` when `fd` is ready (or failed, which the next call reports),
+ *          `false` on a shutdown.
+ */
+static bool wait_fd(int fd, short events) {
+
+    struct pollfd fds[2] = {
+        { .fd = fd, .events = events },
+        { .fd = g_server.wake[0], .events = POLLIN },
+    };
+
+    for (;;) {
+        int n = poll(fds, 2, -1);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        return n > 0 && fds[1].revents == 0;
+    }
+}
+
+
+/**
+ * Reads a file descriptor until end of file, or until the daemon shuts down.
+ */
+static bytes *read_fd(int fd) {
+
+    struct stat st;
+    size_t capacity = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 ? (size_t)st.st_size + 1 : 64 * 1024;
+
+    bytes *b = bytes_init(capacity);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    size_t size = 0;
+
+    for (;;) {
+        if (size == b->capacity && !bytes_reserve(b, b->capacity * 2)) {
+            bytes_free(b);
+            return NULL;
+        }
+
+        if (!wait_fd(fd, POLLIN)) {
+            bytes_free(b);
+            return NULL;
+        }
+
+        ssize_t n = read(fd, b->data + size, b->capacity - size);
+
+        if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+            continue;
+        }
+
+        if (n < 0) {
+            bytes_free(b);
+            return NULL;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        size += (size_t)n;
+    }
+
+    b->size = size;
+
+    return b;
+}
+
+
+/**
+ * Writes all of `data` to a file descriptor, or stops when the daemon
+ * shuts down. Pipes and sockets get at most `PIPE_BUF` bytes per write
+ * once ready, which a blocking descriptor takes without waiting.
+ */
+static bool write_fd(int fd, const byte *data, size_t size) {
+
+    struct stat st;
+    size_t chunk = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? size : PIPE_BUF;
+
+    while (size) {
+        if (!wait_fd(fd, POLLOUT)) {
+            return false;
+        }
+
+        ssize_t n = write(fd, data, size < chunk ? size : chunk);
+
+        if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return false;
+        }
+
+        data += n;
+        size -= (size_t)n;
+    }
+
+    return true;
+}
+
+
+/**
+ * Splits a request line into fields. Fields are separated by tabs when
+ * the line has any, so paths may contain spaces, and by spaces otherwise.
+ */
+static int split_fields(char *line, char **fields, int max) {
+
+    char separator = strchr(line, '\t') ? '\t' : ' ';
+    int n = 0;
+
+    while (*line && n < max) {
+        fields[n++] = line;
+
+        char *next = strchr(line, separator);
+        if (next == NULL) {
+            break;
+        }
+
+        *next = '\0';
+        line = next + 1;
+    }
+
+    return n;
+}
+
+
+/**
+ * Parses a request line:
+ *
+ *      COMPRESS LEVEL INPUT OUTPUT
+ *      DECOMPRESS INPUT OUTPUT
+ *
+ * INPUT and OUTPUT are paths, or both "-" when the file descriptors are
+ * passed with SCM_RIGHTS alongside the request. LEVEL 0 selects the
+ * server default.
+ *
+ * @return: `true` if the line is a valid request.
+ */
+static bool parse_request(char *line, request *req) {
+
+    char *fields[5];
+    int n = split_fields(line, fields, 5);
+
+    if (n == 4 && (strcmp(fields[0], "COMPRESS") == 0 || strcmp(fields[0], "C") == 0)) {
+        req->compress = true;
+        req->compressionlevel = atoi(fields[1]);
+        req->input = fields[2];
+        req->output = fields[3];
+
+        return req->compressionlevel == 0 ||
+               (ZSTD_checkCLevel(req->compressionlevel) && req->compressionlevel < SERVER_LEVELS);
+    }
+
+    if (n == 3 && (strcmp(fields[0], "DECOMPRESS") == 0 || strcmp(fields[0], "D") == 0)) {
+        req->compress = false;
+        req->compressionlevel = 0;
+        req->input = fields[1];
+        req->output = fields[2];
+
+        return true;
+    }
+
+    return false;
+}
+
+
+/**
+ * Serves one request and writes the reply to the client.
+ *
+ * @param client: The connection socket.
+ * @param req: The parsed request.
+ * @param fds: Descriptors received on the connection, consumed from the front.
+ * @param nfds: Number of descriptors in `fds`.
+ */
+static void serve_request(int client, request *req, int *fds, int *nfds) {
+
+    char reply[256];
+    uint64_t start = now_us();
+
+    bool passfd = isstdio(req->input) && isstdio(req->output);
+    int infd = -1, outfd = -1;
+
+    if (passfd) {
+        if (*nfds < 2) {
+            snprintf(reply, sizeof(reply), "ERR expected 2 file descriptors\n");
+            write_fd(client, (const byte *)reply, strlen(reply));
+            return;
+        }
+
+        infd = fds[0];
+        outfd = fds[1];
+
+        memmove(fds, fds + 2, (size_t)(*nfds - 2) * sizeof(int));
+        *nfds -= 2;
+    }
+
+    int compressionlevel = req->compress ? (req->compressionlevel ? req->compressionlevel : g_server.compressionlevel) : 0;
+
+    ZSTD_aov_dict *d = server_getDict(compressionlevel);
+    ZSTD_aov_ctx *ctx = server_acquireCtx();
+
+    bytes *b = passfd ? read_fd(infd) : read_file(req->input);
+    size_t insize = b ? b->size : 0;
+
+    const char *error = NULL;
+
+    if (d == NULL || ctx == NULL) {
+        error = "dictionary or context unavailable";
+    } else if (b == NULL) {
+        error = "cannot read input";
+    } else if (req->compress) {
+        if (!(b->size >= HEADER_SIZE && ZSTD_isNotDecompressedData(b->data, AES_HEADER))) {
+            b = ZSTD_aov_compress_usingDict(ctx, b, d);
+        }
+    } else {
+        b = ZSTD_aov_decompress_usingDict(ctx, b, d);
+    }
+
+    if (error == NULL && b == NULL) {
+        error = req->compress ? "compression failed" : "decompression failed";
+    }
+
+    if (error == NULL) {
+        if (passfd) {
+            if (!write_fd(outfd, b->data, b->size)) {
+                error = "cannot write output";
+            }
+        } else if (!write_file(req->output, b)) {
+            error = "cannot write output";
+        }
+    }
+
+    size_t outsize = b ? b->size : 0;
+
+    if (ctx) {
+        server_releaseCtx(ctx);
+    }
+
+    bytes_free(b);
+
+    if (passfd) {
+        close(infd);
+        close(outfd);
+    }
+
+    if (error) {
+        snprintf(reply, sizeof(reply), "ERR %s\n", error);
+        log_warn("%s %s: %s", req->compress ? "compress" : "decompress", req->input, error);
+    } else {
+        unsigned long long elapsed = (unsigned long long)(now_us() - start);
+
+        snprintf(reply, sizeof(reply), "OK %zu %zu %llu\n", insize, outsize, elapsed);
+        log_info("%s %s: %zu -> %zu bytes in %llu us", req->compress ? "compress" : "decompress",
+                 req->input, insize, outsize, elapsed);
+    }
+
+    write_fd(client, (const byte *)reply, strlen(reply));
+}
+
+
+/**
+ * Reads requests from one client until it disconnects. Each request is a
+ * line; file descriptors may arrive with any message of the connection
+ * and are consumed in order by requests using "-".
+ */
+static void *serve_client(void *arg) {
+
+    int client = (int)(intptr_t)arg;
+
+    char line[SERVER_LINE_MAX];
+    size_t used = 0;
+
+    int fds[SERVER_FDS_MAX];
+    int nfds = 0;
+
+    for (;;) {
+        union {
+            struct cmsghdr align;
+            char buffer[CMSG_SPACE(sizeof(int) * SERVER_FDS_MAX)];
+        } control;
+
+        struct iovec iov = { line + used, sizeof(line) - used };
+        struct msghdr msg = { 0 };
+
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+
+        ssize_t n = recvmsg(client, &msg, 0);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            break;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+
+            int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            int *received = (int *)CMSG_DATA(cmsg);
+
+            for (int i = 0; i < count; i++) {
+                if (nfds < SERVER_FDS_MAX) {
+                    fds[nfds++] = received[i];
+                } else {
+                    close(received[i]);
+                }
+            }
+        }
+
+        used += (size_t)n;
+
+        char *start = line;
+        char *eol;
+
+        while ((eol = memchr(start, '\n', used - (size_t)(start - line))) != NULL) {
+            *eol = '\0';
+
+            if (eol > start && eol[-1] == '\r') {
+                eol[-1] = '\0';
+            }
+
+            request req;
+
+            if (strcmp(start, "PING") == 0) {
+                write_fd(client, (const byte *)"OK\n", 3);
+            } else if (parse_request(start, &req)) {
+                serve_request(client, &req, fds, &nfds);
+            } else if (*start) {
+                write_fd(client, (const byte *)"ERR invalid request\n", 20);
+            }
+
+            start = eol + 1;
+        }
+
+        used -= (size_t)(start - line);
+        memmove(line, start, used);
+
+        if (used == sizeof(line)) {
+            write_fd(client, (const byte *)"ERR request too long\n", 21);
+            break;
+        }
+    }
+
+    for (int i = 0; i < nfds; i++) {
+        close(fds[i]);
+    }
+
+    server_removeClient(client);
+
+    return NULL;
+}
+
+
+/**
+ * Runs the daemon: listens on a Unix domain socket and serves compress
+ * and decompress requests with warm dictionaries and contexts until
+ * SIGINT or SIGTERM.
+ *
+ * @param path: Path of the socket to create.
+ * @param args: The parsed command-line arguments.
+ * @param dict: The raw dictionary.
+ * @param registry: Dictionaries of other IDs for decompression, or NULL.
+ * @return: EXIT_SUCCESS after a clean shutdown, EXIT_FAILURE otherwise.
+ */
+extern int server_run(const char *path, const arguments *args, const bytes *dict, const ZSTD_aov_registry *registry) {
+
+    struct sockaddr_un addr = { 0 };
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_error("Socket path is too long: %s", path);
+        return EXIT_FAILURE;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    g_server.dict = dict;
+    g_server.registry = registry;
+    g_server.compressionlevel = args->compressionlevel ? args->compressionlevel : ZSTD_aov_compressionlevel;
+    g_server.params = &args->params;
+    g_server.stop = 0;
+
+    /* Digest both directions up front so the first request is already warm. */
+    if (server_getDict(0) == NULL || server_getDict(g_server.compressionlevel) == NULL) {
+        log_error("Cannot load the dictionary");
+        return EXIT_FAILURE;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        log_error("Cannot create socket: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    /* Replace a stale socket left by a previous run. */
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        log_error("Cannot listen on %s: %s", path, strerror(errno));
+        close(listener);
+        return EXIT_FAILURE;
+    }
+
+    if (pipe(g_server.wake) != 0) {
+        log_error("Cannot create pipe: %s", strerror(errno));
+        close(listener);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction sa = { 0 };
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+
+    /* No SA_RESTART, so accept() returns on a shutdown signal. */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Connection threads leave the shutdown signals to this one, so they interrupt accept(). */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+
+    log_info("Listening on %s (default compression level %d)", path, g_server.compressionlevel);
+    log_flush();
+
+    while (!g_server.stop) {
+        int client = accept(listener, NULL, NULL);
+
+        if (client < 0) {
+            if (errno != EINTR) {
+                log_warn("accept: %s", strerror(errno));
+            }
+            continue;
+        }
+
+        if (!server_addClient(client)) {
+            close(client);
+            continue;
+        }
+
+        pthread_t thread;
+        sigset_t previous;
+
+        pthread_sigmask(SIG_BLOCK, &signals, &previous);
+        int created = pthread_create(&thread, NULL, serve_client, (void *)(intptr_t)client);
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+        if (created != 0) {
+            server_removeClient(client);
+            continue;
+        }
+
+        pthread_detach(thread);
+    }
+
+    close(listener);
+    unlink(path);
+
+    log_info("Shutting down");
+
+    /* The caller frees the logger, the registry and the dictionary next. */
+    server_drain();
+
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,23 @@
+
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "args.h"
+#include "types.h"
+#include "zstandard.h"
+
+
+/* Longest request line accepted from a client. */
+#define SERVER_LINE_MAX           8192
+
+/* Most file descriptors a client may have in flight on one connection. */
+#define SERVER_FDS_MAX            16
+
+/* Size of the per-level dictionary cache, above ZSTD_maxCLevel(). */
+#define SERVER_LEVELS             32
+
+
+extern int server_run(const char *path, const arguments *args, const bytes *dict, const ZSTD_aov_registry *registry);
+
+#endif
@@ -42,48 +42,53 @@ struct bytes
     
     /* Number of bytes in the data array. */ 
     size_t size;
+
+    /* Number of bytes allocated for the data array, at least `size`. */
+    size_t capacity;
 };
 
 typedef struct bytes bytes;
 
 
+/* Buffers are pooled by size class, see pool.c. */
+extern bytes *pool_acquire(size_t size);
+extern void pool_release(bytes *b);
+extern int pool_reserve(bytes *b, size_t capacity);
+
+
 /**
  * Initializes a bytes structure.
- * Allocates memory for the byte buffer and sets the size.
+ * Takes a buffer of at least `size` bytes from the pool and sets the size.
  * 
  * @param size: The number of bytes to allocate.
  * 
- * @return: A `bytes` struct with allocated memory, or {NULL, 0} if allocation fails.
+ * @return: A `bytes` struct with allocated memory, or NULL if allocation fails.
  */
 static inline bytes *bytes_init(size_t size) {
-    bytes *b = (bytes *)malloc(sizeof(bytes));
-    if (b == NULL) {
-        return NULL;
-    }
-    b->data = (byte *)malloc(size);
-    if (b->data != NULL) {
-        b->size = size;
-    } else {
-        b->size = 0;
-    }
-
-    return b;
+    return pool_acquire(size);
 }
 
 
 /**
- * Frees the memory allocated for the byte array in a `bytes` structure.
+ * Grows the capacity of a `bytes` structure, keeping its data and size.
+ * 
+ * @param b: A pointer to the `bytes` structure.
+ * @param capacity: The number of bytes needed.
+ * 
+ * @return: Non-zero on success, 0 if allocation fails.
+ */
+static inline int bytes_reserve(bytes *b, size_t capacity) {
+    return pool_reserve(b, capacity);
+}
+
+
+/**
+ * Gives the memory of a `bytes` structure back to the pool for reuse.
  * 
  * @param b: A pointer to the `bytes` structure whose memory should be freed.
  */
 static inline void bytes_free(bytes *b) {
-    if (b && b->data) {
-        free(b->data);
-        b->data = NULL;
-        b->size = 0;
-    }
-    
-    free(b);
+    pool_release(b);
 }
 
 #endif
@@ -3,12 +3,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "args.h"
+#include "log.h"
 #include "types.h"
 #include "utils.h"
 #include "zstandard.h"
@@ -92,8 +95,55 @@ extern bool isfile(const char *path) {
 }
 
 
+/**
+ * Checks if two paths name the same existing file or directory, whatever
+ * their spelling (`./dir/a` and `dir//a`, `dir/` and `dir`, links).
+ *
+ * @param a: The first path.
+ * @param b: The second path.
+ * @return: true if both exist and are the same file, false otherwise.
+ */
+extern bool samefile(const char *a, const char *b) {
+
+    if (a == NULL || b == NULL) {
+        return false;
+    }
+
+    #ifdef _WIN32
+        /* Windows reports no inode numbers, compare the absolute paths instead. */
+        char fa[_MAX_PATH], fb[_MAX_PATH];
+        struct stat st;
+
+        return stat(a, &st) == 0 && _fullpath(fa, a, sizeof(fa)) && _fullpath(fb, b, sizeof(fb)) && _stricmp(fa, fb) == 0;
+    #else
+        struct stat sa, sb;
+
+        /* The output is checked first: it usually does not exist yet. */
+        if (stat(b, &sb) != 0 || stat(a, &sa) != 0) {
+            return false;
+        }
+
+        return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    #endif
+}
+
+
+/**
+ * Logs a hex dump of a byte range, 16 bytes per line by default, followed
+ * by the printable ASCII characters of each line. The dump is emitted as a
+ * single INFO block surrounded by blank lines.
+ *
+ * @param b: The bytes to dump.
+ * @param start: Offset of the first byte to dump.
+ * @param stop: Offset past the last byte to dump, or 0 for the whole buffer.
+ * @param column: Number of bytes per line, or 0 for 16.
+ */
 extern void preview(const bytes *b, int start, int stop, int column) {
 
+    if (b == NULL || !log_enabled(LOG_INFO)) {
+        return;
+    }
+
     /* Default to the beginning of the byte array. */ 
     if (start == 0) {
         start = 0;
@@ -114,28 +164,176 @@ extern void preview(const bytes *b, int start, int stop, int column) {
         return;
     }
 
+    /* Each line holds `column` hex triplets, the separator, `column` characters and a newline. */
+    size_t lines = (size_t)(stop - start + column - 1) / column;
+    size_t cap = 2 + lines * ((size_t)column * 4 + 3);
+
+    char *text = (char *)malloc(cap);
+    if (text == NULL) {
+        return;
+    }
+
+    size_t n = 0;
+
+    text[n++] = '\n';
+
     for (size_t i = start; i < stop; i += column) {        
         for (size_t j = 0; j < column; j++) {
             if (i + j < stop) {
-                printf("%02X ", b->data[i + j]);
+                n += sprintf(text + n, "%02X ", b->data[i + j]);
             } else {
-                printf("   ");
+                n += sprintf(text + n, "   ");
             }
         }
         
-        printf("| ");
+        text[n++] = '|';
+        text[n++] = ' ';
 
         for (size_t j = 0; j < column; j++) {
             if (i + j < stop) {
                 byte chr = b->data[i + j];
                 if (chr >= 32 && chr <= 126) {
-                    printf("%c", chr);
+                    text[n++] = (char)chr;
                 } else {
-                    printf(".");
+                    text[n++] = '.';
                 }
             }
         }
 
-        printf("\n");
+        text[n++] = '\n';
+    }
+
+    text[n++] = '\n';
+
+    log_block(LOG_INFO, text, n);
+
+    free(text);
+}
+
+
+#define XXH_PRIME64_1             0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2             0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3             0x165667B19E3779F9ULL
+#define XXH_PRIME64_4             0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5             0x27D4EB2F165667C5ULL
+
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+
+    return (x << r) | (x >> (64 - r));
+}
+
+
+static inline uint64_t read64(const byte *p) {
+
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+
+static inline uint32_t read32(const byte *p) {
+
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+
+    acc += input * XXH_PRIME64_2;
+    acc = rotl64(acc, 31);
+
+    return acc * XXH_PRIME64_1;
+}
+
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val) {
+
+    acc ^= xxh64_round(0, val);
+
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+
+/**
+ * Computes the XXH64 hash of a buffer (the checksum Zstandard frames use),
+ * assuming a little-endian host.
+ *
+ * @param data: The data to hash.
+ * @param size: Number of bytes to hash.
+ * @param seed: The hash seed, usually 0.
+ * @return: The 64-bit hash.
+ */
+extern uint64_t hash64(const byte *data, size_t size, uint64_t seed) {
+
+    const byte *p = data;
+    const byte *end = data + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+
+        do {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += (uint64_t)size;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
     }
-}
\ No newline at end of file
+
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * XXH_PRIME64_1;
+        h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+
+    for (; p < end; p++) {
+        h ^= (uint64_t)(*p) * XXH_PRIME64_5;
+        h = rotl64(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+
+/**
+ * Returns a monotonic timestamp for measuring wall time.
+ *
+ * @return: Nanoseconds since an arbitrary starting point.
+ */
+extern uint64_t time_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
@@ -4,8 +4,12 @@
 #define UTILS_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <libgen.h>
 
+#include "types.h"
+
 #ifdef _WIN32
     #define SEPARATOR "\\"
 #else 
@@ -30,7 +34,11 @@ extern char *path_join(const char *dir, const char *file);
 
 extern bool isdir(const char *path);
 extern bool isfile(const char *path);
+extern bool samefile(const char *a, const char *b);
 
 extern void preview(const bytes *b, int start, int stop, int column);
 
+extern uint64_t hash64(const byte *data, size_t size, uint64_t seed);
+extern uint64_t time_ns(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,559 @@
+
+
+#ifdef __linux__
+#   define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <unistd.h>
+#   include <sched.h>
+#endif
+
+#include "workers.h"
+
+
+struct workers {
+    workers_fn fn;
+    void *arg;
+
+    size_t njobs;
+
+    /* Next job to hand out. */
+    _Atomic size_t next;
+};
+
+typedef struct workers workers;
+
+
+struct worker {
+    workers *pool;
+    int index;
+    pthread_t thread;
+
+    /* Whether the thread is bound to its processor, not for the calling thread. */
+    bool bind;
+};
+
+typedef struct worker worker;
+
+
+/**
+ * Where the workers run with `--pin`: the processors the process may use,
+ * in the order workers are bound to them, taking one processor of each
+ * NUMA node in turn.
+ */
+static struct {
+    bool pin;
+
+    /* Worker `i` runs on `cpus[i % ncpus]`, of node `nodes[i % ncpus]`. */
+    int cpus[WORKERS_CPUS_MAX];
+    int nodes[WORKERS_CPUS_MAX];
+    int ncpus;
+
+    int nnodes;
+} g_workers = { .nnodes = 1 };
+
+
+/* Node of the processor the calling worker is bound to, 0 when not pinned. */
+static _Thread_local int workers_current = 0;
+
+
+#ifdef __linux__
+
+/**
+ * Reads a list of processors or nodes from sysfs, such as "0-3,8-11".
+ *
+ * @param path: The file to read.
+ * @param set: Receives the listed numbers, empty if the file cannot be read.
+ */
+static void workers_readList(const char *path, cpu_set_t *set) {
+
+    CPU_ZERO(set);
+
+    FILE *fptr = fopen(path, "r");
+
+    if (fptr == NULL) {
+        return;
+    }
+
+    int lo, hi;
+
+    while (fscanf(fptr, "%d", &lo) == 1) {
+        int c = fgetc(fptr);
+
+        hi = lo;
+
+        if (c == '-' && fscanf(fptr, "%d", &hi) == 1) {
+            c = fgetc(fptr);
+        }
+
+        for (int n = lo; n >= 0 && n <= hi && n < CPU_SETSIZE; n++) {
+            CPU_SET(n, set);
+        }
+
+        if (c != ',') {
+            break;
+        }
+    }
+
+    fclose(fptr);
+}
+
+#endif
+
+
+/**
+ * Sets up where the workers run. With `pin`, lists the processors the
+ * process may use and their NUMA nodes, so that worker threads can be
+ * bound to processors spread over the nodes and callers can give each
+ * node its own copy of shared data. Nodes past `WORKERS_NODES_MAX` are
+ * counted as the last one.
+ *
+ * @param pin: Whether to bind worker threads to processors.
+ * @return: `false` if threads cannot be bound on this system, `true` otherwise.
+ */
+extern bool workers_init(bool pin) {
+
+    g_workers.pin = false;
+    g_workers.ncpus = 0;
+    g_workers.nnodes = 1;
+
+    if (!pin) {
+        return true;
+    }
+
+    #if defined(__linux__)
+        cpu_set_t allowed;
+
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return false;
+        }
+
+        /* Node slot of each allowed processor, processors of no known node go to the first. */
+        static int slots[CPU_SETSIZE];
+        memset(slots, 0, sizeof(slots));
+
+        cpu_set_t online;
+        workers_readList("/sys/devices/system/node/online", &online);
+
+        int nnodes = 0;
+
+        for (int n = 0; n < CPU_SETSIZE; n++) {
+            if (!CPU_ISSET(n, &online)) {
+                continue;
+            }
+
+            char path[64];
+            cpu_set_t cpus;
+
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+            workers_readList(path, &cpus);
+            CPU_AND(&cpus, &cpus, &allowed);
+
+            if (CPU_COUNT(&cpus) == 0) {
+                continue;
+            }
+
+            int slot = nnodes < WORKERS_NODES_MAX ? nnodes++ : WORKERS_NODES_MAX - 1;
+
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &cpus)) {
+                    slots[cpu] = slot;
+                }
+            }
+        }
+
+        g_workers.nnodes = nnodes > 0 ? nnodes : 1;
+
+        /* Deal the processors round-robin over the nodes, so consecutive workers alternate nodes. */
+        static int lists[WORKERS_NODES_MAX][WORKERS_CPUS_MAX];
+        int counts[WORKERS_NODES_MAX] = { 0 };
+        int most = 0;
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            int slot = slots[cpu];
+
+            if (CPU_ISSET(cpu, &allowed) && counts[slot] < WORKERS_CPUS_MAX) {
+                lists[slot][counts[slot]++] = cpu;
+                most = counts[slot] > most ? counts[slot] : most;
+            }
+        }
+
+        for (int round = 0; round < most; round++) {
+            for (int slot = 0; slot < g_workers.nnodes && g_workers.ncpus < WORKERS_CPUS_MAX; slot++) {
+                if (round < counts[slot]) {
+                    g_workers.cpus[g_workers.ncpus] = lists[slot][round];
+                    g_workers.nodes[g_workers.ncpus] = slot;
+                    g_workers.ncpus++;
+                }
+            }
+        }
+    #elif defined(_WIN32)
+        DWORD_PTR process, system;
+
+        if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system)) {
+            return false;
+        }
+
+        for (int cpu = 0; cpu < (int)(sizeof(DWORD_PTR) * 8); cpu++) {
+            if (process & ((DWORD_PTR)1 << cpu)) {
+                g_workers.cpus[g_workers.ncpus] = cpu;
+                g_workers.nodes[g_workers.ncpus] = 0;
+                g_workers.ncpus++;
+            }
+        }
+    #endif
+
+    g_workers.pin = g_workers.ncpus > 0;
+
+    return g_workers.pin;
+}
+
+
+/**
+ * Returns the number of NUMA nodes the workers are spread over, 1 unless
+ * they are pinned on a system with several nodes.
+ */
+extern int workers_nodes(void) {
+
+    return g_workers.nnodes;
+}
+
+
+/**
+ * Returns the node worker `worker` runs on, from 0 to `workers_nodes() - 1`.
+ */
+extern int workers_node(int worker) {
+
+    if (!g_workers.pin) {
+        return 0;
+    }
+
+    return g_workers.nodes[worker % g_workers.ncpus];
+}
+
+
+/**
+ * Returns the node the calling thread runs on, 0 outside pinned workers.
+ */
+extern int workers_currentNode(void) {
+
+    return workers_current;
+}
+
+
+/**
+ * Binds the calling worker thread to its processor.
+ */
+static void workers_bind(int index) {
+
+    int cpu = g_workers.cpus[index % g_workers.ncpus];
+
+    #if defined(__linux__)
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            return;
+        }
+    #elif defined(_WIN32)
+        if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) == 0) {
+            return;
+        }
+    #else
+        (void)cpu;
+    #endif
+
+    workers_current = g_workers.nodes[index % g_workers.ncpus];
+}
+
+
+/**
+ * Returns the number of online processors, used as the default number
+ * of worker threads.
+ *
+ * @return: The number of processors, at least 1.
+ */
+extern int workers_default(void) {
+
+    #ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        long n = (long)info.dwNumberOfProcessors;
+    #else
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+
+    return n > 0 ? (int)n : 1;
+}
+
+
+/**
+ * Resolves the number of threads to start for a run.
+ *
+ * @param requested: Number of threads asked for, or 0 for one per processor.
+ * @param njobs: Number of jobs; no more threads than jobs are started.
+ * @return: The number of threads, at least 1.
+ */
+extern int workers_count(int requested, size_t njobs) {
+
+    int n = requested > 0 ? requested : workers_default();
+
+    if ((size_t)n > njobs) {
+        n = njobs ? (int)njobs : 1;
+    }
+
+    return n;
+}
+
+
+static void *worker_main(void *arg) {
+
+    worker *w = (worker *)arg;
+    workers *pool = w->pool;
+
+    if (w->bind && g_workers.pin) {
+        workers_bind(w->index);
+    }
+
+    for (;;) {
+        size_t index = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+
+        if (index >= pool->njobs) {
+            break;
+        }
+
+        pool->fn(index, w->index, pool->arg);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Runs `fn` for every job index on a set of worker threads. Jobs are
+ * handed out in index order as workers become free, so callers control
+ * the dispatch order by ordering their jobs. Returns when all jobs are
+ * done.
+ *
+ * @param nthreads: Number of threads, as returned by `workers_count`.
+ * @param njobs: Number of jobs.
+ * @param fn: The function run for each job.
+ * @param arg: Argument passed to `fn`.
+ */
+extern void workers_run(int nthreads, size_t njobs, workers_fn fn, void *arg) {
+
+    workers pool = { fn, arg, njobs, 0 };
+
+    worker *threads = nthreads > 1 ? (worker *)calloc((size_t)nthreads, sizeof(worker)) : NULL;
+
+    if (threads == NULL) {
+        /* Single worker (or out of memory): run in the calling thread. */
+        worker self = { &pool, 0 };
+        worker_main(&self);
+        return;
+    }
+
+    int started = 0;
+
+    for (int i = 0; i < nthreads; i++) {
+        threads[i].pool = &pool;
+        threads[i].index = i;
+        threads[i].bind = true;
+
+        if (pthread_create(&threads[i].thread, NULL, worker_main, &threads[i]) != 0) {
+            break;
+        }
+
+        started++;
+    }
+
+    if (started == 0) {
+        worker self = { &pool, 0 };
+        worker_main(&self);
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+
+    free(threads);
+}
+
+
+/**
+ * Reads a cgroup memory limit file: a number of bytes, or "max" (v2) or
+ * a huge number (v1) for no limit.
+ *
+ * @return: The limit, or 0 when there is none or the file cannot be read.
+ */
+static uint64_t workers_readLimit(const char *path) {
+
+    FILE *fptr = fopen(path, "r");
+
+    if (fptr == NULL) {
+        return 0;
+    }
+
+    unsigned long long limit = 0;
+
+    if (fscanf(fptr, "%llu", &limit) != 1) {
+        limit = 0;
+    }
+
+    fclose(fptr);
+
+    return (uint64_t)limit;
+}
+
+
+/**
+ * Returns the memory the process may use: the memory limit of its cgroup
+ * (v2, then v1) when it has one, capped by the physical memory.
+ *
+ * @return: The limit in bytes, or 0 if it cannot be determined.
+ */
+extern uint64_t workers_memoryLimit(void) {
+
+    uint64_t physical = 0;
+    uint64_t limit = 0;
+
+    #ifdef _WIN32
+        MEMORYSTATUSEX status;
+        status.dwLength = sizeof(status);
+
+        if (GlobalMemoryStatusEx(&status)) {
+            physical = (uint64_t)status.ullTotalPhys;
+        }
+    #else
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long pagesize = sysconf(_SC_PAGESIZE);
+
+        if (pages > 0 && pagesize > 0) {
+            physical = (uint64_t)pages * (uint64_t)pagesize;
+        }
+    #endif
+
+    #ifdef __linux__
+        /* The cgroup v2 of the process is the "0::" line, usually "/" inside a container. */
+        char line[512];
+        char path[600];
+
+        FILE *fptr = fopen("/proc/self/cgroup", "r");
+
+        while (fptr && limit == 0 && fgets(line, sizeof(line), fptr)) {
+            if (strncmp(line, "0::", 3) == 0) {
+                line[strcspn(line, "\n")] = '\0';
+                snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.max", strcmp(line + 3, "/") == 0 ? "" : line + 3);
+                limit = workers_readLimit(path);
+            }
+        }
+
+        if (fptr) {
+            fclose(fptr);
+        }
+
+        if (limit == 0) {
+            limit = workers_readLimit("/sys/fs/cgroup/memory.max");
+        }
+
+        if (limit == 0) {
+            limit = workers_readLimit("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+        }
+    #endif
+
+    if (limit == 0 || (physical && limit > physical)) {
+        limit = physical;
+    }
+
+    return limit;
+}
+
+
+/**
+ * Sets up a memory budget.
+ *
+ * @param b: The budget.
+ * @param limit: Bytes the jobs may reserve at once, 0 for no limit.
+ */
+extern void workers_budgetInit(workers_budget *b, uint64_t limit) {
+
+    b->limit = limit;
+    b->used = 0;
+    b->peak = 0;
+    b->waits = 0;
+    b->trim = NULL;
+
+    pthread_mutex_init(&b->mutex, NULL);
+    pthread_cond_init(&b->cond, NULL);
+}
+
+
+/**
+ * Reserves the memory of a job, waiting until the running jobs leave
+ * room for it. A job larger than the whole budget runs alone rather than
+ * never.
+ *
+ * @param b: The budget.
+ * @param bytes: The estimated footprint of the job.
+ */
+extern void workers_budgetAcquire(workers_budget *b, uint64_t bytes) {
+
+    pthread_mutex_lock(&b->mutex);
+
+    if (b->limit && b->used && b->used + bytes > b->limit) {
+        b->waits++;
+
+        if (b->trim) {
+            pthread_mutex_unlock(&b->mutex);
+            b->trim();
+            pthread_mutex_lock(&b->mutex);
+        }
+
+        while (b->used && b->used + bytes > b->limit) {
+            pthread_cond_wait(&b->cond, &b->mutex);
+        }
+    }
+
+    b->used += bytes;
+
+    if (b->used > b->peak) {
+        b->peak = b->used;
+    }
+
+    pthread_mutex_unlock(&b->mutex);
+}
+
+
+/**
+ * Gives back the memory reserved by `workers_budgetAcquire`.
+ *
+ * @param b: The budget.
+ * @param bytes: The footprint the job reserved.
+ */
+extern void workers_budgetRelease(workers_budget *b, uint64_t bytes) {
+
+    pthread_mutex_lock(&b->mutex);
+
+    b->used -= bytes;
+
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+
+extern void workers_budgetDestroy(workers_budget *b) {
+
+    pthread_cond_destroy(&b->cond);
+    pthread_mutex_destroy(&b->mutex);
+}
@@ -0,0 +1,71 @@
+
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+
+/* Most NUMA nodes told apart; workers on further nodes share the last one's resources. */
+#define WORKERS_NODES_MAX         8
+
+/* Most processors workers are bound to. */
+#define WORKERS_CPUS_MAX          1024
+
+
+/**
+ * Function run for each job of `workers_run`.
+ *
+ * @param index: Index of the job, in [0, njobs).
+ * @param worker: Index of the worker thread running it, in [0, nthreads).
+ * @param arg: The argument given to `workers_run`.
+ */
+typedef void (*workers_fn)(size_t index, int worker, void *arg);
+
+
+/**
+ * A memory budget shared by the workers of a run: each job reserves its
+ * estimated footprint before it starts and gives it back when done, so
+ * jobs only run side by side while they fit.
+ */
+struct workers_budget {
+    /* Bytes that may be reserved at once, 0 for no limit. */
+    uint64_t limit;
+
+    /* Bytes reserved by the running jobs, and the most ever reserved. */
+    uint64_t used;
+    uint64_t peak;
+
+    /* Number of jobs that had to wait for memory. */
+    size_t waits;
+
+    /* Called, when set, before a job waits, to give back memory held outside the budget. */
+    void (*trim)(void);
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+typedef struct workers_budget workers_budget;
+
+
+extern bool workers_init(bool pin);
+extern int workers_nodes(void);
+extern int workers_node(int worker);
+extern int workers_currentNode(void);
+
+extern int workers_default(void);
+extern int workers_count(int requested, size_t njobs);
+extern void workers_run(int nthreads, size_t njobs, workers_fn fn, void *arg);
+
+extern uint64_t workers_memoryLimit(void);
+
+extern void workers_budgetInit(workers_budget *b, uint64_t limit);
+extern void workers_budgetAcquire(workers_budget *b, uint64_t bytes);
+extern void workers_budgetRelease(workers_budget *b, uint64_t bytes);
+extern void workers_budgetDestroy(workers_budget *b);
+
+#endif
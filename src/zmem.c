@@ -0,0 +1,322 @@
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#   include <sys/mman.h>
+#endif
+
+#include "workers.h"
+#include "zmem.h"
+#include "zstandard.h"
+
+
+/**
+ * Placed in front of every block handed to Zstandard, so `zmem_free`
+ * knows how the block was obtained. Its size keeps the block aligned on
+ * a cache line.
+ */
+struct zmem_header {
+    /* Size of the mapping holding the block, 0 for a `malloc` block. */
+    size_t mapped;
+
+    /* NUMA node of the worker that first touched the mapping. */
+    int node;
+
+    byte _pad[64 - sizeof(size_t) - sizeof(int)];
+};
+
+typedef struct zmem_header zmem_header;
+
+
+static struct {
+    pthread_mutex_t mutex;
+
+    /* Free mappings, oldest first, each `sizes[i]` bytes, faulted in on node `nodes[i]`. */
+    void *free[ZMEM_KEEP];
+    size_t sizes[ZMEM_KEEP];
+    int nodes[ZMEM_KEEP];
+    size_t count;
+    size_t cached_bytes;
+
+    /* Most bytes the free mappings may add up to. */
+    size_t cache_max;
+
+    bool hugepages;
+
+    _Atomic size_t allocs;
+    _Atomic size_t reused;
+    _Atomic size_t maps;
+    _Atomic size_t huge;
+} g_zmem = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cache_max = ZMEM_CACHE_MAX };
+
+
+#ifdef __linux__
+
+/**
+ * Maps `size` bytes of anonymous memory, on explicit huge pages when they
+ * are enabled and reserved, otherwise on regular pages that transparent
+ * huge pages may back.
+ */
+static void *zmem_map(size_t size) {
+
+    void *p;
+
+    atomic_fetch_add_explicit(&g_zmem.maps, 1, memory_order_relaxed);
+
+    #ifdef MAP_HUGETLB
+        if (g_zmem.hugepages) {
+            p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+            if (p != MAP_FAILED) {
+                atomic_fetch_add_explicit(&g_zmem.huge, 1, memory_order_relaxed);
+                return p;
+            }
+        }
+    #endif
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+
+    #ifdef MADV_HUGEPAGE
+        if (g_zmem.hugepages) {
+            madvise(p, size, MADV_HUGEPAGE);
+        }
+    #endif
+
+    return p;
+}
+
+
+/**
+ * Removes the free mapping at `i`, keeping the others oldest first.
+ * Called with the lock held.
+ */
+static void zmem_remove(size_t i) {
+
+    g_zmem.cached_bytes -= g_zmem.sizes[i];
+    g_zmem.count--;
+
+    memmove(&g_zmem.free[i], &g_zmem.free[i + 1], (g_zmem.count - i) * sizeof(g_zmem.free[0]));
+    memmove(&g_zmem.sizes[i], &g_zmem.sizes[i + 1], (g_zmem.count - i) * sizeof(g_zmem.sizes[0]));
+    memmove(&g_zmem.nodes[i], &g_zmem.nodes[i + 1], (g_zmem.count - i) * sizeof(g_zmem.nodes[0]));
+}
+
+#endif
+
+
+/**
+ * Allocation callback given to Zstandard. Workspaces of `ZMEM_LARGE` bytes
+ * or more come from a pool of mappings, so contexts and dictionaries
+ * created one after the other reuse memory that is already faulted in
+ * instead of mapping and zeroing fresh pages.
+ */
+static void *zmem_alloc(void *opaque, size_t size) {
+
+    (void)opaque;
+
+    zmem_header *h = NULL;
+
+    #ifdef __linux__
+
+        if (size >= ZMEM_LARGE) {
+            size_t mapped = (size + sizeof(zmem_header) + ZMEM_HUGE_PAGE - 1) / ZMEM_HUGE_PAGE * ZMEM_HUGE_PAGE;
+            int node = workers_currentNode();
+
+            atomic_fetch_add_explicit(&g_zmem.allocs, 1, memory_order_relaxed);
+
+            pthread_mutex_lock(&g_zmem.mutex);
+
+            for (size_t i = 0; i < g_zmem.count; i++) {
+                if (g_zmem.sizes[i] == mapped && g_zmem.nodes[i] == node) {
+                    h = (zmem_header *)g_zmem.free[i];
+                    zmem_remove(i);
+                    break;
+                }
+            }
+
+            pthread_mutex_unlock(&g_zmem.mutex);
+
+            if (h != NULL) {
+                atomic_fetch_add_explicit(&g_zmem.reused, 1, memory_order_relaxed);
+            } else {
+                h = (zmem_header *)zmem_map(mapped);
+            }
+
+            if (h == NULL) {
+                return NULL;
+            }
+
+            h->mapped = mapped;
+            h->node = node;
+
+            return h + 1;
+        }
+
+    #endif
+
+    h = (zmem_header *)malloc(sizeof(zmem_header) + size);
+
+    if (h == NULL) {
+        return NULL;
+    }
+
+    h->mapped = 0;
+
+    return h + 1;
+}
+
+
+/**
+ * Free callback given to Zstandard. Mappings go back to the pool, the
+ * oldest ones making room for them when it is full by count or by bytes;
+ * a mapping larger than the whole cache is unmapped.
+ */
+static void zmem_free(void *opaque, void *address) {
+
+    (void)opaque;
+
+    if (address == NULL) {
+        return;
+    }
+
+    zmem_header *h = (zmem_header *)address - 1;
+
+    if (h->mapped == 0) {
+        free(h);
+        return;
+    }
+
+    #ifdef __linux__
+
+        size_t mapped = h->mapped;
+
+        /* Evicted mappings are unmapped once the lock is released. */
+        void *evicted[ZMEM_KEEP];
+        size_t evictedsizes[ZMEM_KEEP];
+        size_t nevicted = 0;
+
+        pthread_mutex_lock(&g_zmem.mutex);
+
+        if (mapped > g_zmem.cache_max) {
+            pthread_mutex_unlock(&g_zmem.mutex);
+            munmap(h, mapped);
+            return;
+        }
+
+        while (g_zmem.count == ZMEM_KEEP || g_zmem.cached_bytes + mapped > g_zmem.cache_max) {
+            evicted[nevicted] = g_zmem.free[0];
+            evictedsizes[nevicted] = g_zmem.sizes[0];
+            nevicted++;
+            zmem_remove(0);
+        }
+
+        g_zmem.free[g_zmem.count] = h;
+        g_zmem.sizes[g_zmem.count] = mapped;
+        g_zmem.nodes[g_zmem.count] = h->node;
+        g_zmem.count++;
+        g_zmem.cached_bytes += mapped;
+
+        pthread_mutex_unlock(&g_zmem.mutex);
+
+        for (size_t i = 0; i < nevicted; i++) {
+            munmap(evicted[i], evictedsizes[i]);
+        }
+
+    #endif
+}
+
+
+/**
+ * Configures the allocator. Call it before any context or dictionary is
+ * created.
+ *
+ * @param hugepages: Whether to back mappings with huge pages, explicit
+ *                   (`MAP_HUGETLB`) when the system has some reserved,
+ *                   transparent (`MADV_HUGEPAGE`) otherwise.
+ */
+extern void zmem_init(bool hugepages) {
+
+    g_zmem.hugepages = hugepages;
+}
+
+
+/**
+ * Returns the allocator to pass to the `_advanced` Zstandard constructors.
+ */
+extern ZSTD_customMem zmem_customMem(void) {
+
+    ZSTD_customMem mem = { zmem_alloc, zmem_free, NULL };
+
+    return mem;
+}
+
+
+/**
+ * Reads the counters of the allocator.
+ *
+ * @param stats: Receives the counters.
+ */
+extern void zmem_getStats(zmem_stats *stats) {
+
+    stats->allocs = atomic_load(&g_zmem.allocs);
+    stats->reused = atomic_load(&g_zmem.reused);
+    stats->maps = atomic_load(&g_zmem.maps);
+    stats->huge = atomic_load(&g_zmem.huge);
+
+    pthread_mutex_lock(&g_zmem.mutex);
+
+    stats->cached = g_zmem.count;
+    stats->cached_bytes = g_zmem.cached_bytes;
+
+    pthread_mutex_unlock(&g_zmem.mutex);
+}
+
+
+/**
+ * Lowers the bytes the pool keeps in free mappings, e.g. to a share of a
+ * memory budget, unmapping them all if it already keeps more.
+ *
+ * @param bytes: The most bytes to keep, at most ZMEM_CACHE_MAX.
+ */
+extern void zmem_setCacheMax(size_t bytes) {
+
+    pthread_mutex_lock(&g_zmem.mutex);
+
+    g_zmem.cache_max = bytes < ZMEM_CACHE_MAX ? bytes : ZMEM_CACHE_MAX;
+    bool over = g_zmem.cached_bytes > g_zmem.cache_max;
+
+    pthread_mutex_unlock(&g_zmem.mutex);
+
+    if (over) {
+        zmem_trim();
+    }
+}
+
+
+/**
+ * Unmaps every free mapping kept in the pool.
+ */
+extern void zmem_trim(void) {
+
+    pthread_mutex_lock(&g_zmem.mutex);
+
+    #ifdef __linux__
+        for (size_t i = 0; i < g_zmem.count; i++) {
+            munmap(g_zmem.free[i], g_zmem.sizes[i]);
+        }
+    #endif
+
+    g_zmem.count = 0;
+    g_zmem.cached_bytes = 0;
+
+    pthread_mutex_unlock(&g_zmem.mutex);
+}
@@ -0,0 +1,54 @@
+
+
+#ifndef ZMEM_H
+#define ZMEM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "zstandard.h"
+
+
+/* Allocations from this size on are served from pooled memory mappings. */
+#define ZMEM_LARGE                (1024 * 1024)
+
+/* Mappings are rounded up to this size, the size of a huge page. */
+#define ZMEM_HUGE_PAGE            (2 * 1024 * 1024)
+
+/* Most free mappings kept for reuse. */
+#define ZMEM_KEEP                 16
+
+/* Most bytes kept in free mappings, unless lowered by zmem_setCacheMax(). Larger mappings are never kept. */
+#define ZMEM_CACHE_MAX            ((size_t)256 * 1024 * 1024)
+
+
+/**
+ * Counters of the Zstandard workspace allocator.
+ */
+struct zmem_stats {
+    /* Large allocations made by Zstandard. */
+    size_t allocs;
+
+    /* Of those, allocations served by a pooled mapping. */
+    size_t reused;
+
+    /* New mappings, and how many of them are backed by explicit huge pages. */
+    size_t maps;
+    size_t huge;
+
+    /* Free mappings kept in the pool, and their total size. */
+    size_t cached;
+    size_t cached_bytes;
+};
+
+typedef struct zmem_stats zmem_stats;
+
+
+extern void zmem_init(bool hugepages);
+extern ZSTD_customMem zmem_customMem(void);
+
+extern void zmem_getStats(zmem_stats *stats);
+extern void zmem_setCacheMax(size_t bytes);
+extern void zmem_trim(void);
+
+#endif
@@ -5,11 +5,23 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#   include "dirent.h"
+#elif __linux__
+#   include <dirent.h>
+#endif
 
 #include "args.h"
 #include "io.h"
 #include "types.h"
 #include "utils.h"
+#include "zmem.h"
 #include "zstandard.h"
 
 
@@ -26,6 +38,12 @@ const byte HEADER[HEADER_SIZE] = {0x22, 0x4A, 0x00, 0xEF};
  */ 
 const byte FRAME_HEADER[FRAME_HEADER_SIZE] = {0x28, 0xB5, 0x2F, 0xFD};
 
+/**
+ * The first 4 bytes of a patch written by `--patch-from`. Like the AoV
+ * header, they are followed by the size of the content the patch gives.
+ */
+const byte PATCH_HEADER[HEADER_SIZE] = {0x22, 0x4A, 0x50, 0xEF};
+
 
 /**
  * Returns the minimum compression level for Zstandard.
@@ -82,6 +100,219 @@ extern bool ZSTD_checkCLevel(const int clevel) {
 }
 
 
+/**
+ * Named profiles, from quick local iteration to the smallest output.
+ * `ship` is the level the game's own files are compressed with.
+ */
+static const ZSTD_aov_profile ZSTD_aov_profiles[] = {
+    { "fast-iterate", 3,  { .windowLog = 20, .strategy = ZSTD_dfast } },
+    { "ship",         ZSTD_aov_compressionlevel, { 0 } },
+    { "max",          22, { .windowLog = ZSTD_aov_windowLogMax, .targetLength = 999, 
+                            .strategy = ZSTD_btultra2, .literalCompressionMode = ZSTD_ps_enable } },
+};
+
+
+/**
+ * Looks up a named profile.
+ *
+ * @param name: The profile name.
+ * @return: The profile, or NULL if there is none with this name.
+ */
+extern const ZSTD_aov_profile *ZSTD_aov_getProfile(const char *name) {
+
+    for (size_t i = 0; i < sizeof(ZSTD_aov_profiles) / sizeof(ZSTD_aov_profiles[0]); i++) {
+        if (strcmp(ZSTD_aov_profiles[i].name, name) == 0) {
+            return &ZSTD_aov_profiles[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * A parameter accepted by `ZSTD_aov_parseParams`, with the short name
+ * the `zstd` command line uses and the Zstandard parameter it maps to.
+ */
+struct ZSTD_aov_paramName {
+    const char *name;
+    const char *shortname;
+    ZSTD_cParameter param;
+    size_t offset;
+};
+
+static const struct ZSTD_aov_paramName ZSTD_aov_paramNames[] = {
+    { "windowLog",              "wlog",  ZSTD_c_windowLog,              offsetof(ZSTD_aov_params, windowLog) },
+    { "chainLog",               "clog",  ZSTD_c_chainLog,               offsetof(ZSTD_aov_params, chainLog) },
+    { "hashLog",                "hlog",  ZSTD_c_hashLog,                offsetof(ZSTD_aov_params, hashLog) },
+    { "searchLog",              "slog",  ZSTD_c_searchLog,              offsetof(ZSTD_aov_params, searchLog) },
+    { "minMatch",               "mml",   ZSTD_c_minMatch,               offsetof(ZSTD_aov_params, minMatch) },
+    { "targetLength",           "tlen",  ZSTD_c_targetLength,           offsetof(ZSTD_aov_params, targetLength) },
+    { "strategy",               "strat", ZSTD_c_strategy,               offsetof(ZSTD_aov_params, strategy) },
+    { "literalCompressionMode", "lcm",   ZSTD_c_literalCompressionMode, offsetof(ZSTD_aov_params, literalCompressionMode) },
+};
+
+static const char *ZSTD_aov_strategyNames[] = {
+    "", "fast", "dfast", "greedy", "lazy", "lazy2", "btlazy2", "btopt", "btultra", "btultra2"
+};
+
+
+/**
+ * Parses a value of `ZSTD_aov_parseParams`: a number, a strategy name or
+ * a literal compression mode name.
+ */
+static bool ZSTD_aov_parseValue(ZSTD_cParameter param, const char *text, int *value) {
+
+    if (param == ZSTD_c_strategy) {
+        for (int i = 1; i < (int)(sizeof(ZSTD_aov_strategyNames) / sizeof(ZSTD_aov_strategyNames[0])); i++) {
+            if (strcmp(text, ZSTD_aov_strategyNames[i]) == 0) {
+                *value = i;
+                return true;
+            }
+        }
+    }
+
+    if (param == ZSTD_c_literalCompressionMode) {
+        if (strcmp(text, "auto") == 0)         { *value = ZSTD_ps_auto;    return true; }
+        if (strcmp(text, "huffman") == 0)      { *value = ZSTD_ps_enable;  return true; }
+        if (strcmp(text, "uncompressed") == 0) { *value = ZSTD_ps_disable; return true; }
+    }
+
+    char *end;
+    long n = strtol(text, &end, 10);
+
+    if (end == text || *end != '\0' || n < INT_MIN || n > INT_MAX) {
+        return false;
+    }
+
+    *value = (int)n;
+
+    return true;
+}
+
+
+/**
+ * Parses compression parameter overrides written as a comma-separated
+ * list of NAME=VALUE, such as "wlog=23,strat=btultra2,tlen=256". Names are
+ * the Zstandard parameter names or the short names of the `zstd` command
+ * line. Every value is checked against the bounds of the library, and
+ * windows the game cannot decode are refused.
+ *
+ * @param spec: The list to parse.
+ * @param p: The parameters to update.
+ * @param error: Receives a message on failure.
+ * @param errsize: Size of `error`.
+ * @return: `true` on success, `false` on the first invalid entry.
+ */
+extern bool ZSTD_aov_parseParams(const char *spec, ZSTD_aov_params *p, char *error, size_t errsize) {
+
+    char entry[128];
+
+    while (*spec) {
+        size_t len = strcspn(spec, ",");
+
+        if (len >= sizeof(entry)) {
+            snprintf(error, errsize, "parameter '%.32s...' is too long", spec);
+            return false;
+        }
+
+        memcpy(entry, spec, len);
+        entry[len] = '\0';
+
+        spec += len + (spec[len] == ',');
+
+        if (len == 0) {
+            continue;
+        }
+
+        char *value = strchr(entry, '=');
+
+        if (value == NULL) {
+            snprintf(error, errsize, "parameter '%s' needs a value (NAME=VALUE)", entry);
+            return false;
+        }
+
+        *value++ = '\0';
+
+        const struct ZSTD_aov_paramName *pn = NULL;
+
+        for (size_t i = 0; i < sizeof(ZSTD_aov_paramNames) / sizeof(ZSTD_aov_paramNames[0]); i++) {
+            if (strcmp(entry, ZSTD_aov_paramNames[i].name) == 0 || strcmp(entry, ZSTD_aov_paramNames[i].shortname) == 0) {
+                pn = &ZSTD_aov_paramNames[i];
+                break;
+            }
+        }
+
+        if (pn == NULL) {
+            snprintf(error, errsize, "unknown parameter '%s'", entry);
+            return false;
+        }
+
+        int n;
+        ZSTD_bounds bounds = ZSTD_cParam_getBounds(pn->param);
+
+        if (!ZSTD_aov_parseValue(pn->param, value, &n)) {
+            snprintf(error, errsize, "invalid value '%s' for %s", value, pn->name);
+            return false;
+        }
+
+        if (pn->param == ZSTD_c_windowLog && bounds.upperBound > ZSTD_aov_windowLogMax) {
+            bounds.upperBound = ZSTD_aov_windowLogMax;
+        }
+
+        if (ZSTD_isError(bounds.error) || n < bounds.lowerBound || n > bounds.upperBound) {
+            snprintf(error, errsize, "%s must be between %d and %d", pn->name, bounds.lowerBound, bounds.upperBound);
+            return false;
+        }
+
+        *(int *)((char *)p + pn->offset) = n;
+    }
+
+    return true;
+}
+
+
+/**
+ * Writes the parameters that are set in the syntax `ZSTD_aov_parseParams`
+ * reads, with short names, so a result can be given back to `--zstd`.
+ *
+ * @param p: The parameters to write.
+ * @param out: Receives the list, empty when no parameter is set.
+ * @param size: Size of `out`.
+ * @return: `out`.
+ */
+extern char *ZSTD_aov_formatParams(const ZSTD_aov_params *p, char *out, size_t size) {
+
+    size_t len = 0;
+
+    out[0] = '\0';
+
+    for (size_t i = 0; i < sizeof(ZSTD_aov_paramNames) / sizeof(ZSTD_aov_paramNames[0]) && len < size; i++) {
+        const struct ZSTD_aov_paramName *pn = &ZSTD_aov_paramNames[i];
+        int n = *(const int *)((const char *)p + pn->offset);
+
+        if (n == 0) {
+            continue;
+        }
+
+        const char *sep = len ? "," : "";
+        int written;
+
+        if (pn->param == ZSTD_c_strategy && n < (int)(sizeof(ZSTD_aov_strategyNames) / sizeof(ZSTD_aov_strategyNames[0]))) {
+            written = snprintf(out + len, size - len, "%s%s=%s", sep, pn->shortname, ZSTD_aov_strategyNames[n]);
+        } else if (pn->param == ZSTD_c_literalCompressionMode) {
+            written = snprintf(out + len, size - len, "%s%s=%s", sep, pn->shortname, n == ZSTD_ps_enable ? "huffman" : "uncompressed");
+        } else {
+            written = snprintf(out + len, size - len, "%s%s=%d", sep, pn->shortname, n);
+        }
+
+        len += written > 0 ? (size_t)written : 0;
+    }
+
+    return out;
+}
+
+
 typedef void (*cleanup_context_fn)(void *);
 typedef void (*cleanup_dict_fn)(void *);
 
@@ -118,6 +349,25 @@ extern bool ZSTD_isHeader(const byte *data) {
 }
 
 
+/**
+ * Reads the decompressed size stored after the AoV header, written in
+ * little-endian order by `ZSTD_setHeader`.
+ *
+ * @param data: Pointer to data starting with the AoV header, at least 8 bytes.
+ * @return: The stored decompressed size.
+ */
+extern uint32_t ZSTD_getHeaderSize(const byte *data) {
+
+    uint32_t dsize = 0;
+
+    for (int i = 0; i < HEADER_SIZE; i++) {
+        dsize |= (uint32_t)data[HEADER_SIZE + i] << (8 * i);
+    }
+
+    return dsize;
+}
+
+
 /** 
  * Checks if the provided data matches the specified header, indicating it is 
  * not decompressed data.
@@ -148,10 +398,10 @@ extern bool ZSTD_isNotDecompressedData(byte *data, const byte *header) {
  * @param size: Size of the data.
  * @return: The index of the frame header if found, `-1` otherwise.
  */
-extern int ZSTD_getFrameHeaderIndex(const byte *data, size_t size) {
-    for (size_t i = 0; i < size - FRAME_HEADER_SIZE; i++) {
+extern ptrdiff_t ZSTD_getFrameHeaderIndex(const byte *data, size_t size) {
+    for (size_t i = 0; i + FRAME_HEADER_SIZE <= size; i++) {
         if (memcmp(data + i, FRAME_HEADER, FRAME_HEADER_SIZE) == 0) {
-            return (int)i;
+            return (ptrdiff_t)i;
         }
     }
 
@@ -230,13 +480,13 @@ extern bytes *ZSTD_extract_CompressData(bytes *b) {
     }
 
     /* Find the frame header (which should be 4 bytes after the decompressed size). */ 
-    int fh = ZSTD_getFrameHeaderIndex(b->data, b->size);
+    ptrdiff_t fh = ZSTD_getFrameHeaderIndex(b->data, b->size);
     if (fh == -1) {
         return NULL;
     }
 
     /* The size of the compressed data. */
-    size_t csize = b->size - fh;
+    size_t csize = b->size - (size_t)fh;
 
     bytes *result = bytes_init(csize);
     if (result == NULL) {
@@ -253,133 +503,1263 @@ extern bytes *ZSTD_extract_CompressData(bytes *b) {
 
 
 /**
- * Compresses the given data using the Zstandard algorithm.
- * 
- * @param b: Pointer to the `bytes` structure containing the data to be compressed.
- * @param dict: Pointer to the `bytes` structure containing the dictionary used for compression.
- * @param compressionlevel: Compression level to be used, between the minimum and maximum 
- *                          allowable Zstandard compression levels.
- * @return: A pointer to a new `bytes` structure containing the compressed data, or NULL on failure.
+ * Parses the AoV header of compressed data and locates its frame.
+ *
+ * The stored decompressed size is cross-checked against the content size
+ * of the frame when the frame records one, so a corrupt header is caught
+ * before any output is allocated. Frames without a recorded size are
+ * sized from the header alone.
+ *
+ * @param data: Pointer to the compressed data.
+ * @param size: Number of bytes in `data`.
+ * @param h: Receives the stored size and the frame offset.
+ * @return: `true` if the header is valid, `false` otherwise.
  */
-extern bytes *ZSTD_aov_compress(bytes *b, bytes *dict, int compressionlevel) {
+extern bool ZSTD_aov_parseHeader(const byte *data, size_t size, ZSTD_aov_header *h) {
 
-    ZSTD_CCtx *cctx = ZSTD_createCCtx();
-    if (cctx == NULL) {
-        return NULL;
+    size_t offset = HEADER_SIZE + FRAME_HEADER_SIZE;
+
+    if (size < offset + FRAME_HEADER_SIZE || !ZSTD_isHeader(data)) {
+        return false;
     }
 
-    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+    /* The frame normally follows the header directly; skip anything in between. */
+    ptrdiff_t fh = ZSTD_getFrameHeaderIndex(data + offset, size - offset);
+    if (fh == -1) {
+        return false;
+    }
 
-    ZSTD_CDict *cdict = ZSTD_createCDict(dict->data, dict->size, compressionlevel);
-    if (cdict == NULL) {
-        cleanup_resource(cctx, (cleanup_context_fn)ZSTD_freeCCtx, NULL, NULL, NULL);
-        return NULL;
+    h->dsize = ZSTD_getHeaderSize(data);
+    h->frame = offset + (size_t)fh;
+
+    unsigned long long content_size = ZSTD_getFrameContentSize(data + h->frame, size - h->frame);
+
+    if (content_size == ZSTD_CONTENTSIZE_ERROR) {
+        return false;
+    }
+
+    if (content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != h->dsize) {
+        return false;
     }
 
-    size_t code = ZSTD_CCtx_refCDict(cctx, cdict);
+    return true;
+}
+
+
+/**
+ * Digests a raw dictionary once so it can be shared by every file of a
+ * batch, and by every worker thread, without being parsed again.
+ *
+ * @param dict: Pointer to the `bytes` structure containing the raw dictionary.
+ * @param compressionlevel: Level the compression dictionary is digested for, 
+ *                          or 0 when only decompression is needed.
+ * @return: A pointer to the digested dictionary, or NULL on failure.
+ */
+extern ZSTD_aov_dict *ZSTD_aov_createDict(const bytes *dict, int compressionlevel) {
+
+    return ZSTD_aov_createDict_advanced(dict, compressionlevel, NULL);
+}
+
+
+/**
+ * Prepares a raw dictionary with compression parameters on top of the
+ * level. The parameters are resolved to a full set once, the compression
+ * dictionary is digested with that set and every compression applies it,
+ * so the dictionary is used the same way whatever the size of the input.
+ * Without parameters this is `ZSTD_aov_createDict`, and the output is the
+ * same as with the level alone. The digestion itself is left to the first
+ * file of each direction, and reads `dict`, which must outlive the result.
+ *
+ * @param dict: Pointer to the `bytes` structure containing the raw dictionary.
+ * @param compressionlevel: Level the compression dictionary is digested for, 
+ *                          or 0 when only decompression is needed.
+ * @param p: Parameters set on top of the level, or NULL.
+ * @return: A pointer to the digested dictionary, or NULL on failure.
+ */
+extern ZSTD_aov_dict *ZSTD_aov_createDict_advanced(const bytes *dict, int compressionlevel, const ZSTD_aov_params *p) {
 
-    if (ZSTD_isError(code)) {
-        cleanup_resource(cctx, (cleanup_context_fn)ZSTD_freeCCtx, cdict, (cleanup_dict_fn)ZSTD_freeCDict, NULL);
+    if (dict == NULL || dict->data == NULL) {
         return NULL;
     }
 
-    bytes *result = bytes_init(ZSTD_compressBound(b->size));
+    ZSTD_aov_dict *d = (ZSTD_aov_dict *)calloc(1, sizeof(ZSTD_aov_dict));
+    if (d == NULL) {
+        return NULL;
+    }
 
-    if (result == NULL) {
-        cleanup_resource(cctx, (cleanup_context_fn)ZSTD_freeCCtx, cdict, (cleanup_dict_fn)ZSTD_freeCDict, NULL);
+    if (pthread_mutex_init(&d->lock, NULL) != 0) {
+        free(d);
         return NULL;
     }
 
-    code = ZSTD_CCtx_setPledgedSrcSize(cctx, b->size);
+    d->raw = dict;
+    d->compressionlevel = compressionlevel;
+    d->id = ZSTD_getDictID_fromDict(dict->data, dict->size);
 
-    if (ZSTD_isError(code)) {
-        cleanup_resource(cctx, (cleanup_context_fn)ZSTD_freeCCtx, cdict, (cleanup_dict_fn)ZSTD_freeCDict, result);
-        return NULL;
+    static const ZSTD_aov_params none = { 0 };
+
+    d->advanced = compressionlevel && p != NULL && memcmp(p, &none, sizeof(none)) != 0;
+
+    if (d->advanced) {
+        ZSTD_compressionParameters cp = ZSTD_getCParams(compressionlevel, ZSTD_CONTENTSIZE_UNKNOWN, dict->size);
+
+        if (p->windowLog)    cp.windowLog = (unsigned)p->windowLog;
+        if (p->chainLog)     cp.chainLog = (unsigned)p->chainLog;
+        if (p->hashLog)      cp.hashLog = (unsigned)p->hashLog;
+        if (p->searchLog)    cp.searchLog = (unsigned)p->searchLog;
+        if (p->minMatch)     cp.minMatch = (unsigned)p->minMatch;
+        if (p->targetLength) cp.targetLength = (unsigned)p->targetLength;
+        if (p->strategy)     cp.strategy = (ZSTD_strategy)p->strategy;
+
+        if (ZSTD_isError(ZSTD_checkCParams(cp))) {
+            ZSTD_aov_freeDict(d);
+            return NULL;
+        }
+
+        d->cparams = cp;
+        d->literalCompressionMode = p->literalCompressionMode;
     }
 
-    ZSTD_inBuffer in_buffer = { b->data, b->size, 0 };
-    ZSTD_outBuffer out_buffer = { result->data, result->size, 0 };
+    return d;
+}
 
-    code = ZSTD_compressStream2(cctx, &out_buffer, &in_buffer, ZSTD_e_end);
 
-    if (ZSTD_isError(code) || code) {
-        cleanup_resource(cctx, (cleanup_context_fn)ZSTD_freeCCtx, cdict, (cleanup_dict_fn)ZSTD_freeCDict, result);
+/**
+ * Creates an undigested copy of a digested dictionary, with the same
+ * parameters. Each copy digests its own CDict and DDict on first use, so
+ * a copy used by the workers of one NUMA node has them in local memory.
+ *
+ * @param d: The dictionary to copy.
+ * @return: A pointer to the copy, or NULL on failure.
+ */
+extern ZSTD_aov_dict *ZSTD_aov_cloneDict(const ZSTD_aov_dict *d) {
+
+    ZSTD_aov_dict *copy = (ZSTD_aov_dict *)calloc(1, sizeof(ZSTD_aov_dict));
+    if (copy == NULL) {
         return NULL;
     }
 
-    result->size = out_buffer.pos;
+    if (pthread_mutex_init(&copy->lock, NULL) != 0) {
+        free(copy);
+        return NULL;
+    }
 
-    cleanup_resource(cctx, (cleanup_context_fn)ZSTD_freeCCtx, cdict, (cleanup_dict_fn)ZSTD_freeCDict, NULL);
-    cleanup_resource(NULL, NULL, NULL, NULL, b);
+    copy->raw = d->raw;
+    copy->compressionlevel = d->compressionlevel;
+    copy->advanced = d->advanced;
+    copy->cparams = d->cparams;
+    copy->literalCompressionMode = d->literalCompressionMode;
+    copy->id = d->id;
+    copy->registry = d->registry;
 
-    return ZSTD_setHeader(result, (uint32_t)in_buffer.size);
+    return copy;
 }
 
 
 /**
- * Decompresses the provided data using the Zstandard algorithm.
- * 
- * @param b: Pointer to the `bytes` structure containing the compressed data.
- * @param dict: Pointer to the `bytes` structure containing 
- *              the dictionary used for decompression.
- * @return: A pointer to a new `bytes` structure containing 
- *          the decompressed data, or NULL on failure.
+ * Returns the digested compression dictionary, digesting it on first use.
+ * The first worker digests it while the others wait, then every later
+ * call only loads the pointer.
+ *
+ * @return: The CDict, or NULL when only decompressing or on failure.
  */
-extern bytes *ZSTD_aov_decompress(bytes *b, bytes *dict) {
+static const ZSTD_CDict *ZSTD_aov_digestCDict(const ZSTD_aov_dict *d) {
 
-    if (!ZSTD_isHeader(b->data)) {
-        return b;
+    ZSTD_CDict *cdict = atomic_load_explicit(&d->cdict, memory_order_acquire);
+
+    if (cdict != NULL || !d->compressionlevel) {
+        return cdict;
     }
 
-    b = ZSTD_extract_CompressData(b);
-    if (b == NULL) {
-        return NULL;
+    /* The digested dictionaries are a cache, filled in behind the const. */
+    ZSTD_aov_dict *m = (ZSTD_aov_dict *)d;
+
+    pthread_mutex_lock(&m->lock);
+
+    cdict = atomic_load_explicit(&m->cdict, memory_order_relaxed);
+
+    if (cdict == NULL) {
+        /**
+         * Only `ZSTD_createCDict` records the level in the CDict. Both
+         * `_advanced` constructors, `_advanced2` included, record
+         * `ZSTD_NO_CLEVEL`, and compression then uses the CDict tables for
+         * sources of every size instead of loading the dictionary again
+         * with the level tuned to large sources, which changes their output.
+         * So with only a level this CDict is taken from `malloc`, outside
+         * the zmem mappings (its size is still reserved by
+         * `ZSTD_aov_estimateDict`); with parameters, every one is set
+         * explicitly anyway and zmem backs it.
+         */
+        if (d->advanced) {
+            cdict = ZSTD_createCDict_advanced(d->raw->data, d->raw->size, ZSTD_dlm_byCopy, ZSTD_dct_auto, d->cparams, zmem_customMem());
+        } else {
+            cdict = ZSTD_createCDict(d->raw->data, d->raw->size, d->compressionlevel);
+        }
+
+        atomic_store_explicit(&m->cdict, cdict, memory_order_release);
     }
 
-    ZSTD_DCtx *dctx = ZSTD_createDCtx();
-    if (dctx == NULL) {
-        return NULL;
+    pthread_mutex_unlock(&m->lock);
+
+    return cdict;
+}
+
+
+/**
+ * Returns the digested decompression dictionary, digesting it on first use.
+ *
+ * @return: The DDict, or NULL on failure.
+ */
+static const ZSTD_DDict *ZSTD_aov_digestDDict(const ZSTD_aov_dict *d) {
+
+    ZSTD_DDict *ddict = atomic_load_explicit(&d->ddict, memory_order_acquire);
+
+    if (ddict != NULL) {
+        return ddict;
     }
 
-    ZSTD_DDict *ddict = ZSTD_createDDict(dict->data, dict->size);
+    ZSTD_aov_dict *m = (ZSTD_aov_dict *)d;
+
+    pthread_mutex_lock(&m->lock);
+
+    ddict = atomic_load_explicit(&m->ddict, memory_order_relaxed);
+
     if (ddict == NULL) {
-        cleanup_resource(dctx, (cleanup_context_fn)ZSTD_freeDCtx, NULL, NULL, NULL);
-        return NULL;
+        ddict = ZSTD_createDDict_advanced(d->raw->data, d->raw->size, ZSTD_dlm_byCopy, ZSTD_dct_auto, zmem_customMem());
+
+        atomic_store_explicit(&m->ddict, ddict, memory_order_release);
     }
 
-    size_t code = ZSTD_DCtx_refDDict(dctx, ddict);
-    if (ZSTD_isError(code)) {
-        cleanup_resource(dctx, (cleanup_context_fn)ZSTD_freeDCtx, ddict, (cleanup_dict_fn)ZSTD_freeDDict, NULL);
-        return NULL;
+    pthread_mutex_unlock(&m->lock);
+
+    return ddict;
+}
+
+
+/**
+ * Frees a dictionary created by `ZSTD_aov_createDict`.
+ *
+ * @param d: The dictionary to free, may be NULL.
+ */
+extern void ZSTD_aov_freeDict(ZSTD_aov_dict *d) {
+
+    if (d == NULL) {
+        return;
     }
 
-    size_t output_size = ZSTD_getFrameContentSize(b->data, b->size);
+    cleanup_resource(NULL, NULL, atomic_load(&d->cdict), (cleanup_dict_fn)ZSTD_freeCDict, NULL);
+    cleanup_resource(NULL, NULL, atomic_load(&d->ddict), (cleanup_dict_fn)ZSTD_freeDDict, NULL);
 
-    if (output_size == ZSTD_CONTENTSIZE_ERROR || output_size == ZSTD_CONTENTSIZE_UNKNOWN) {
-        cleanup_resource(dctx, (cleanup_context_fn)ZSTD_freeDCtx, ddict, (cleanup_dict_fn)ZSTD_freeDDict, NULL);
-        return NULL;
+    pthread_mutex_destroy(&d->lock);
+
+    free(d);
+}
+
+
+/**
+ * Creates an empty dictionary registry.
+ *
+ * @return: A pointer to the registry, or NULL on failure.
+ */
+extern ZSTD_aov_registry *ZSTD_aov_createRegistry(void) {
+
+    return (ZSTD_aov_registry *)calloc(1, sizeof(ZSTD_aov_registry));
+}
+
+
+/**
+ * Digests a dictionary for decompression and registers it under its ID.
+ *
+ * @param r: The registry.
+ * @param dict: The raw dictionary.
+ * @param id: Receives the ID of the dictionary, 0 for raw content.
+ * @return: `true` if it was registered, `false` if it has no ID, its ID
+ *          is registered already or it cannot be digested.
+ */
+extern bool ZSTD_aov_registerDict(ZSTD_aov_registry *r, const bytes *dict, unsigned *id) {
+
+    *id = ZSTD_getDictID_fromDict(dict->data, dict->size);
+
+    if (*id == 0 || ZSTD_aov_findDict(r, *id) != NULL) {
+        return false;
     }
 
-    bytes *result = bytes_init(output_size);
+    if (r->count == r->capacity) {
+        size_t capacity = r->capacity ? r->capacity * 2 : 8;
 
-    if (result == NULL) {
-        cleanup_resource(dctx, (cleanup_context_fn)ZSTD_freeDCtx, ddict, (cleanup_dict_fn)ZSTD_freeDDict, NULL);
-        return NULL;
+        ZSTD_DDict **ddicts = (ZSTD_DDict **)realloc(r->ddicts, capacity * sizeof(ZSTD_DDict *));
+        if (ddicts == NULL) {
+            return false;
+        }
+        r->ddicts = ddicts;
+
+        unsigned *ids = (unsigned *)realloc(r->ids, capacity * sizeof(unsigned));
+        if (ids == NULL) {
+            return false;
+        }
+        r->ids = ids;
+
+        r->capacity = capacity;
     }
 
-    ZSTD_inBuffer in_buffer = { b->data, b->size, 0 };
-    ZSTD_outBuffer out_buffer = { result->data, result->size, 0 };
+    ZSTD_DDict *ddict = ZSTD_createDDict_advanced(dict->data, dict->size, ZSTD_dlm_byCopy, ZSTD_dct_fullDict, zmem_customMem());
 
-    code = ZSTD_decompressStream(dctx, &out_buffer, &in_buffer);
+    if (ddict == NULL) {
+        return false;
+    }
 
-    if (ZSTD_isError(code)) {
-        cleanup_resource(dctx, (cleanup_context_fn)ZSTD_freeDCtx, ddict, (cleanup_dict_fn)ZSTD_freeDDict, result);
-        return NULL;
+    r->ddicts[r->count] = ddict;
+    r->ids[r->count] = *id;
+    r->count++;
+
+    return true;
+}
+
+
+/**
+ * Registers every dictionary of a directory (not recursive). Files that
+ * are not Zstandard dictionaries, and IDs registered already, are left out.
+ *
+ * @param r: The registry.
+ * @param dir: The directory to read.
+ * @return: The number of dictionaries registered.
+ */
+extern size_t ZSTD_aov_registerDir(ZSTD_aov_registry *r, const char *dir) {
+
+    DIR *dp = opendir(dir);
+
+    if (dp == NULL) {
+        return 0;
     }
 
-    cleanup_resource(dctx, (cleanup_context_fn)ZSTD_freeDCtx, ddict, (cleanup_dict_fn)ZSTD_freeDDict, NULL);
-    cleanup_resource(NULL, NULL, NULL, NULL, b);
+    struct dirent *entry;
+    size_t count = 0;
 
-    return result;
+    while ((entry = readdir(dp)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        char *path = path_join(dir, entry->d_name);
+        bytes *dict = path && isfile(path) ? read_file(path) : NULL;
+
+        unsigned id;
+
+        if (dict != NULL && ZSTD_aov_registerDict(r, dict, &id)) {
+            count++;
+        }
+
+        bytes_free(dict);
+        free(path);
+    }
+
+    closedir(dp);
+
+    return count;
+}
 
-}
\ No newline at end of file
+
+/**
+ * Finds a registered dictionary by ID.
+ *
+ * @param r: The registry, may be NULL.
+ * @param id: The dictionary ID.
+ * @return: The digested dictionary, or NULL if none has this ID.
+ */
+extern const ZSTD_DDict *ZSTD_aov_findDict(const ZSTD_aov_registry *r, unsigned id) {
+
+    for (size_t i = 0; r != NULL && i < r->count; i++) {
+        if (r->ids[i] == id) {
+            return r->ddicts[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Frees a registry created by `ZSTD_aov_createRegistry`.
+ *
+ * @param r: The registry to free, may be NULL.
+ */
+extern void ZSTD_aov_freeRegistry(ZSTD_aov_registry *r) {
+
+    if (r == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < r->count; i++) {
+        ZSTD_freeDDict(r->ddicts[i]);
+    }
+
+    free(r->ddicts);
+    free(r->ids);
+    free(r);
+}
+
+
+/**
+ * Creates a set of reusable compression and decompression contexts. The
+ * contexts themselves are allocated on first use and keep their working
+ * memory between files. A context set must not be shared between threads.
+ *
+ * @return: A pointer to the context set, or NULL on failure.
+ */
+extern ZSTD_aov_ctx *ZSTD_aov_createCtx(void) {
+
+    return (ZSTD_aov_ctx *)calloc(1, sizeof(ZSTD_aov_ctx));
+}
+
+
+/**
+ * Frees a context set created by `ZSTD_aov_createCtx`.
+ *
+ * @param ctx: The context set to free, may be NULL.
+ */
+extern void ZSTD_aov_freeCtx(ZSTD_aov_ctx *ctx) {
+
+    if (ctx == NULL) {
+        return;
+    }
+
+    cleanup_resource(ctx->cctx, (cleanup_context_fn)ZSTD_freeCCtx, NULL, NULL, NULL);
+    cleanup_resource(ctx->dctx, (cleanup_context_fn)ZSTD_freeDCtx, NULL, NULL, NULL);
+
+    free(ctx);
+}
+
+
+/**
+ * Estimates the working memory of compressing one file with a digested
+ * dictionary: the context sized for the parameters zstd would pick for
+ * the file. The digested dictionary is shared, see `ZSTD_aov_estimateDict`.
+ *
+ * @param d: The digested dictionary.
+ * @param size: The size of the file.
+ * @param streaming: Whether the file goes through `ZSTD_aov_compressStream`.
+ * @return: The estimate in bytes.
+ */
+extern size_t ZSTD_aov_estimateCompress(const ZSTD_aov_dict *d, uint64_t size, bool streaming) {
+
+    size_t dictsize = d->raw ? d->raw->size : 0;
+
+    ZSTD_compressionParameters cp = d->advanced ? d->cparams
+                                  : ZSTD_getCParams(d->compressionlevel, size, dictsize);
+
+    return streaming ? ZSTD_estimateCStreamSize_usingCParams(cp) : ZSTD_estimateCCtxSize_usingCParams(cp);
+}
+
+
+/**
+ * Estimates the working memory of decompressing one file: the context,
+ * plus the window of a streamed frame, which is at most the stored size.
+ *
+ * @param dsize: The decompressed size from the AoV header.
+ * @param streaming: Whether the file goes through `ZSTD_aov_decompressStream`.
+ * @return: The estimate in bytes.
+ */
+extern size_t ZSTD_aov_estimateDecompress(uint64_t dsize, bool streaming) {
+
+    if (!streaming) {
+        return ZSTD_estimateDCtxSize();
+    }
+
+    uint64_t window = (uint64_t)1 << ZSTD_aov_windowLogMax;
+
+    return ZSTD_estimateDStreamSize((size_t)(dsize < window ? dsize : window));
+}
+
+
+/**
+ * Estimates the memory of a digested dictionary, for the directions a run
+ * uses. It is held as long as the dictionary, whatever the files.
+ *
+ * @param d: The dictionary.
+ * @param compress: Whether the run digests it for compression.
+ * @param decompress: Whether the run digests it for decompression.
+ * @return: The estimate in bytes.
+ */
+extern size_t ZSTD_aov_estimateDict(const ZSTD_aov_dict *d, bool compress, bool decompress) {
+
+    size_t dictsize = d->raw ? d->raw->size : 0;
+    size_t estimate = 0;
+
+    if (compress && d->compressionlevel) {
+        ZSTD_compressionParameters cp = d->advanced ? d->cparams : ZSTD_getCParams(d->compressionlevel, 0, dictsize);
+
+        estimate += ZSTD_estimateCDictSize_advanced(dictsize, cp, ZSTD_dlm_byCopy);
+    }
+
+    if (decompress) {
+        estimate += ZSTD_estimateDDictSize(dictsize, ZSTD_dlm_byCopy);
+    }
+
+    return estimate;
+}
+
+
+/**
+ * Returns the compression context of a context set, created on first use
+ * and reset for a new frame with default parameters.
+ */
+static ZSTD_CCtx *ZSTD_aov_resetCCtx(ZSTD_aov_ctx *ctx) {
+
+    if (ctx->cctx == NULL) {
+        ctx->cctx = ZSTD_createCCtx_advanced(zmem_customMem());
+        if (ctx->cctx == NULL) {
+            return NULL;
+        }
+    }
+
+    ZSTD_CCtx_reset(ctx->cctx, ZSTD_reset_session_and_parameters);
+
+    return ctx->cctx;
+}
+
+
+/**
+ * Returns the decompression context of a context set, created on first use
+ * and reset for a new frame with default parameters.
+ */
+static ZSTD_DCtx *ZSTD_aov_resetDCtx(ZSTD_aov_ctx *ctx) {
+
+    if (ctx->dctx == NULL) {
+        ctx->dctx = ZSTD_createDCtx_advanced(zmem_customMem());
+        if (ctx->dctx == NULL) {
+            return NULL;
+        }
+    }
+
+    ZSTD_DCtx_reset(ctx->dctx, ZSTD_reset_session_and_parameters);
+
+    return ctx->dctx;
+}
+
+
+/**
+ * Returns the compression context of a context set, ready for a new frame
+ * referencing the digested dictionary.
+ */
+static ZSTD_CCtx *ZSTD_aov_getCCtx(ZSTD_aov_ctx *ctx, const ZSTD_aov_dict *d) {
+
+    const ZSTD_CDict *cdict = ZSTD_aov_digestCDict(d);
+
+    if (cdict == NULL || ZSTD_aov_resetCCtx(ctx) == NULL) {
+        return NULL;
+    }
+
+    if (ZSTD_isError(ZSTD_CCtx_refCDict(ctx->cctx, cdict))) {
+        return NULL;
+    }
+
+    if (d->advanced) {
+        /* The CDict carries no level here, so every parameter is set explicitly. */
+        const ZSTD_compressionParameters *cp = &d->cparams;
+
+        ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_windowLog, (int)cp->windowLog);
+        ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_chainLog, (int)cp->chainLog);
+        ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_hashLog, (int)cp->hashLog);
+        ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_searchLog, (int)cp->searchLog);
+        ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_minMatch, (int)cp->minMatch);
+        ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_targetLength, (int)cp->targetLength);
+        ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_strategy, (int)cp->strategy);
+        ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_literalCompressionMode, d->literalCompressionMode);
+    }
+
+    return ctx->cctx;
+}
+
+
+/**
+ * Returns the decompression context of a context set, ready for a new
+ * frame referencing the dictionary the frame was compressed with: the
+ * digested dictionary, or the one of the registry with the ID recorded
+ * in the frame header. Frames that record no ID use the digested one.
+ */
+static ZSTD_DCtx *ZSTD_aov_getDCtx(ZSTD_aov_ctx *ctx, const ZSTD_aov_dict *d, const byte *frame, size_t size) {
+
+    if (ZSTD_aov_resetDCtx(ctx) == NULL) {
+        return NULL;
+    }
+
+    const ZSTD_DDict *ddict = NULL;
+    unsigned id = ZSTD_getDictID_fromFrame(frame, size);
+
+    if (id != 0 && id != d->id) {
+        ddict = ZSTD_aov_findDict(d->registry, id);
+    }
+
+    if (ddict == NULL) {
+        ddict = ZSTD_aov_digestDDict(d);
+    }
+
+    if (ddict == NULL || ZSTD_isError(ZSTD_DCtx_refDDict(ctx->dctx, ddict))) {
+        return NULL;
+    }
+
+    return ctx->dctx;
+}
+
+
+/**
+ * Compresses the given data with reusable contexts and a digested dictionary.
+ * 
+ * @param ctx: The context set of the calling thread.
+ * @param b: Pointer to the `bytes` structure containing the data to be compressed.
+ *           It is released whether or not compression succeeds.
+ * @param d: The digested dictionary, created with a non-zero compression level.
+ * @return: A pointer to a new `bytes` structure containing the AoV header and 
+ *          the compressed data, or NULL on failure.
+ */
+extern bytes *ZSTD_aov_compress_usingDict(ZSTD_aov_ctx *ctx, bytes *b, const ZSTD_aov_dict *d) {
+
+    ZSTD_CCtx *cctx = b->size <= HEADER_DSIZE_MAX ? ZSTD_aov_getCCtx(ctx, d) : NULL;
+
+    if (cctx == NULL || ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(cctx, b->size))) {
+        bytes_free(b);
+        return NULL;
+    }
+
+    /* Compress right after the header so it does not have to be prepended with a copy. */
+    size_t offset = HEADER_SIZE + FRAME_HEADER_SIZE;
+
+    bytes *result = bytes_init(offset + ZSTD_compressBound(b->size));
+
+    if (result == NULL || result->data == NULL) {
+        cleanup_resource(NULL, NULL, NULL, NULL, result);
+        bytes_free(b);
+        return NULL;
+    }
+
+    ZSTD_inBuffer in_buffer = { b->data, b->size, 0 };
+    ZSTD_outBuffer out_buffer = { result->data + offset, result->size - offset, 0 };
+
+    size_t code = ZSTD_compressStream2(cctx, &out_buffer, &in_buffer, ZSTD_e_end);
+
+    if (ZSTD_isError(code) || code) {
+        cleanup_resource(NULL, NULL, NULL, NULL, result);
+        bytes_free(b);
+        return NULL;
+    }
+
+    memcpy(result->data, HEADER, HEADER_SIZE);
+
+    for (int i = 0; i < FRAME_HEADER_SIZE; i++) {
+        result->data[HEADER_SIZE + i] = ((uint32_t)b->size >> (8 * i)) & 0xFF;
+    }
+
+    result->size = offset + out_buffer.pos;
+
+    bytes_free(b);
+
+    return result;
+}
+
+
+/**
+ * Compresses data and compares the frame with an expected one as it is
+ * produced, a chunk at a time. Compression stops at the first chunk that
+ * differs, usually within the first block, so a wrong setting costs far
+ * less than a full compression.
+ *
+ * @param ctx: The context set of the calling thread.
+ * @param src: The data to compress.
+ * @param size: Size of `src`.
+ * @param frame: The expected Zstandard frame.
+ * @param frame_size: Size of `frame`.
+ * @param d: The digested dictionary, created with a non-zero compression level.
+ * @return: `true` if the frame is reproduced byte for byte, `false` otherwise.
+ */
+extern bool ZSTD_aov_matchFrame(ZSTD_aov_ctx *ctx, const byte *src, size_t size, 
+                                const byte *frame, size_t frame_size, const ZSTD_aov_dict *d) {
+
+    ZSTD_CCtx *cctx = ZSTD_aov_getCCtx(ctx, d);
+
+    /**
+     * The input stays in place until the frame is done, so it is read from
+     * where it is instead of through the internal buffer. This gives the
+     * frame of a single call with room for all of it, as the compression
+     * of files does, even when the input is larger than the window.
+     */
+    if (cctx == NULL || ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(cctx, size))
+        || ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_stableInBuffer, 1))) {
+        return false;
+    }
+
+    byte chunk[16 * 1024];
+
+    ZSTD_inBuffer in_buffer = { src, size, 0 };
+    size_t pos = 0;
+    size_t remaining;
+
+    do {
+        ZSTD_outBuffer out_buffer = { chunk, sizeof(chunk), 0 };
+
+        remaining = ZSTD_compressStream2(cctx, &out_buffer, &in_buffer, ZSTD_e_end);
+
+        if (ZSTD_isError(remaining) || out_buffer.pos > frame_size - pos 
+            || memcmp(chunk, frame + pos, out_buffer.pos) != 0) {
+            /* The context is reset for its next frame. */
+            return false;
+        }
+
+        pos += out_buffer.pos;
+
+    } while (remaining);
+
+    return pos == frame_size;
+}
+
+
+/**
+ * Returns the window log a patch needs to reach any byte of the reference
+ * from any byte of the new content.
+ */
+static int ZSTD_aov_patchWindowLog(size_t refsize, size_t size) {
+
+    unsigned long long span = (unsigned long long)refsize + size;
+    int wlog = ZSTD_WINDOWLOG_MIN;
+
+    while (wlog < ZSTD_WINDOWLOG_MAX && (1ULL << wlog) < span) {
+        wlog++;
+    }
+
+    return wlog;
+}
+
+
+/**
+ * Compresses content as a patch against a previous version of it, in the
+ * style of `zstd --patch-from`: the previous version is referenced as a
+ * prefix, with a window that covers both and long-distance matching, so
+ * the unchanged parts cost a few bytes wherever they moved. The game
+ * dictionary is not used. The patch starts with `PATCH_HEADER`, the size
+ * of the content and the XXH64 hash of the reference, then the frame.
+ *
+ * @param ctx: The context set of the calling thread.
+ * @param ref: The previous version, decompressed. May be empty.
+ * @param b: The new version, decompressed. It is released whether or not
+ *           compression succeeds.
+ * @param compressionlevel: The compression level.
+ * @return: A pointer to a new `bytes` structure containing the patch,
+ *          or NULL on failure.
+ */
+extern bytes *ZSTD_aov_compressPatch(ZSTD_aov_ctx *ctx, const bytes *ref, bytes *b, int compressionlevel) {
+
+    ZSTD_CCtx *cctx = ZSTD_aov_resetCCtx(ctx);
+
+    bool ok = cctx != NULL && b->size <= HEADER_DSIZE_MAX
+        && !ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, compressionlevel))
+        && !ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, ZSTD_aov_patchWindowLog(ref->size, b->size)))
+        && !ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, ZSTD_ps_enable))
+        && !ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1))
+        && !ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(cctx, b->size))
+        && !ZSTD_isError(ZSTD_CCtx_refPrefix(cctx, ref->data, ref->size));
+
+    bytes *result = ok ? bytes_init(PATCH_HEADER_SIZE + ZSTD_compressBound(b->size)) : NULL;
+
+    if (result == NULL || result->data == NULL) {
+        cleanup_resource(NULL, NULL, NULL, NULL, result);
+        bytes_free(b);
+        return NULL;
+    }
+
+    ZSTD_inBuffer in_buffer = { b->data, b->size, 0 };
+    ZSTD_outBuffer out_buffer = { result->data + PATCH_HEADER_SIZE, result->size - PATCH_HEADER_SIZE, 0 };
+
+    size_t code = ZSTD_compressStream2(cctx, &out_buffer, &in_buffer, ZSTD_e_end);
+
+    if (ZSTD_isError(code) || code) {
+        cleanup_resource(NULL, NULL, NULL, NULL, result);
+        bytes_free(b);
+        return NULL;
+    }
+
+    uint64_t hash = hash64(ref->data, ref->size, 0);
+
+    memcpy(result->data, PATCH_HEADER, HEADER_SIZE);
+
+    for (int i = 0; i < FRAME_HEADER_SIZE; i++) {
+        result->data[HEADER_SIZE + i] = ((uint32_t)b->size >> (8 * i)) & 0xFF;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        result->data[HEADER_SIZE + FRAME_HEADER_SIZE + i] = (hash >> (8 * i)) & 0xFF;
+    }
+
+    result->size = PATCH_HEADER_SIZE + out_buffer.pos;
+
+    bytes_free(b);
+
+    return result;
+}
+
+
+/**
+ * Checks whether data is a patch written by `ZSTD_aov_compressPatch`.
+ *
+ * @param data: The data.
+ * @param size: Size of `data`.
+ * @return: `true` if it starts with a complete patch header.
+ */
+extern bool ZSTD_isPatch(const byte *data, size_t size) {
+
+    return size >= PATCH_HEADER_SIZE && memcmp(data, PATCH_HEADER, HEADER_SIZE) == 0;
+}
+
+
+/**
+ * Applies a patch written by `ZSTD_aov_compressPatch` to the version it
+ * was made against. A reference whose hash differs from the one recorded
+ * in the patch is refused, rather than giving wrong content.
+ *
+ * @param ctx: The context set of the calling thread.
+ * @param ref: The previous version, decompressed.
+ * @param b: The patch. It is released whether or not it applies.
+ * @param error: Receives the reason of a failure.
+ * @return: A pointer to a new `bytes` structure containing the new
+ *          version, or NULL on failure.
+ */
+extern bytes *ZSTD_aov_decompressPatch(ZSTD_aov_ctx *ctx, const bytes *ref, bytes *b, const char **error) {
+
+    *error = NULL;
+
+    if (!ZSTD_isPatch(b->data, b->size)) {
+        *error = "not a patch";
+        bytes_free(b);
+        return NULL;
+    }
+
+    uint32_t dsize = ZSTD_getHeaderSize(b->data);
+    uint64_t hash = 0;
+
+    for (int i = 0; i < 8; i++) {
+        hash |= (uint64_t)b->data[HEADER_SIZE + FRAME_HEADER_SIZE + i] << (8 * i);
+    }
+
+    if (hash != hash64(ref->data, ref->size, 0)) {
+        *error = "the previous version does not match the one the patch was made from";
+        bytes_free(b);
+        return NULL;
+    }
+
+    ZSTD_DCtx *dctx = ZSTD_aov_resetDCtx(ctx);
+
+    bytes *result = NULL;
+
+    if (dctx != NULL
+        && !ZSTD_isError(ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, ZSTD_WINDOWLOG_MAX))
+        && !ZSTD_isError(ZSTD_DCtx_refPrefix(dctx, ref->data, ref->size))) {
+        result = bytes_init(dsize);
+    }
+
+    if (result == NULL || result->data == NULL) {
+        *error = "out of memory";
+        cleanup_resource(NULL, NULL, NULL, NULL, result);
+        bytes_free(b);
+        return NULL;
+    }
+
+    size_t code = ZSTD_decompressDCtx(dctx, result->data, dsize, b->data + PATCH_HEADER_SIZE, b->size - PATCH_HEADER_SIZE);
+
+    bytes_free(b);
+
+    if (ZSTD_isError(code) || code != dsize) {
+        *error = "corrupt patch";
+        cleanup_resource(NULL, NULL, NULL, NULL, result);
+        return NULL;
+    }
+
+    return result;
+}
+
+
+/**
+ * Decompresses the given data with reusable contexts and a digested dictionary.
+ * Data without the AoV header is returned unchanged.
+ * 
+ * @param ctx: The context set of the calling thread.
+ * @param b: Pointer to the `bytes` structure containing the compressed data.
+ *           It is released unless it is returned unchanged.
+ * @param d: The digested dictionary.
+ * @return: A pointer to a `bytes` structure containing the decompressed 
+ *          data, or NULL on failure.
+ */
+extern bytes *ZSTD_aov_decompress_usingDict(ZSTD_aov_ctx *ctx, bytes *b, const ZSTD_aov_dict *d) {
+
+    if (b->size < HEADER_SIZE || !ZSTD_isHeader(b->data)) {
+        return b;
+    }
+
+    ZSTD_aov_header h;
+
+    if (!ZSTD_aov_parseHeader(b->data, b->size, &h)) {
+        bytes_free(b);
+        return NULL;
+    }
+
+    /* The stored size is exact, so the output is allocated once. */
+    bytes *result = bytes_init(h.dsize);
+
+    if (result == NULL || (result->data == NULL && h.dsize)) {
+        cleanup_resource(NULL, NULL, NULL, NULL, result);
+        bytes_free(b);
+        return NULL;
+    }
+
+    bool ok = ZSTD_aov_decompressInto(ctx, b, &h, d, result->data);
+
+    bytes_free(b);
+
+    if (!ok) {
+        bytes_free(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+
+/**
+ * Decompresses AoV data straight into a caller-provided buffer, such as
+ * a memory-mapped output file, without copying the frame first.
+ *
+ * @param ctx: The context set of the calling thread.
+ * @param b: The compressed data, left untouched.
+ * @param h: The header parsed from `b` by `ZSTD_aov_parseHeader`.
+ * @param d: The digested dictionary.
+ * @param dst: The output buffer, at least `h->dsize` bytes.
+ * @return: `true` if exactly `h->dsize` bytes were decoded, `false` otherwise.
+ */
+extern bool ZSTD_aov_decompressInto(ZSTD_aov_ctx *ctx, const bytes *b, const ZSTD_aov_header *h, 
+                                    const ZSTD_aov_dict *d, byte *dst) {
+
+    ZSTD_DCtx *dctx = ZSTD_aov_getDCtx(ctx, d, b->data + h->frame, b->size - h->frame);
+    if (dctx == NULL) {
+        return false;
+    }
+
+    size_t code = ZSTD_decompressDCtx(dctx, dst, h->dsize, b->data + h->frame, b->size - h->frame);
+
+    return !ZSTD_isError(code) && code == h->dsize;
+}
+
+
+/**
+ * Compresses the given data using the Zstandard algorithm.
+ *
+ * Convenience wrapper that digests the dictionary for a single call; use
+ * `ZSTD_aov_compress_usingDict` when processing more than one file.
+ * 
+ * @param b: Pointer to the `bytes` structure containing the data to be compressed.
+ * @param dict: Pointer to the `bytes` structure containing the dictionary used for compression.
+ * @param compressionlevel: Compression level to be used, between the minimum and maximum 
+ *                          allowable Zstandard compression levels.
+ * @return: A pointer to a new `bytes` structure containing the compressed data, or NULL on failure.
+ */
+extern bytes *ZSTD_aov_compress(bytes *b, bytes *dict, int compressionlevel) {
+
+    ZSTD_aov_dict *d = ZSTD_aov_createDict(dict, compressionlevel);
+    ZSTD_aov_ctx *ctx = ZSTD_aov_createCtx();
+
+    bytes *result = NULL;
+
+    if (d && ctx) {
+        result = ZSTD_aov_compress_usingDict(ctx, b, d);
+    } else {
+        bytes_free(b);
+    }
+
+    ZSTD_aov_freeCtx(ctx);
+    ZSTD_aov_freeDict(d);
+
+    return result;
+}
+
+
+/**
+ * Decompresses the provided data using the Zstandard algorithm.
+ *
+ * Convenience wrapper that digests the dictionary for a single call; use
+ * `ZSTD_aov_decompress_usingDict` when processing more than one file.
+ * 
+ * @param b: Pointer to the `bytes` structure containing the compressed data.
+ * @param dict: Pointer to the `bytes` structure containing 
+ *              the dictionary used for decompression.
+ * @return: A pointer to a new `bytes` structure containing 
+ *          the decompressed data, or NULL on failure.
+ */
+extern bytes *ZSTD_aov_decompress(bytes *b, bytes *dict) {
+
+    if (b->size < HEADER_SIZE || !ZSTD_isHeader(b->data)) {
+        return b;
+    }
+
+    ZSTD_aov_dict *d = ZSTD_aov_createDict(dict, 0);
+    ZSTD_aov_ctx *ctx = ZSTD_aov_createCtx();
+
+    bytes *result = NULL;
+
+    if (d && ctx) {
+        result = ZSTD_aov_decompress_usingDict(ctx, b, d);
+    } else {
+        bytes_free(b);
+    }
+
+    ZSTD_aov_freeCtx(ctx);
+    ZSTD_aov_freeDict(d);
+
+    return result;
+}
+
+
+/**
+ * Copies a stream to another unchanged, after an already read prefix.
+ *
+ * @return: The number of bytes written, or -1 on failure.
+ */
+static long long copy_stream(FILE *in, FILE *out, const byte *prefix, size_t prefix_size, byte *buffer, size_t buffer_size) {
+
+    long long total = 0;
+
+    if (fwrite(prefix, 1, prefix_size, out) != prefix_size) {
+        return -1;
+    }
+
+    total += prefix_size;
+
+    size_t n;
+
+    while ((n = fread(buffer, 1, buffer_size, in)) > 0) {
+        if (fwrite(buffer, 1, n, out) != n) {
+            return -1;
+        }
+        total += n;
+    }
+
+    return ferror(in) ? -1 : total;
+}
+
+
+/**
+ * Compresses a stream into the Arena of Valor format.
+ *
+ * The AoV header stores the decompressed size in front of the frame, so
+ * the size must be known before the first byte is written. When the input
+ * is a regular file the remaining size is pledged and the data is
+ * compressed chunk by chunk in constant memory; pipes are buffered whole
+ * first and compressed exactly like `ZSTD_aov_compress`. Content past
+ * `HEADER_DSIZE_MAX` fails before anything is written.
+ *
+ * @param ctx: The context set of the calling thread.
+ * @param in: The stream holding the decompressed data.
+ * @param out: The stream receiving the compressed data.
+ * @param d: The digested dictionary, created with a non-zero compression level.
+ * @param passthrough: If not NULL, input starting with this header is copied unchanged.
+ * @return: The number of bytes written, or -1 on failure.
+ */
+extern long long ZSTD_aov_compressStream(ZSTD_aov_ctx *ctx, FILE *in, FILE *out, const ZSTD_aov_dict *d, const byte *passthrough) {
+
+    uint64_t pledged;
+
+    if (!stream_remaining(in, &pledged)) {
+
+        bytes *b = read_stream(in);
+        if (b == NULL) {
+            return -1;
+        }
+
+        if (passthrough && b->size >= HEADER_SIZE && ZSTD_isNotDecompressedData(b->data, passthrough)) {
+            /* Pass. */
+        } else {
+            b = ZSTD_aov_compress_usingDict(ctx, b, d);
+            if (b == NULL) {
+                return -1;
+            }
+        }
+
+        long long written = fwrite(b->data, 1, b->size, out) == b->size ? (long long)b->size : -1;
+
+        bytes_free(b);
+
+        return written;
+    }
+
+    size_t in_size = ZSTD_CStreamInSize();
+    size_t out_size = ZSTD_CStreamOutSize();
+
+    byte *in_data = (byte *)malloc(in_size);
+    byte *out_data = (byte *)malloc(out_size);
+
+    ZSTD_CCtx *cctx = ZSTD_aov_getCCtx(ctx, d);
+
+    long long written = -1;
+
+    if (in_data == NULL || out_data == NULL || cctx == NULL) {
+        goto cleanup;
+    }
+
+    size_t n = fread(in_data, 1, in_size, in);
+
+    if (passthrough && n >= HEADER_SIZE && ZSTD_isNotDecompressedData(in_data, passthrough)) {
+        written = copy_stream(in, out, in_data, n, out_data, out_size);
+        goto cleanup;
+    }
+
+    if (pledged > HEADER_DSIZE_MAX || ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(cctx, pledged))) {
+        goto cleanup;
+    }
+
+    byte header[HEADER_SIZE + FRAME_HEADER_SIZE];
+
+    memcpy(header, HEADER, HEADER_SIZE);
+
+    for (int i = 0; i < FRAME_HEADER_SIZE; i++) {
+        header[HEADER_SIZE + i] = ((uint32_t)pledged >> (8 * i)) & 0xFF;
+    }
+
+    if (fwrite(header, 1, sizeof(header), out) != sizeof(header)) {
+        goto cleanup;
+    }
+
+    long long total = sizeof(header);
+    uint64_t consumed = 0;
+
+    for (;;) {
+        consumed += n;
+
+        ZSTD_EndDirective mode = consumed >= pledged || n < in_size ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer in_buffer = { in_data, n, 0 };
+        size_t remaining;
+
+        do {
+            ZSTD_outBuffer out_buffer = { out_data, out_size, 0 };
+
+            remaining = ZSTD_compressStream2(cctx, &out_buffer, &in_buffer, mode);
+
+            if (ZSTD_isError(remaining) || fwrite(out_data, 1, out_buffer.pos, out) != out_buffer.pos) {
+                goto cleanup;
+            }
+
+            total += out_buffer.pos;
+
+        } while (mode == ZSTD_e_end ? remaining != 0 : in_buffer.pos < in_buffer.size);
+
+        if (mode == ZSTD_e_end) {
+            break;
+        }
+
+        n = fread(in_data, 1, in_size, in);
+    }
+
+    written = total;
+
+cleanup:
+    free(in_data);
+    free(out_data);
+
+    return written;
+}
+
+
+/**
+ * Decompresses an Arena of Valor stream chunk by chunk in constant memory.
+ *
+ * The 8-byte AoV header is parsed from the first chunk, the Zstandard
+ * frame is located after it and decoded as the input arrives. Input that
+ * does not start with the AoV header is copied unchanged, like
+ * `ZSTD_aov_decompress` does for buffers. A frame that decodes to more
+ * than the size stored in the header fails as soon as it goes past it.
+ *
+ * @param ctx: The context set of the calling thread.
+ * @param in: The stream holding the compressed data.
+ * @param out: The stream receiving the decompressed data.
+ * @param d: The digested dictionary.
+ * @return: The number of bytes written, or -1 on failure.
+ */
+extern long long ZSTD_aov_decompressStream(ZSTD_aov_ctx *ctx, FILE *in, FILE *out, const ZSTD_aov_dict *d) {
+
+    size_t in_size = ZSTD_DStreamInSize();
+    size_t out_size = ZSTD_DStreamOutSize();
+
+    byte *in_data = (byte *)malloc(in_size);
+    byte *out_data = (byte *)malloc(out_size);
+
+    long long written = -1;
+
+    if (in_data == NULL || out_data == NULL) {
+        goto cleanup;
+    }
+
+    size_t n = fread(in_data, 1, in_size, in);
+
+    if (n < HEADER_SIZE + FRAME_HEADER_SIZE || !ZSTD_isHeader(in_data)) {
+        written = copy_stream(in, out, in_data, n, out_data, out_size);
+        goto cleanup;
+    }
+
+    uint32_t dsize = ZSTD_getHeaderSize(in_data);
+
+    /* The frame normally follows the header directly; skip anything in between. */
+    ptrdiff_t fh = ZSTD_getFrameHeaderIndex(in_data + HEADER_SIZE + FRAME_HEADER_SIZE, n - HEADER_SIZE - FRAME_HEADER_SIZE);
+    if (fh == -1) {
+        goto cleanup;
+    }
+
+    size_t frame = HEADER_SIZE + FRAME_HEADER_SIZE + (size_t)fh;
+
+    ZSTD_DCtx *dctx = ZSTD_aov_getDCtx(ctx, d, in_data + frame, n - frame);
+    if (dctx == NULL) {
+        goto cleanup;
+    }
+
+    ZSTD_inBuffer in_buffer = { in_data, n, frame };
+    long long total = 0;
+    size_t code = 1;
+
+    for (;;) {
+        while (in_buffer.pos < in_buffer.size) {
+            ZSTD_outBuffer out_buffer = { out_data, out_size, 0 };
+
+            code = ZSTD_decompressStream(dctx, &out_buffer, &in_buffer);
+
+            if (ZSTD_isError(code) || (uint64_t)total + out_buffer.pos > dsize
+                || fwrite(out_data, 1, out_buffer.pos, out) != out_buffer.pos) {
+                goto cleanup;
+            }
+
+            total += out_buffer.pos;
+
+            if (code == 0) {
+                break;
+            }
+        }
+
+        if (code == 0) {
+            break;
+        }
+
+        n = fread(in_data, 1, in_size, in);
+
+        if (n == 0) {
+            /* Truncated frame. */
+            goto cleanup;
+        }
+
+        in_buffer.size = n;
+        in_buffer.pos = 0;
+    }
+
+    if ((uint64_t)total != dsize) {
+        goto cleanup;
+    }
+
+    written = total;
+
+cleanup:
+    free(in_data);
+    free(out_data);
+
+    return written;
+}
@@ -6,6 +6,10 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
+
+/* For `ZSTD_customMem` and the `_advanced` constructors. */
+#define ZSTD_STATIC_LINKING_ONLY
 
 #ifdef _WIN32
 #   include "zstd.h"
@@ -19,6 +23,15 @@
 #define HEADER_SIZE               4
 #define FRAME_HEADER_SIZE         4
 
+/* Patch header: magic, size of the new content and XXH64 hash of the reference. */
+#define PATCH_HEADER_SIZE         (HEADER_SIZE + FRAME_HEADER_SIZE + 8)
+
+/**
+ * Largest content the AoV header can describe: its size field has 32 bits.
+ * Larger content is refused instead of being written with a truncated size.
+ */
+#define HEADER_DSIZE_MAX          0xFFFFFFFFull
+
 /**
  * The compression level for Arena of Valor game files.
  * After testing, it was determined that the optimal compression level 
@@ -26,15 +39,142 @@
  */ 
 #define ZSTD_aov_compressionlevel 19
 
+/**
+ * Largest window the game decodes. Zstandard decoders refuse windows above
+ * 2^27 unless told otherwise, so larger windows would not load in game.
+ */
+#define ZSTD_aov_windowLogMax     27
+
+
+/**
+ * Compression parameters set on top of a compression level, by a named
+ * profile or on the command line. Fields left at 0 keep the value the
+ * level gives them.
+ */
+struct ZSTD_aov_params {
+    int windowLog;
+    int chainLog;
+    int hashLog;
+    int searchLog;
+    int minMatch;
+    int targetLength;
+
+    /* A `ZSTD_strategy`, from ZSTD_fast (1) to ZSTD_btultra2 (9). */
+    int strategy;
+
+    /* A `ZSTD_paramSwitch_e`: auto (0), enable (1) or disable (2) Huffman literals. */
+    int literalCompressionMode;
+};
+
+typedef struct ZSTD_aov_params ZSTD_aov_params;
+
+
+/**
+ * A named set of compression level and parameters.
+ */
+struct ZSTD_aov_profile {
+    const char *name;
+    int compressionlevel;
+    ZSTD_aov_params params;
+};
+
+typedef struct ZSTD_aov_profile ZSTD_aov_profile;
+
+
+/**
+ * Decompression dictionaries known to a run, found by the dictionary ID
+ * Zstandard frames record, so files of other branches and regions decode
+ * with their own dictionary. Shared, read-only, by every worker.
+ */
+struct ZSTD_aov_registry {
+    /* Digested dictionaries, and the IDs they are found by. */
+    ZSTD_DDict **ddicts;
+    unsigned *ids;
+
+    size_t count;
+    size_t capacity;
+};
+
+typedef struct ZSTD_aov_registry ZSTD_aov_registry;
+
+
+/**
+ * A dictionary digested once for both directions and shared by every file
+ * and worker of a run. Each direction is digested by the first file that
+ * needs it, so a run pays only for the ones it uses.
+ */
+struct ZSTD_aov_dict {
+    /* The raw dictionary. Not owned, it must outlive the digested one. */
+    const bytes *raw;
+
+    /* Digested compression dictionary, NULL until used or when only decompressing. */
+    _Atomic(ZSTD_CDict *) cdict;
+
+    /* Digested decompression dictionary, NULL until used. */
+    _Atomic(ZSTD_DDict *) ddict;
+
+    /* Serializes the digestion of either dictionary. */
+    pthread_mutex_t lock;
+
+    /* Compression level the CDict was digested for. */
+    int compressionlevel;
+
+    /* Whether `cparams` is set on every compression, for profiles and overrides. */
+    bool advanced;
+
+    /* The full parameters the CDict was digested with, when `advanced`. */
+    ZSTD_compressionParameters cparams;
+    int literalCompressionMode;
+
+    /* Dictionary ID, 0 for a raw content dictionary. */
+    unsigned id;
+
+    /* Dictionaries of other IDs decompression may pick, or NULL. Not owned. */
+    const ZSTD_aov_registry *registry;
+};
+
+typedef struct ZSTD_aov_dict ZSTD_aov_dict;
+
+
+/**
+ * Reusable Zstandard contexts owned by a single thread. Keeping them
+ * between files avoids reallocating the window and match tables.
+ */
+struct ZSTD_aov_ctx {
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+};
+
+typedef struct ZSTD_aov_ctx ZSTD_aov_ctx;
+
+
+/**
+ * The parsed AoV header of a compressed buffer.
+ */
+struct ZSTD_aov_header {
+    /* Decompressed size stored after the AoV header, checked against the frame. */
+    uint32_t dsize;
+
+    /* Offset of the Zstandard frame in the buffer. */
+    size_t frame;
+};
+
+typedef struct ZSTD_aov_header ZSTD_aov_header;
+
 
 extern const byte HEADER[HEADER_SIZE];
 extern const byte FRAME_HEADER[FRAME_HEADER_SIZE];
+extern const byte PATCH_HEADER[HEADER_SIZE];
 
 extern bool ZSTD_checkCLevel(const int clevel);
+extern const ZSTD_aov_profile *ZSTD_aov_getProfile(const char *name);
+extern bool ZSTD_aov_parseParams(const char *spec, ZSTD_aov_params *p, char *error, size_t errsize);
+extern char *ZSTD_aov_formatParams(const ZSTD_aov_params *p, char *out, size_t size);
 extern bool ZSTD_isHeader(const byte *data);
+extern uint32_t ZSTD_getHeaderSize(const byte *data);
 extern bool ZSTD_isNotDecompressedData(byte *data, const byte *header);
 
-extern int ZSTD_getFrameHeaderIndex(const byte *data, size_t size);
+extern ptrdiff_t ZSTD_getFrameHeaderIndex(const byte *data, size_t size);
 
 extern bytes *ZSTD_setHeader(bytes *b, uint32_t dsize);
 extern bytes *ZSTD_loadDictionary(const char *path);
@@ -42,4 +182,42 @@ extern bytes *ZSTD_extract_CompressData(bytes *b);
 extern bytes *ZSTD_aov_compress(bytes *b, bytes *dict, int compressionlevel);
 extern bytes *ZSTD_aov_decompress(bytes *b, bytes *dict);
 
+extern bool ZSTD_aov_parseHeader(const byte *data, size_t size, ZSTD_aov_header *h);
+
+extern ZSTD_aov_dict *ZSTD_aov_createDict(const bytes *dict, int compressionlevel);
+extern ZSTD_aov_dict *ZSTD_aov_createDict_advanced(const bytes *dict, int compressionlevel, const ZSTD_aov_params *p);
+extern ZSTD_aov_dict *ZSTD_aov_cloneDict(const ZSTD_aov_dict *d);
+extern void ZSTD_aov_freeDict(ZSTD_aov_dict *d);
+
+extern ZSTD_aov_registry *ZSTD_aov_createRegistry(void);
+extern bool ZSTD_aov_registerDict(ZSTD_aov_registry *r, const bytes *dict, unsigned *id);
+extern size_t ZSTD_aov_registerDir(ZSTD_aov_registry *r, const char *dir);
+extern const ZSTD_DDict *ZSTD_aov_findDict(const ZSTD_aov_registry *r, unsigned id);
+extern void ZSTD_aov_freeRegistry(ZSTD_aov_registry *r);
+
+extern ZSTD_aov_ctx *ZSTD_aov_createCtx(void);
+extern void ZSTD_aov_freeCtx(ZSTD_aov_ctx *ctx);
+extern size_t ZSTD_aov_estimateCompress(const ZSTD_aov_dict *d, uint64_t size, bool streaming);
+extern size_t ZSTD_aov_estimateDecompress(uint64_t dsize, bool streaming);
+extern size_t ZSTD_aov_estimateDict(const ZSTD_aov_dict *d, bool compress, bool decompress);
+
+extern bytes *ZSTD_aov_compress_usingDict(ZSTD_aov_ctx *ctx, bytes *b, const ZSTD_aov_dict *d);
+extern bytes *ZSTD_aov_decompress_usingDict(ZSTD_aov_ctx *ctx, bytes *b, const ZSTD_aov_dict *d);
+extern bool ZSTD_aov_matchFrame(ZSTD_aov_ctx *ctx, const byte *src, size_t size, 
+                                const byte *frame, size_t frame_size, const ZSTD_aov_dict *d);
+extern bool ZSTD_aov_decompressInto(ZSTD_aov_ctx *ctx, const bytes *b, const ZSTD_aov_header *h, 
+                                    const ZSTD_aov_dict *d, byte *dst);
+
+extern bool ZSTD_isPatch(const byte *data, size_t size);
+extern bytes *ZSTD_aov_compressPatch(ZSTD_aov_ctx *ctx, const bytes *ref, bytes *b, int compressionlevel);
+extern bytes *ZSTD_aov_decompressPatch(ZSTD_aov_ctx *ctx, const bytes *ref, bytes *b, const char **error);
+
+extern long long ZSTD_aov_compressStream(ZSTD_aov_ctx *ctx, FILE *in, FILE *out, const ZSTD_aov_dict *d, const byte *passthrough);
+extern long long ZSTD_aov_decompressStream(ZSTD_aov_ctx *ctx, FILE *in, FILE *out, const ZSTD_aov_dict *d);
+
+#ifdef __linux__
+/* ISA level the Zstandard calls run on, defined only by the dispatching release build. */
+extern const char *ZSTD_aov_isa(void) __attribute__((weak));
+#endif
+
 #endif
@@ -0,0 +1,82 @@
+
+
+/**
+ * Checks that the ring buffers of the logger wrap around correctly: logs
+ * several rings' worth of short records, of every length modulo the record
+ * alignment so every amount of room left before the end of the ring is
+ * met, and reads them back in order, each exactly once.
+ *
+ * Usage: log_wrap [FILE]
+ * Exits with 1 on a missing, repeated or reordered record. A flusher that
+ * hangs is caught by an alarm.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+
+/* Records logged, enough to fill the ring many times over. */
+#define WRAP_RECORDS              20000
+
+/* Seconds the whole test may take before it is taken for a hang. */
+#define WRAP_TIMEOUT              30
+
+
+int main(int argc, char *argv[]) {
+
+    const char *path = argc > 1 ? argv[1] : "./log_wrap.log";
+
+    FILE *fptr = fopen(path, "w+");
+
+    if (fptr == NULL) {
+        fprintf(stderr, "Cannot open %s.\n", path);
+        return 1;
+    }
+
+    alarm(WRAP_TIMEOUT);
+
+    static const char filler[] = "................................................................";
+    size_t logged = 0;
+
+    log_init(fptr, LOG_INFO, LOG_FORMAT_TEXT);
+
+    for (int i = 0; i < WRAP_RECORDS; i++) {
+        log_info("r%06d %.*s", i, i % 61, filler);
+        logged += 8 + (size_t)(i % 61);
+    }
+
+    log_shutdown();
+
+    rewind(fptr);
+
+    char line[256];
+    int expected = 0;
+
+    while (fgets(line, sizeof(line), fptr)) {
+        int n;
+
+        if (sscanf(line, "[INFO   ] r%d", &n) != 1 || n != expected) {
+            fprintf(stderr, "Record %d expected, got: %s", expected, line);
+            fclose(fptr);
+            return 1;
+        }
+
+        expected++;
+    }
+
+    fclose(fptr);
+    remove(path);
+
+    if (expected != WRAP_RECORDS) {
+        fprintf(stderr, "%d of %d records written.\n", expected, WRAP_RECORDS);
+        return 1;
+    }
+
+    printf("%d records (%zu bytes of messages) through a ring of %d bytes.\n", expected, logged, LOG_RING_SIZE);
+
+    return 0;
+}